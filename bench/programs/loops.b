@@ -0,0 +1,3 @@
+; Nested counting loops: four levels of 40 around an innermost loop which steps
+; by two so that it is not lowered to a multiply; prints A and a newline
+++++++++++++++++++++++++++++++++++++++++[>++++++++++++++++++++++++++++++++++++++++[>++++++++++++++++++++++++++++++++++++++++[>++++++++++++++++++++++++++++++++++++++++[>++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++[-->+>+++<<]<-]<-]<-]<-]>>>>>[-]>[-]<<<<<+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++.[-]++++++++++.
@@ -0,0 +1,3 @@
+; Runs multiply and clear loops 64000 times
+; then prints M and a newline
+++++++++++++++++++++++++++++++++++++++++[>++++++++++++++++++++++++++++++++++++++++[>++++++++++++++++++++++++++++++++++++++++[>+++++++[->+>++>+++>++++<<<<]>[-<<+>>]>[-]>[-]>[-]<<<<<-]<-]<-]>>>[-]<<<+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++.[-]++++++++++.
@@ -0,0 +1,528 @@
+/**
+ * @file bench.c
+ * @brief benchmark harness for the bfx engines
+ *
+ * Runs every program in a corpus with each engine of a bfx binary and prints one
+ * JSON object per program and engine, so results can be collected across commits.
+ *
+ * This work is released under the terms of the MIT License. See LICENSE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define BENCH_DEFAULT_RUNS 3
+#define BENCH_TAPE_SIZE    30000
+#define BENCH_LINE_MAX     4096
+
+/**
+ * @brief Structure to represent an engine: the options bfx runs a program with, or
+ * the options it compiles it with if `compile` is set.
+ */
+typedef struct {
+    const char* name;
+    const char* flags[3];
+    int         compile;
+} bench_engine_t;
+
+/**
+ * @brief Structure to hold the measurements of one run.
+ * @param wall Wall-clock time in seconds.
+ * @param user User CPU time in seconds.
+ * @param sys System CPU time in seconds.
+ * @param max_rss Peak resident set size in kilobytes.
+ * @param status Exit status, or -1 if the process did not exit normally.
+ */
+typedef struct {
+    double wall;
+    double user;
+    double sys;
+    long   max_rss;
+    int    status;
+} bench_run_t;
+
+static const bench_engine_t engines[] = {
+    { "naive", { "-n", NULL }, 0 },    { "ir", { "-I", NULL }, 0 },
+    { "tiered", { NULL }, 0 },         { "threaded", { "-T", NULL }, 0 },
+    { "jit", { "-j", NULL }, 0 },      { "c", { "-c", NULL }, 1 },
+    { "asm", { "-c", "-S", NULL }, 1 },
+};
+
+static long          count_ops(const char*, const char*);
+static int           engine_selected(const char*, const char*);
+static void          bench_program(
+    const char*, const char*, const char*, const char*, const char*, int);
+static char*         make_input(long);
+static char*         make_temp(void);
+static unsigned long hash_file(const char*);
+static double        now(void);
+static void          print_usage(const char*);
+static int           run(char* const*, const char*, const char*, int, bench_run_t*);
+
+/**
+ * @brief Entry point.
+ */
+int main(int argc, char* argv[]) {
+    FILE*       corpus;
+    const char* bfx    = "bfx";
+    const char* filter = NULL;
+    int         runs   = BENCH_DEFAULT_RUNS;
+    char        line[BENCH_LINE_MAX];
+    char        name[BENCH_LINE_MAX];
+    char        program[BENCH_LINE_MAX];
+    char        path[2 * BENCH_LINE_MAX];
+    char*       input;
+    char*       dir_end;
+    long        input_len;
+    size_t      dir_len;
+    int         opt;
+
+    while ((opt = getopt(argc, argv, "b:e:n:")) != -1) {
+        switch (opt) {
+        case 'b':
+            bfx = optarg;
+            break;
+        case 'e':
+            filter = optarg;
+            break;
+        case 'n':
+            if ((runs = atoi(optarg)) < 1) {
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!(corpus = fopen(argv[optind], "r"))) {
+        fprintf(stderr, "bfx-bench: Cannot open %s: %s\n", argv[optind], strerror(errno));
+        return EXIT_FAILURE;
+    }
+    dir_end = strrchr(argv[optind], '/');
+    dir_len = dir_end ? (size_t) (dir_end - argv[optind] + 1) : 0;
+
+    while (fgets(line, sizeof line, corpus)) {
+        input_len = 0;
+        if (line[0] == '#' || sscanf(line, "%s %s %ld", name, program, &input_len) < 2) {
+            continue;
+        }
+        if (program[0] == '/') {
+            strcpy(path, program);
+        } else {
+            sprintf(path, "%.*s%s", (int) dir_len, argv[optind], program);
+        }
+
+        input = input_len > 0 ? make_input(input_len) : NULL;
+        bench_program(bfx, filter, name, path, input, runs);
+        if (input) {
+            remove(input);
+            free(input);
+        }
+    }
+
+    fclose(corpus);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Runs a program with each selected engine and prints the results.
+ *
+ * The fastest of `runs` runs is reported. For compiled engines the time taken to
+ * compile is reported as well, with the compile cache disabled so it is measured
+ * every time. The hash of the program's output is reported so engines which
+ * disagree stand out.
+ *
+ * @param bfx Path of the bfx binary.
+ * @param filter Comma-separated names of the engines to use, or NULL for all of them.
+ * @param name Name of the benchmark.
+ * @param path Path of the program.
+ * @param input Path of the program's input, or NULL.
+ * @param runs Number of times to run the program with each engine.
+ */
+static void bench_program(const char* bfx,
+                          const char* filter,
+                          const char* name,
+                          const char* path,
+                          const char* input,
+                          int         runs) {
+    bench_run_t best;
+    bench_run_t result;
+    char*       argv[8];
+    char*       output;
+    char*       binary;
+    double      compile;
+    long        ops;
+    size_t      argc;
+    size_t      e;
+    size_t      i;
+    int         r;
+
+    ops    = count_ops(path, input);
+    output = make_temp();
+    binary = make_temp();
+
+    for (e = 0; e < sizeof engines / sizeof engines[0]; e++) {
+        if (!engine_selected(filter, engines[e].name)) {
+            continue;
+        }
+
+        argc         = 0;
+        argv[argc++] = (char*) bfx;
+        for (i = 0; engines[e].flags[i]; i++) {
+            argv[argc++] = (char*) engines[e].flags[i];
+        }
+
+        compile = 0;
+        if (engines[e].compile) {
+            argv[argc++] = "-o";
+            argv[argc++] = binary;
+            argv[argc++] = (char*) path;
+            argv[argc]   = NULL;
+            if (run(argv, NULL, NULL, 1, &result) || result.status != 0) {
+                printf("{\"program\":\"%s\",\"engine\":\"%s\",\"status\":\"compile failed\"}\n",
+                       name,
+                       engines[e].name);
+                continue;
+            }
+            compile = result.wall;
+            argv[0] = binary;
+            argv[1] = NULL;
+        } else {
+            argv[argc++] = (char*) path;
+            argv[argc]   = NULL;
+        }
+
+        best.wall = -1;
+        for (r = 0; r < runs; r++) {
+            if (run(argv, input, output, 0, &result)) {
+                memset(&result, 0, sizeof result);
+                result.status = -1;
+            }
+            if (best.wall < 0 || result.wall < best.wall) {
+                best = result;
+            }
+            if (result.max_rss > best.max_rss) {
+                best.max_rss = result.max_rss;
+            }
+        }
+
+        printf("{\"program\":\"%s\",\"engine\":\"%s\",\"runs\":%d,\"ops\":%ld,"
+               "\"wall_s\":%.6f,\"user_s\":%.6f,\"sys_s\":%.6f,\"ops_per_s\":%.0f,"
+               "\"max_rss_kb\":%ld,\"compile_s\":%.6f,\"output_hash\":\"%08lx\","
+               "\"status\":%d}\n",
+               name,
+               engines[e].name,
+               runs,
+               ops,
+               best.wall,
+               best.user,
+               best.sys,
+               best.wall > 0 ? ops / best.wall : 0.0,
+               best.max_rss,
+               compile,
+               hash_file(output),
+               best.status);
+        fflush(stdout);
+    }
+
+    remove(output);
+    remove(binary);
+    free(output);
+    free(binary);
+}
+
+/**
+ * @brief Counts the brainfuck commands a program executes.
+ *
+ * The program is run by a minimal interpreter with the same defaults as bfx (a tape
+ * of BENCH_TAPE_SIZE byte cells and 0 on EOF), which counts every command it runs,
+ * including each test of a bracket. This is the number of operations the ops/s
+ * figures are based on, so they compare engines which do different amounts of work
+ * per command.
+ *
+ * @param path Path of the program.
+ * @param input Path of the program's input, or NULL.
+ *
+ * @return Returns the number of commands executed, or -1 if the program cannot be
+ *         read or has unbalanced brackets.
+ */
+static long count_ops(const char* path, const char* input) {
+    static unsigned char tape[BENCH_TAPE_SIZE];
+    FILE*                f;
+    FILE*                in = NULL;
+    char*                prog;
+    long*                jumps;
+    long*                stack;
+    long                 len;
+    long                 top;
+    long                 ops;
+    long                 ip;
+    long                 tp;
+    int                  c;
+
+    if (!(f = fopen(path, "r"))) {
+        return -1;
+    }
+    prog = NULL;
+    len  = 0;
+    while ((c = getc(f)) != EOF) {
+        if (strchr("+-<>[].,", c) && c) {
+            if (len % 4096 == 0 && !(prog = realloc(prog, len + 4096))) {
+                fclose(f);
+                return -1;
+            }
+            prog[len++] = c;
+        }
+    }
+    fclose(f);
+
+    jumps = malloc(sizeof(long) * (len + 1));
+    stack = malloc(sizeof(long) * (len + 1));
+    ops   = -1;
+    top   = 0;
+    for (ip = 0; jumps && stack && ip < len; ip++) {
+        if (prog[ip] == '[') {
+            stack[top++] = ip;
+        } else if (prog[ip] == ']') {
+            if (top == 0) {
+                break;
+            }
+            jumps[ip]         = stack[--top];
+            jumps[stack[top]] = ip;
+        }
+    }
+
+    if (jumps && stack && ip == len && top == 0 && (!input || (in = fopen(input, "rb")))) {
+        memset(tape, 0, sizeof tape);
+        ops = 0;
+        tp  = 0;
+        for (ip = 0; ip < len; ip++, ops++) {
+            switch (prog[ip]) {
+            case '+':
+                tape[tp]++;
+                break;
+            case '-':
+                tape[tp]--;
+                break;
+            case '>':
+                tp = tp + 1 < BENCH_TAPE_SIZE ? tp + 1 : tp;
+                break;
+            case '<':
+                tp = tp > 0 ? tp - 1 : 0;
+                break;
+            case '[':
+                if (!tape[tp]) {
+                    ip = jumps[ip];
+                }
+                break;
+            case ']':
+                if (tape[tp]) {
+                    ip = jumps[ip];
+                }
+                break;
+            case ',':
+                tape[tp] = in && (c = getc(in)) != EOF ? c : 0;
+                break;
+            }
+        }
+    }
+
+    if (in) {
+        fclose(in);
+    }
+    free(prog);
+    free(jumps);
+    free(stack);
+    return ops;
+}
+
+/**
+ * @brief Checks if an engine is in a comma-separated list of names.
+ * @return Returns 1 if the engine is selected or `filter` is NULL, otherwise 0.
+ */
+static int engine_selected(const char* filter, const char* name) {
+    size_t len = strlen(name);
+
+    if (!filter) {
+        return 1;
+    }
+    for (; filter; filter = strchr(filter, ',') ? strchr(filter, ',') + 1 : NULL) {
+        if (!strncmp(filter, name, len) && (filter[len] == ',' || filter[len] == '\0')) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns a 32-bit FNV-1a hash of a file's contents, or 0 if it cannot be read.
+ */
+static unsigned long hash_file(const char* path) {
+    unsigned long hash = 2166136261UL;
+    FILE*         f;
+    int           c;
+
+    if (!(f = fopen(path, "rb"))) {
+        return 0;
+    }
+    while ((c = getc(f)) != EOF) {
+        hash = ((hash ^ c) * 16777619UL) & 0xffffffffUL;
+    }
+    fclose(f);
+    return hash;
+}
+
+/**
+ * @brief Writes an input file of lines of letters.
+ *
+ * The input contains no zero bytes, so programs which stop at a zero cell read all of
+ * it, and is the same on every run so results are comparable.
+ *
+ * @param len Size of the input in bytes.
+ *
+ * @return Returns the path of the file. The caller is responsible for removing and
+ *         freeing it.
+ */
+static char* make_input(long len) {
+    FILE* f;
+    char* path;
+    long  i;
+
+    path = make_temp();
+    if (!(f = fopen(path, "wb"))) {
+        fprintf(stderr, "bfx-bench: Cannot write %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < len; i++) {
+        putc(i % 64 == 63 ? '\n' : 'a' + (int) (i * 7 % 26), f);
+    }
+    fclose(f);
+    return path;
+}
+
+/**
+ * @brief Creates an empty temporary file in $TMPDIR, or /tmp if it is not set.
+ * @return Returns the path of the file. The caller is responsible for freeing it.
+ */
+static char* make_temp(void) {
+    const char* dir;
+    char*       path;
+    int         fd;
+
+    if (!(dir = getenv("TMPDIR")) || !*dir) {
+        dir = "/tmp";
+    }
+    if (!(path = malloc(strlen(dir) + sizeof "/bfx-bench.XXXXXX"))) {
+        fprintf(stderr, "bfx-bench: Cannot allocate memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    sprintf(path, "%s/bfx-bench.XXXXXX", dir);
+    if ((fd = mkstemp(path)) < 0) {
+        fprintf(stderr, "bfx-bench: Cannot create a temporary file: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    return path;
+}
+
+/**
+ * @brief Returns the current time in seconds.
+ */
+static double now(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/**
+ * @brief Prints the usage message for the program.
+ *
+ * @param argv0 The name of the program as it was invoked.
+ */
+static void print_usage(const char* argv0) {
+    fprintf(stderr, "Usage: %s [-b bfx] [-e engines] [-n runs] corpus\n", argv0);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, " -b bfx:\t\tPath of the bfx binary to benchmark. Default is bfx.\n");
+    fprintf(stderr, " -e engines:\t\tComma-separated engines to run: naive, ir, tiered,\n");
+    fprintf(stderr, "            \t\tthreaded, jit, c and asm. Default is all of them.\n");
+    fprintf(stderr,
+            " -n runs:\t\tRun each program this many times and report the fastest.\n"
+            "         \t\tDefault is %d.\n",
+            BENCH_DEFAULT_RUNS);
+}
+
+/**
+ * @brief Runs a program and measures it.
+ *
+ * @param argv Arguments, starting with the path of the program to run.
+ * @param input Path of the file to use as stdin, or NULL for /dev/null.
+ * @param output Path of the file to write stdout to, or NULL for /dev/null.
+ * @param no_cache If the compile cache should be disabled for the program.
+ * @param result Set to the measurements.
+ *
+ * @return Returns 0 if the program was run, or -1 otherwise.
+ */
+static int run(char* const* argv,
+               const char*  input,
+               const char*  output,
+               int          no_cache,
+               bench_run_t* result) {
+    struct rusage usage;
+    double        start;
+    pid_t         pid;
+    int           status;
+    int           fd;
+
+    fflush(stdout);
+    start = now();
+    if ((pid = fork()) < 0) {
+        return -1;
+    }
+
+    if (pid == 0) {
+        if ((fd = open(input ? input : "/dev/null", O_RDONLY)) < 0 || dup2(fd, 0) < 0) {
+            _exit(127);
+        }
+        close(fd);
+        if ((fd = open(output ? output : "/dev/null", O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0
+            || dup2(fd, 1) < 0) {
+            _exit(127);
+        }
+        close(fd);
+        if (no_cache) {
+            setenv("XDG_CACHE_HOME", "", 1);
+            setenv("HOME", "", 1);
+        }
+        execv(argv[0], argv);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    while (wait4(pid, &status, 0, &usage) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    result->wall    = now() - start;
+    result->user    = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+    result->sys     = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    result->max_rss = usage.ru_maxrss;
+    result->status  = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    return 0;
+}
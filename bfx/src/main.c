@@ -11,7 +11,9 @@
 #include "bfx.h"
 #include "compile.h"
 
+#include <errno.h>
 #include <getopt.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -22,6 +24,27 @@
 #define EOF_BEHAVIOR_DECREMENT_S "decrement"
 #define EOF_BEHAVIOR_UNCHANGED_S "unchanged"
 
+#define OPT_BATCH            256
+#define OPT_RUN_COMPILED     257
+#define OPT_CHECKPOINT_EVERY 258
+#define OPT_RESUME           259
+#define OPT_INPUT            260
+#define OPT_STATS            261
+
+#define CHECKPOINT_EXTENSION ".checkpoint"
+#define CHECKPOINT_DEFAULT   "bfx" CHECKPOINT_EXTENSION
+
+static const struct option long_options[] = {
+    { "batch", required_argument, NULL, OPT_BATCH },
+    { "run-compiled", no_argument, NULL, OPT_RUN_COMPILED },
+    { "checkpoint-every", required_argument, NULL, OPT_CHECKPOINT_EVERY },
+    { "resume", required_argument, NULL, OPT_RESUME },
+    { "input", required_argument, NULL, OPT_INPUT },
+    { "stats", no_argument, NULL, OPT_STATS },
+    { NULL, 0, NULL, 0 },
+};
+
+static long get_count(const char*);
 static int  get_eof_behavior(const char*);
 static void print_usage(const char*);
 static void print_version(const char*);
@@ -32,19 +55,63 @@ static void print_version(const char*);
 int main(int argc, char* argv[]) {
     int              opt;
     bfx_parameters_t params;
-    char*            path        = NULL;
-    char*            output_path = NULL;
-    bool             compile     = false;
+    char*            path          = NULL;
+    char*            output_path   = NULL;
+    char*            manifest_path = NULL;
+    char*            checkpoint    = NULL;
+    bool             compile       = false;
+    bool             run_compiled  = false;
+    bool             binary        = false;
+    bool             tape_size_set = false;
+    bool             tiered        = true;
 
-    params.flags                 = 0;
-    params.input_max             = BFX_DEFAULT_INPUT_MAX;
-    params.tape_size             = BFX_DEFAULT_TAPE_SIZE;
-    params.eof_behavior          = BFX_DEFAULT_EOF_BEHAVIOR;
+    params.flags                   = 0;
+    params.input_max               = BFX_DEFAULT_INPUT_MAX;
+    params.tape_size               = BFX_DEFAULT_TAPE_SIZE;
+    params.eof_behavior            = BFX_DEFAULT_EOF_BEHAVIOR;
+    params.io_buffer_size          = BFX_DEFAULT_IO_BUFFER_SIZE;
+    params.cell_width              = BFX_DEFAULT_CELL_WIDTH;
+    params.jobs                    = 0;
+    params.checkpoint_interval     = 0;
+    params.checkpoint_path         = NULL;
+    params.resume_path             = NULL;
+    params.input_path              = NULL;
 
-    while ((opt = getopt(argc, argv, "cCde:g:Gio:Prst:vY")) != -1) {
+    while ((opt = getopt_long(argc, argv, "b:cCde:g:GiIjJ:no:pPrsSt:Tuvw:Y", long_options, NULL))
+           != -1) {
         switch (opt) {
+        case OPT_BATCH:
+            manifest_path = optarg;
+            break;
+        case OPT_RUN_COMPILED:
+            run_compiled = true;
+            break;
+        case OPT_CHECKPOINT_EVERY:
+            if (atoi(optarg) <= 0) {
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            params.checkpoint_interval = atoi(optarg);
+            break;
+        case OPT_RESUME:
+            params.resume_path = optarg;
+            break;
+        case OPT_INPUT:
+            params.input_path = optarg;
+            break;
+        case OPT_STATS:
+            params.flags |= BFX_FLAG_STATS;
+            break;
+        case 'b':
+            if (get_count(optarg) <= 0) {
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            params.io_buffer_size = get_count(optarg);
+            break;
         case 'c':
             compile = true;
+            binary  = true;
             break;
         case 'C':
             compile = true;
@@ -68,9 +135,28 @@ int main(int argc, char* argv[]) {
         case 'i':
             params.flags |= BFX_FLAG_SEPARATE_INPUT_AND_SOURCE;
             break;
+        case 'I':
+            tiered = false;
+            break;
+        case 'j':
+            params.flags |= BFX_FLAG_JIT;
+            break;
+        case 'J':
+            if (get_count(optarg) < 0) {
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            params.jobs = get_count(optarg);
+            break;
+        case 'n':
+            params.flags |= BFX_FLAG_INTERPRET_SOURCE;
+            break;
         case 'o':
             output_path = optarg;
             break;
+        case 'p':
+            params.flags |= BFX_FLAG_PROFILE;
+            break;
         case 'P':
             printf("-%c Unimplemented.\n", opt);
             break;
@@ -80,14 +166,32 @@ int main(int argc, char* argv[]) {
         case 's':
             params.flags |= BFX_FLAG_DISABLE_SPECIAL_INSTRUCTIONS;
             break;
+        case 'S':
+            compile = true;
+            params.flags |= BFX_FLAG_ASSEMBLY;
+            break;
         case 't':
             params.tape_size = atoi(optarg);
+            tape_size_set    = true;
+            break;
+        case 'T':
+            params.flags |= BFX_FLAG_THREADED;
+            break;
+        case 'u':
+            params.flags |= BFX_FLAG_GROWABLE_TAPE;
             break;
         case 'v':
             print_version(argv[0]);
             return EXIT_SUCCESS;
+        case 'w':
+            params.cell_width = atoi(optarg);
+            if (params.cell_width != 8 && params.cell_width != 16 && params.cell_width != 32) {
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
         case 'Y':
-            printf("-%c Unimplemented.\n", opt);
+            params.flags |= BFX_FLAG_BRAINFORK;
             break;
         default:
             print_usage(argv[0]);
@@ -99,13 +203,107 @@ int main(int argc, char* argv[]) {
         path = argv[optind];
     }
 
+    /* without another engine, hot loops are moved from the interpreter to the JIT */
+    if (tiered && !(params.flags & (BFX_FLAG_JIT | BFX_FLAG_THREADED))) {
+        params.flags |= BFX_FLAG_TIERED;
+    }
+
+    if ((params.flags & BFX_FLAG_GROWABLE_TAPE) && !tape_size_set) {
+        params.tape_size = BFX_MAX_TAPE_SIZE;
+    }
+
+    /* -S alone writes the assembly, like -C writes C; with -c it is assembled and linked */
+    if ((params.flags & BFX_FLAG_ASSEMBLY) && !binary) {
+        params.flags |= BFX_FLAG_ONLY_GENERATE_C_SOURCE;
+    } else if (params.flags & BFX_FLAG_ASSEMBLY) {
+        params.flags &= ~BFX_FLAG_ONLY_GENERATE_C_SOURCE;
+    }
+
+    /* the profiler counts instructions of the IR engine, so it needs a file run by it */
+    if ((params.flags & BFX_FLAG_PROFILE)
+        && (compile || run_compiled || manifest_path
+            || (params.flags & (BFX_FLAG_REPL | BFX_FLAG_INTERPRET_SOURCE)))) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* statistics measure a single file's run by the IR engines, and report alone */
+    if ((params.flags & BFX_FLAG_STATS)
+        && (compile || run_compiled || manifest_path
+            || (params.flags
+                & (BFX_FLAG_REPL | BFX_FLAG_INTERPRET_SOURCE | BFX_FLAG_PROFILE)))) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* snapshots are of the IR engine's state, so they need a file run by it */
+    if ((params.checkpoint_interval || params.resume_path)
+        && (compile || run_compiled || manifest_path
+            || (params.flags
+                & (BFX_FLAG_REPL | BFX_FLAG_INTERPRET_SOURCE | BFX_FLAG_PROFILE
+                   | BFX_FLAG_STATS)))) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* threads are started by a file's run, and are neither counted nor snapshotted */
+    if ((params.flags & BFX_FLAG_BRAINFORK)
+        && (compile || run_compiled || manifest_path || params.checkpoint_interval
+            || params.resume_path
+            || (params.flags
+                & (BFX_FLAG_REPL | BFX_FLAG_INTERPRET_SOURCE | BFX_FLAG_PROFILE
+                   | BFX_FLAG_STATS)))) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* an input file replaces the input of a single file's run */
+    if (params.input_path
+        && (compile || run_compiled || manifest_path
+            || (params.flags & (BFX_FLAG_REPL | BFX_FLAG_SEPARATE_INPUT_AND_SOURCE)))) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* a resumed run keeps its snapshot up to date, others write one next to the file */
+    if (output_path || params.resume_path) {
+        params.checkpoint_path = output_path ? output_path : params.resume_path;
+    } else if (path && strcmp(path, "-")) {
+        if (!(checkpoint = malloc(strlen(path) + sizeof(CHECKPOINT_EXTENSION)))) {
+            return EXIT_FAILURE;
+        }
+        sprintf(checkpoint, "%s%s", path, CHECKPOINT_EXTENSION);
+        params.checkpoint_path = checkpoint;
+    } else {
+        params.checkpoint_path = CHECKPOINT_DEFAULT;
+    }
+
+    if (run_compiled) {
+        return bfx_compile_run(path, params);
+    }
+
+    if (compile && argc - optind > 1) {
+        if (output_path) {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        return bfx_compile_many(argv + optind, argc - optind, params) ? EXIT_FAILURE
+                                                                       : EXIT_SUCCESS;
+    }
+
     if (compile) {
         bfx_compile(path, output_path, params);
         return EXIT_SUCCESS;
     }
 
-    if (!(params.flags & BFX_FLAG_REPL) && path) {
+    if (manifest_path) {
+        bfx_run_batch(manifest_path, params);
+        return EXIT_SUCCESS;
+    }
+
+    if (!(params.flags & BFX_FLAG_REPL)) {
         bfx_run_file(path, params);
+        free(checkpoint);
     } else if ((params.flags & BFX_FLAG_REPL) && !path) {
         bfx_run_repl(params);
     } else {
@@ -116,6 +314,25 @@ int main(int argc, char* argv[]) {
     return EXIT_SUCCESS;
 }
 
+/**
+ * @brief Parses the value of an option which takes a count.
+ *
+ * @param s The value, which must be a decimal integer and nothing else.
+ *
+ * @return Returns the count, or -1 if `s` is not a number from 0 to INT_MAX.
+ */
+static long get_count(const char* s) {
+    char* end;
+    long  n;
+
+    errno = 0;
+    n     = strtol(s, &end, 10);
+    if (end == s || *end || errno || n < 0 || n > INT_MAX) {
+        return -1;
+    }
+    return n;
+}
+
 static int get_eof_behavior(const char* s) {
     int         i;
     const char* eof_behavior[3];
@@ -139,8 +356,10 @@ static int get_eof_behavior(const char* s) {
  */
 static void print_usage(const char* argv0) {
     fprintf(stderr,
-            "Usage: %s [-cCdGiPrsvY] [-e eof_behavior] [-g start-end] [-o output_file] [-t "
-            "tape_size] [file]\n",
+            "Usage: %s [-cCdGiIjnpPrsSTuvY] [-b buffer_size] [-e eof_behavior] [-g start-end] [-J "
+            "jobs] [-o output_file] [-t tape_size] [-w cell_width] [--batch manifest] "
+            "[--run-compiled] [--checkpoint-every seconds] [--resume snapshot] [--input "
+            "input_file] [--stats] [file...]\n",
             argv0);
     fprintf(stderr, "Options:\n");
     fprintf(stderr,
@@ -153,12 +372,32 @@ static void print_usage(const char* argv0) {
     fprintf(stderr, "    \t\t\tinstruction pointer, and a memory dump.\n");
     fprintf(stderr, " -G:\t\t\tEnable Grin language support\n");
     fprintf(stderr, " -i:\t\t\tSeparate code from input using !\n");
+    fprintf(stderr, " -I:\t\t\tRun every loop in the interpreter, instead of compiling\n");
+    fprintf(stderr, "    \t\t\tloops to machine code in memory once they are hot\n");
+    fprintf(stderr, " -j:\t\t\tCompile to machine code in memory and run it (x86-64 and\n");
+    fprintf(stderr, "    \t\t\tAArch64; other platforms use the interpreter)\n");
+    fprintf(stderr, " -n:\t\t\tInterpret the source directly instead of compiling it\n");
+    fprintf(stderr, "    \t\t\tfirst (slow; a baseline for benchmarks)\n");
+    fprintf(stderr, " -p:\t\t\tProfile the program and report its hot loops and\n");
+    fprintf(stderr, "    \t\t\tinstructions on stderr when it ends (uses the\n");
+    fprintf(stderr, "    \t\t\tinterpreter, even with -j or -T)\n");
     fprintf(stderr, " -P:\t\t\tEnable pbrain language support\n");
     fprintf(stderr, " -r:\t\t\tEnable REPL mode\n");
     fprintf(stderr, " -s:\t\t\tDisable special instructions\n");
+    fprintf(stderr, " -S:\t\t\tCompile the brainfuck code into assembly for this machine\n");
+    fprintf(stderr, "    \t\t\t(x86-64 and AArch64 Linux). Default output file is\n");
+    fprintf(stderr, "    \t\t\t./a.out.s. With -c, assemble and link it with as and ld\n");
+    fprintf(stderr, "    \t\t\tinstead of using the C compiler.\n");
+    fprintf(stderr, " -T:\t\t\tUse the threaded-code engine\n");
+    fprintf(stderr, " -u:\t\t\tUse a tape which grows as it is used, up to tape_size (default\n");
+    fprintf(stderr, "    \t\t\t%d) cells. Leaving the tape is an error.\n", BFX_MAX_TAPE_SIZE);
     fprintf(stderr, " -v:\t\t\tPrint version information\n");
-    fprintf(stderr, " -Y:\t\t\tEnable brainfork language support\n");
+    fprintf(stderr, " -Y:\t\t\tEnable brainfork language support (Y forks a thread)\n");
     fprintf(stderr, "\n");
+    fprintf(stderr,
+            " -b buffer_size:\tSet the size of the input and output buffers. Default is %d.\n",
+            BFX_DEFAULT_IO_BUFFER_SIZE);
+    fprintf(stderr, "                 \tOutput is line-buffered in REPL mode.\n");
     fprintf(stderr, " -e eof_behavior:\tSet the behavior of the interpreter when EOF is\n");
     fprintf(stderr,
             "                 \tencountered in the input. Valid values are \"%s\" (default),\n",
@@ -170,12 +409,41 @@ static void print_usage(const char* argv0) {
     fprintf(stderr, " -g start-end:\t\tDisplay the contents of the tape between the specified\n");
     fprintf(stderr, "                 \tindices as pixels on a graphical display. 0 will be a\n");
     fprintf(stderr, "                 \tblack pixel, and any other value will be a white pixel.\n");
+    fprintf(stderr, " -J jobs:\t\tSet the number of worker threads for --batch, or of files\n");
+    fprintf(stderr, "                 \tcompiled at once by -c and -C. Must be 0 or more; the\n");
+    fprintf(stderr, "                 \tdefault, 0, is one per CPU.\n");
     fprintf(stderr,
             " -o output_file:\t(for compilation) Write the output to the specified file instead of "
             "a.out(.c).\n");
+    fprintf(stderr, "                 \tWhen compiling several files, each is written next\n");
+    fprintf(stderr, "                 \tto its source with the extension removed (or\n");
+    fprintf(stderr, "                 \treplaced by .c).\n");
     fprintf(stderr,
             " -t tape_size:\t\tSet the size of the tape. Default is %d.\n",
             BFX_DEFAULT_TAPE_SIZE);
+    fprintf(stderr,
+            " -w cell_width:\t\tSet the width of a cell in bits (8, 16 or 32). Default is %d.\n",
+            BFX_DEFAULT_CELL_WIDTH);
+    fprintf(stderr, " --batch manifest:\tRun the programs listed in manifest, one per line and\n");
+    fprintf(stderr, "                 \toptionally followed by an input file, on a pool of\n");
+    fprintf(stderr, "                 \tthreads, and write their output in order.\n");
+    fprintf(stderr, " --run-compiled:\tCompile the brainfuck code into a native executable and\n");
+    fprintf(stderr, "                 \trun it, reusing the cached executable if there is one.\n");
+    fprintf(stderr, " --checkpoint-every seconds:\n");
+    fprintf(stderr, "                 \tWrite a snapshot of the run this often, to\n");
+    fprintf(stderr,
+            "                 \toutput_file or the file name followed by %s\n",
+            CHECKPOINT_EXTENSION);
+    fprintf(stderr, "                 \t(uses the interpreter, even with -j or -T). The\n");
+    fprintf(stderr, "                 \tsnapshot is removed when the program ends.\n");
+    fprintf(stderr, " --resume snapshot:\tContinue a run from a snapshot, given the same input.\n");
+    fprintf(stderr, " --input input_file:\tRead input from input_file instead of standard\n");
+    fprintf(stderr, "                 \tinput. Regular files are mapped into memory and read\n");
+    fprintf(stderr, "                 \tin place.\n");
+    fprintf(stderr, " --stats:\t\tReport the instructions and jumps executed, time, highest\n");
+    fprintf(stderr, "                 \tcell, peak memory and hardware counters of the run\n");
+    fprintf(stderr, "                 \tas JSON on stderr when it ends, with the engine\n");
+    fprintf(stderr, "                 \tselected by -I, -j or -T.\n");
 }
 
 static void print_version(const char* argv0) { fprintf(stderr, "%s %s\n", argv0, BFX_VERSION); }
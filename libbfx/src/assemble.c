@@ -0,0 +1,560 @@
+#include "assemble.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef BFX_ASSEMBLE_SUPPORTED
+
+static void emit_epilogue(FILE*, unsigned long);
+static void emit_op(FILE*, const bfx_op_t*, size_t, bfx_parameters_t);
+static void emit_prologue(FILE*, unsigned long);
+static void emit_resume(FILE*, const bfx_prefix_t*, long);
+static long mask(long, int);
+
+/**
+ * @brief Writes a program as assembly for the host architecture.
+ *
+ * The output is a complete program for the GNU assembler with its own `_start`, so
+ * it only needs to be assembled and linked with `as` and `ld`. Like the C the
+ * compiler generates, it buffers input and output in blocks of
+ * `params.io_buffer_size` bytes, and keeps its tape of `params.tape_size` cells of
+ * `params.cell_width` bits in .bss. Jumps are labelled by the index of their loop's
+ * JZ, so their targets do not need to be resolved here. The tape bounds are not
+ * checked either, so CHECKs write nothing.
+ *
+ * Like the C, the code starts where the program's prefix ends: its cells are copied
+ * to the tape from `bfx_cells` and its output is written from `bfx_output`, both in
+ * .rodata.
+ *
+ * @param output File to write to.
+ * @param program Program to translate.
+ * @param prefix Evaluated prefix of the program (see bfx_prefix_evaluate()).
+ * @param params Compilation parameters
+ *
+ * @return Returns BFX_STATUS_OK, or BFX_STATUS_INVALID_PARAMETERS if assembly
+ *         cannot be generated for this platform.
+ */
+int bfx_assemble(FILE*                output,
+                 const bfx_program_t* program,
+                 const bfx_prefix_t*  prefix,
+                 bfx_parameters_t     params) {
+    const char*   directive;
+    unsigned long io_size;
+    size_t        i;
+    long          k;
+
+    io_size   = params.io_buffer_size > 0 ? params.io_buffer_size : 1;
+    k         = params.cell_width / 8;
+    directive = k == 1 ? ".byte" : k == 2 ? ".2byte" : ".4byte";
+    emit_prologue(output, io_size);
+    emit_resume(output, prefix, k);
+    for (i = prefix->ip; i < program->len; i++) {
+        emit_op(output, &program->ops[i], i, params);
+    }
+    emit_epilogue(output, io_size);
+    fprintf(output,
+            "\t.lcomm t, %lu\n\t.lcomm o, %lu\n\t.lcomm i, %lu\n",
+            (unsigned long) params.tape_size * k,
+            io_size,
+            io_size);
+
+    if (prefix->cells > 0) {
+        fprintf(output, "\t.section .rodata\n\t.balign 4\nbfx_cells:");
+        for (i = 0; i < prefix->cells; i++) {
+            if (i % BFX_ASSEMBLE_DATA_LINE) {
+                fprintf(output, ", %lu", (unsigned long) prefix->tape[i]);
+            } else {
+                fprintf(output, "\n\t%s %lu", directive, (unsigned long) prefix->tape[i]);
+            }
+        }
+        fprintf(output, "\n");
+    }
+    if (prefix->output_len > 0) {
+        fprintf(output, "\t.section .rodata\nbfx_output:");
+        for (i = 0; i < prefix->output_len; i++) {
+            fprintf(output,
+                    i % BFX_ASSEMBLE_DATA_LINE ? ", %u" : "\n\t.byte %u",
+                    prefix->output[i]);
+        }
+        fprintf(output, "\n");
+    }
+    fprintf(output, "\t.section .note.GNU-stack,\"\",%%progbits\n");
+    return BFX_STATUS_OK;
+}
+
+/**
+ * @brief Reduces a constant to a value of the cell width, so byte and halfword
+ * instructions take it as an immediate.
+ */
+static long mask(long v, int width) { return width < 32 ? v & ((1L << width) - 1) : (int) v; }
+
+#if defined(__x86_64__)
+
+/*
+ * Register use: rbx = tape pointer, r12 = bytes in the output buffer, r13 and r14 = position
+ * and length of the input buffer, r15 = output buffer, ebp = copies left to write of an OUT
+ * folded from a run of '.'. The system calls only clobber rax, rcx and r11 besides their
+ * arguments.
+ */
+
+static void emit_prologue(FILE* output, unsigned long io_size) {
+    fprintf(output,
+            "\t.text\n\t.globl _start\n_start:\n"
+            "\tleaq t(%%rip), %%rbx\n"
+            "\tleaq o(%%rip), %%r15\n"
+            "\txorl %%r12d, %%r12d\n"
+            "\txorl %%r13d, %%r13d\n"
+            "\txorl %%r14d, %%r14d\n");
+}
+
+static void emit_epilogue(FILE* output, unsigned long io_size) {
+    fprintf(output,
+            "\tcall bfx_flush\n"
+            "\tmovl $60, %%eax\n"
+            "\txorl %%edi, %%edi\n"
+            "\tsyscall\n");
+    /* write(1, o, n) until the buffer is written or an error which is not EINTR */
+    fprintf(output,
+            "bfx_flush:\n"
+            "\tmovq %%r15, %%rsi\n"
+            "\tmovq %%r12, %%rdx\n"
+            "1:\ttestq %%rdx, %%rdx\n"
+            "\tjz 2f\n"
+            "\tmovl $1, %%eax\n"
+            "\tmovl $1, %%edi\n"
+            "\tsyscall\n"
+            "\tcmpq $-4, %%rax\n"
+            "\tje 1b\n"
+            "\ttestq %%rax, %%rax\n"
+            "\tjle 2f\n"
+            "\taddq %%rax, %%rsi\n"
+            "\tsubq %%rax, %%rdx\n"
+            "\tjmp 1b\n"
+            "2:\txorl %%r12d, %%r12d\n"
+            "\tret\n");
+    /* returns the next byte of input in eax, or -1 on EOF */
+    fprintf(output,
+            "bfx_getc:\n"
+            "\tcmpq %%r14, %%r13\n"
+            "\tjne 2f\n"
+            "\tcall bfx_flush\n"
+            "1:\txorl %%eax, %%eax\n"
+            "\txorl %%edi, %%edi\n"
+            "\tleaq i(%%rip), %%rsi\n"
+            "\tmovl $%lu, %%edx\n"
+            "\tsyscall\n"
+            "\tcmpq $-4, %%rax\n"
+            "\tje 1b\n"
+            "\ttestq %%rax, %%rax\n"
+            "\tjg 3f\n"
+            "\tmovl $-1, %%eax\n"
+            "\tret\n"
+            "3:\tmovq %%rax, %%r14\n"
+            "\txorl %%r13d, %%r13d\n"
+            "2:\tleaq i(%%rip), %%rsi\n"
+            "\tmovzbl (%%rsi,%%r13), %%eax\n"
+            "\tincq %%r13\n"
+            "\tret\n",
+            io_size);
+}
+
+/**
+ * @brief Starts from the cells, tape pointer and output the program's prefix reached.
+ *
+ * The output is written by pointing bfx_flush at it instead of the output buffer.
+ */
+static void emit_resume(FILE* output, const bfx_prefix_t* prefix, long k) {
+    if (prefix->cells > 0) {
+        fprintf(output,
+                "\tleaq bfx_cells(%%rip), %%rsi\n"
+                "\tmovq %%rbx, %%rdi\n"
+                "\tmovabsq $%lu, %%rcx\n"
+                "\trep movsb\n",
+                (unsigned long) prefix->cells * k);
+    }
+    if (prefix->tp != 0) {
+        fprintf(output, "\tmovabsq $%ld, %%rax\n\taddq %%rax, %%rbx\n", (long) prefix->tp * k);
+    }
+    if (prefix->output_len > 0) {
+        fprintf(output,
+                "\tleaq bfx_output(%%rip), %%r15\n"
+                "\tmovl $%lu, %%r12d\n"
+                "\tcall bfx_flush\n"
+                "\tleaq o(%%rip), %%r15\n",
+                (unsigned long) prefix->output_len);
+    }
+}
+
+static void emit_op(FILE* output, const bfx_op_t* op, size_t ip, bfx_parameters_t params) {
+    const char* s;
+    const char* r;
+    const char* load;
+    long        k;
+    long        arg;
+    long        offset;
+
+    switch (params.cell_width) {
+    case 16:
+        s    = "w";
+        r    = "%ax";
+        load = "movzwl";
+        break;
+    case 32:
+        s    = "l";
+        r    = "%eax";
+        load = "movl";
+        break;
+    default:
+        s    = "b";
+        r    = "%al";
+        load = "movzbl";
+        break;
+    }
+    k      = params.cell_width / 8;
+    arg    = mask(op->arg, params.cell_width);
+    offset = op->offset * k;
+
+    switch (op->op) {
+    case BFX_OP_ADD:
+        fprintf(output, "\tadd%s $%ld, %ld(%%rbx)\n", s, arg, offset);
+        break;
+    case BFX_OP_MOVE:
+        fprintf(output, "\taddq $%ld, %%rbx\n", op->arg * k);
+        break;
+    case BFX_OP_JZ:
+        fprintf(output,
+                "\tcmp%s $0, (%%rbx)\n\tje .L%luE\n.L%luB:\n",
+                s,
+                (unsigned long) ip,
+                (unsigned long) ip);
+        break;
+    case BFX_OP_JNZ:
+        fprintf(output,
+                "\tcmp%s $0, (%%rbx)\n\tjne .L%dB\n.L%dE:\n",
+                s,
+                op->arg,
+                op->arg);
+        break;
+    case BFX_OP_IN:
+        fprintf(output, "\tcall bfx_getc\n\tcmpl $-1, %%eax\n");
+        switch (params.eof_behavior) {
+        case BFX_EOF_BEHAVIOR_ZERO:
+            fprintf(output,
+                    "\tjne 1f\n\txorl %%eax, %%eax\n1:\tmov%s %s, %ld(%%rbx)\n",
+                    s,
+                    r,
+                    offset);
+            break;
+        case BFX_EOF_BEHAVIOR_DECREMENT:
+            fprintf(output,
+                    "\tjne 1f\n\tsub%s $1, %ld(%%rbx)\n\tjmp 2f\n1:\tmov%s %s, %ld(%%rbx)\n2:\n",
+                    s,
+                    offset,
+                    s,
+                    r,
+                    offset);
+            break;
+        default:
+            fprintf(output, "\tje 1f\n\tmov%s %s, %ld(%%rbx)\n1:\n", s, r, offset);
+            break;
+        }
+        break;
+    case BFX_OP_OUT:
+        if (op->arg > 1) {
+            fprintf(output, "\tmovl $%d, %%ebp\n2:\n", op->arg);
+        }
+        fprintf(output,
+                "\tmovb %ld(%%rbx), %%al\n"
+                "\tmovb %%al, (%%r15,%%r12)\n"
+                "\tincq %%r12\n"
+                "\tcmpq $%lu, %%r12\n"
+                "\tjne 1f\n"
+                "\tcall bfx_flush\n"
+                "1:\n",
+                offset,
+                (unsigned long) (params.io_buffer_size > 0 ? params.io_buffer_size : 1));
+        if (op->arg > 1) {
+            fprintf(output, "\tdecl %%ebp\n\tjnz 2b\n");
+        }
+        break;
+    case BFX_OP_SET:
+        fprintf(output, "\tmov%s $%ld, %ld(%%rbx)\n", s, arg, offset);
+        break;
+    case BFX_OP_SCAN:
+        fprintf(output,
+                "1:\tcmp%s $0, (%%rbx)\n\tje 2f\n\taddq $%ld, %%rbx\n\tjmp 1b\n2:\n",
+                s,
+                op->arg * k);
+        break;
+    case BFX_OP_MULADD:
+        fprintf(output,
+                "\t%s (%%rbx), %%eax\n\timull $%d, %%eax, %%eax\n\tadd%s %s, %ld(%%rbx)\n",
+                load,
+                op->arg,
+                s,
+                r,
+                offset);
+        break;
+    }
+}
+
+#elif defined(__aarch64__)
+
+/*
+ * Register use: x19 = tape pointer, x20 = bytes in the output buffer, x21 and x22 = position
+ * and length of the input buffer, x23 = output buffer, x24 = buffer size, w25 = copies left
+ * to write of an OUT folded from a run of '.'. w0-w3 and x30 are scratch.
+ */
+
+static void emit_addr(FILE*, long);
+static void emit_imm(FILE*, const char*, long);
+
+static void emit_prologue(FILE* output, unsigned long io_size) {
+    fprintf(output,
+            "\t.text\n\t.globl _start\n_start:\n"
+            "\tadrp x19, t\n"
+            "\tadd x19, x19, :lo12:t\n"
+            "\tadrp x23, o\n"
+            "\tadd x23, x23, :lo12:o\n"
+            "\tmov x20, #0\n"
+            "\tmov x21, #0\n"
+            "\tmov x22, #0\n");
+    emit_imm(output, "w24", (long) io_size);
+}
+
+static void emit_epilogue(FILE* output, unsigned long io_size) {
+    fprintf(output,
+            "\tbl bfx_flush\n"
+            "\tmov x0, #0\n"
+            "\tmov x8, #93\n"
+            "\tsvc #0\n");
+    /* write(1, o, n) until the buffer is written or an error which is not EINTR */
+    fprintf(output,
+            "bfx_flush:\n"
+            "\tmov x1, x23\n"
+            "\tmov x2, x20\n"
+            "1:\tcbz x2, 2f\n"
+            "\tmov x0, #1\n"
+            "\tmov x8, #64\n"
+            "\tsvc #0\n"
+            "\tcmn x0, #4\n"
+            "\tb.eq 1b\n"
+            "\tcmp x0, #0\n"
+            "\tb.le 2f\n"
+            "\tadd x1, x1, x0\n"
+            "\tsub x2, x2, x0\n"
+            "\tb 1b\n"
+            "2:\tmov x20, #0\n"
+            "\tret\n");
+    /* returns the next byte of input in w0, or -1 on EOF */
+    fprintf(output,
+            "bfx_getc:\n"
+            "\tcmp x21, x22\n"
+            "\tb.ne 2f\n"
+            "\tstr x30, [sp, #-16]!\n"
+            "\tbl bfx_flush\n"
+            "\tldr x30, [sp], #16\n"
+            "1:\tmov x0, #0\n"
+            "\tadrp x1, i\n"
+            "\tadd x1, x1, :lo12:i\n"
+            "\tmov x2, x24\n"
+            "\tmov x8, #63\n"
+            "\tsvc #0\n"
+            "\tcmn x0, #4\n"
+            "\tb.eq 1b\n"
+            "\tcmp x0, #0\n"
+            "\tb.gt 3f\n"
+            "\tmov w0, #-1\n"
+            "\tret\n"
+            "3:\tmov x22, x0\n"
+            "\tmov x21, #0\n"
+            "2:\tadrp x1, i\n"
+            "\tadd x1, x1, :lo12:i\n"
+            "\tldrb w0, [x1, x21]\n"
+            "\tadd x21, x21, #1\n"
+            "\tret\n");
+}
+
+/**
+ * @brief Points x2 at the cell `offset` bytes from the tape pointer, unless it is close
+ * enough to use x19 with an immediate offset. The operand to use is written by the caller.
+ */
+static void emit_addr(FILE* output, long offset) {
+    if (offset < -256 || offset > 255) {
+        emit_imm(output, "w2", offset);
+        fprintf(output, "\tadd x2, x19, w2, sxtw\n");
+    }
+}
+
+/**
+ * @brief Loads a 32-bit constant into a register.
+ */
+static void emit_imm(FILE* output, const char* reg, long v) {
+    unsigned long u = (unsigned long) v & 0xffffffffUL;
+
+    fprintf(output, "\tmovz %s, #%lu\n", reg, u & 0xffff);
+    if (u >> 16) {
+        fprintf(output, "\tmovk %s, #%lu, lsl #16\n", reg, u >> 16);
+    }
+}
+
+/**
+ * @brief Starts from the cells, tape pointer and output the program's prefix reached.
+ *
+ * The output is written by pointing bfx_flush at it instead of the output buffer.
+ */
+static void emit_resume(FILE* output, const bfx_prefix_t* prefix, long k) {
+    if (prefix->cells > 0) {
+        fprintf(output, "\tadrp x1, bfx_cells\n\tadd x1, x1, :lo12:bfx_cells\n\tmov x2, x19\n");
+        emit_imm(output, "w3", (long) prefix->cells * k);
+        fprintf(output,
+                "1:\tldrb w0, [x1], #1\n"
+                "\tstrb w0, [x2], #1\n"
+                "\tsubs w3, w3, #1\n"
+                "\tb.ne 1b\n");
+    }
+    if (prefix->tp != 0) {
+        emit_imm(output, "w1", (long) prefix->tp * k);
+        fprintf(output, "\tadd x19, x19, w1, uxtw\n");
+    }
+    if (prefix->output_len > 0) {
+        fprintf(output, "\tadrp x23, bfx_output\n\tadd x23, x23, :lo12:bfx_output\n");
+        emit_imm(output, "w20", (long) prefix->output_len);
+        fprintf(output, "\tbl bfx_flush\n\tadrp x23, o\n\tadd x23, x23, :lo12:o\n");
+    }
+}
+
+static void emit_op(FILE* output, const bfx_op_t* op, size_t ip, bfx_parameters_t params) {
+    const char* ld;
+    const char* st;
+    char        cell[32];
+    long        k;
+    long        offset;
+
+    switch (params.cell_width) {
+    case 16:
+        ld = "ldurh";
+        st = "sturh";
+        break;
+    case 32:
+        ld = "ldur";
+        st = "stur";
+        break;
+    default:
+        ld = "ldurb";
+        st = "sturb";
+        break;
+    }
+    k      = params.cell_width / 8;
+    offset = (long) op->offset * k;
+    if (offset < -256 || offset > 255) {
+        sprintf(cell, "[x2]");
+    } else {
+        sprintf(cell, "[x19, #%ld]", offset);
+    }
+
+    switch (op->op) {
+    case BFX_OP_ADD:
+        emit_addr(output, offset);
+        emit_imm(output, "w1", op->arg);
+        fprintf(output, "\t%s w0, %s\n\tadd w0, w0, w1\n\t%s w0, %s\n", ld, cell, st, cell);
+        break;
+    case BFX_OP_MOVE:
+        emit_imm(output, "w1", op->arg * k);
+        fprintf(output, "\tadd x19, x19, w1, sxtw\n");
+        break;
+    case BFX_OP_JZ:
+        fprintf(output,
+                "\t%s w0, [x19]\n\tcbnz w0, .L%luB\n\tb .L%luE\n.L%luB:\n",
+                ld,
+                (unsigned long) ip,
+                (unsigned long) ip,
+                (unsigned long) ip);
+        break;
+    case BFX_OP_JNZ:
+        /* b reaches further than cbz, so long loops still assemble */
+        fprintf(output,
+                "\t%s w0, [x19]\n\tcbz w0, .L%dE\n\tb .L%dB\n.L%dE:\n",
+                ld,
+                op->arg,
+                op->arg,
+                op->arg);
+        break;
+    case BFX_OP_IN:
+        /* bfx_getc clobbers x2, and emit_addr() leaves the flags alone */
+        fprintf(output, "\tbl bfx_getc\n\tcmn w0, #1\n");
+        emit_addr(output, offset);
+        switch (params.eof_behavior) {
+        case BFX_EOF_BEHAVIOR_ZERO:
+            fprintf(output, "\tcsel w0, wzr, w0, eq\n\t%s w0, %s\n", st, cell);
+            break;
+        case BFX_EOF_BEHAVIOR_DECREMENT:
+            fprintf(output,
+                    "\tb.ne 1f\n\t%s w0, %s\n\tsub w0, w0, #1\n1:\t%s w0, %s\n",
+                    ld,
+                    cell,
+                    st,
+                    cell);
+            break;
+        default:
+            fprintf(output, "\tb.eq 1f\n\t%s w0, %s\n1:\n", st, cell);
+            break;
+        }
+        break;
+    case BFX_OP_OUT:
+        /* bfx_flush clobbers x2, so the cell's address is found again for each copy */
+        if (op->arg > 1) {
+            emit_imm(output, "w25", op->arg);
+            fprintf(output, "2:\n");
+        }
+        emit_addr(output, offset);
+        fprintf(output,
+                "\tldurb w0, %s\n"
+                "\tstrb w0, [x23, x20]\n"
+                "\tadd x20, x20, #1\n"
+                "\tcmp x20, x24\n"
+                "\tb.ne 1f\n"
+                "\tbl bfx_flush\n"
+                "1:\n",
+                cell);
+        if (op->arg > 1) {
+            fprintf(output, "\tsubs w25, w25, #1\n\tb.ne 2b\n");
+        }
+        break;
+    case BFX_OP_SET:
+        emit_addr(output, offset);
+        emit_imm(output, "w0", mask(op->arg, params.cell_width));
+        fprintf(output, "\t%s w0, %s\n", st, cell);
+        break;
+    case BFX_OP_SCAN:
+        emit_imm(output, "w1", op->arg * k);
+        fprintf(output,
+                "1:\t%s w0, [x19]\n\tcbz w0, 2f\n\tadd x19, x19, w1, sxtw\n\tb 1b\n2:\n",
+                ld);
+        break;
+    case BFX_OP_MULADD:
+        emit_addr(output, offset);
+        emit_imm(output, "w1", op->arg);
+        fprintf(output,
+                "\t%s w0, [x19]\n\tmul w0, w0, w1\n\t%s w3, %s\n\tadd w3, w3, w0\n\t%s w3, %s\n",
+                ld,
+                ld,
+                cell,
+                st,
+                cell);
+        break;
+    }
+}
+
+#endif
+
+#else
+
+int bfx_assemble(FILE*                output,
+                 const bfx_program_t* program,
+                 const bfx_prefix_t*  prefix,
+                 bfx_parameters_t     params) {
+    return BFX_STATUS_INVALID_PARAMETERS;
+}
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef BFX_ASSEMBLE_H
+#define BFX_ASSEMBLE_H
+
+#include "bfx.h"
+#include "prefix.h"
+#include "program.h"
+
+#include <stdio.h>
+
+/* the generated code makes Linux system calls directly instead of linking the C library */
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#define BFX_ASSEMBLE_SUPPORTED
+#endif
+
+/* values of the prefix's cells and output written on each line of the generated source */
+#ifndef BFX_ASSEMBLE_DATA_LINE
+#define BFX_ASSEMBLE_DATA_LINE 16
+#endif
+
+int bfx_assemble(FILE*, const bfx_program_t*, const bfx_prefix_t*, bfx_parameters_t);
+
+#endif
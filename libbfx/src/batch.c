@@ -0,0 +1,511 @@
+/**
+ * @file batch.c
+ * @brief runs many programs on a pool of worker threads
+ *
+ * Each worker owns a queue of jobs and takes jobs from its front. A worker whose
+ * queue is empty steals the back half of another worker's queue, so a worker
+ * which drew long-running jobs does not hold up the rest of the batch. Since no
+ * jobs are added once the batch starts, a worker finding every queue empty is done.
+ */
+
+#include "bfx.h"
+
+#include "instance.h"
+#include "io.h"
+#include "prefix.h"
+#include "program.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * @brief Structure to represent a worker's queue: the jobs from `head` to `tail`.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    size_t          head;
+    size_t          tail;
+} bfx_batch_queue_t;
+
+/**
+ * @brief Structure to hold the state shared by the workers of a batch.
+ * @param jobs Pointer to the jobs.
+ * @param queues Queue of each worker.
+ * @param workers Number of workers.
+ */
+typedef struct {
+    bfx_job_t*         jobs;
+    bfx_batch_queue_t* queues;
+    size_t             workers;
+} bfx_batch_t;
+
+/**
+ * @brief Structure to represent a worker.
+ * @param batch Pointer to the shared state.
+ * @param id Index of the worker's queue.
+ * @param bf Interpreter state, whose tape and buffers are reused for every job.
+ * @param job Pointer to the job being run.
+ * @param input_pos Number of bytes of the job's input which were read.
+ * @param output_size Allocated size of the job's output.
+ * @param thread The worker's thread.
+ */
+typedef struct {
+    bfx_batch_t* batch;
+    size_t       id;
+    bfx_t        bf;
+    bfx_job_t*   job;
+    size_t       input_pos;
+    size_t       output_size;
+    pthread_t    thread;
+} bfx_worker_t;
+
+/**
+ * @brief Structure to represent a manifest entry while the batch is loaded.
+ * @param program Path to the program.
+ * @param input Path to the input, or NULL.
+ * @param job Index of the entry's job.
+ */
+typedef struct {
+    const char* program;
+    const char* input;
+    size_t      job;
+} bfx_batch_entry_t;
+
+static int    compare_entries(const void*, const void*);
+static int    next_job(bfx_worker_t*, size_t*);
+static size_t parse_manifest(char*, bfx_batch_entry_t**);
+static size_t read_job(void*, uint8_t*, size_t);
+static char*  read_path(const char*, size_t*);
+static void*  run_worker(void*);
+static size_t write_job(void*, const uint8_t*, size_t);
+
+/**
+ * @brief Runs a batch of jobs on a pool of worker threads.
+ *
+ * Jobs may share programs, which are only read. Each worker allocates one tape and
+ * one set of I/O buffers, which it resets between jobs. A job's input is read from
+ * `input`, and its output is collected in `output`, which the caller frees.
+ *
+ * @param jobs Pointer to the jobs.
+ * @param len Number of jobs.
+ * @param params Parameters for every job (see bfx_instance_create()). `jobs` is the
+ *               number of worker threads, or 0 for one per online CPU.
+ *
+ * @return Returns BFX_STATUS_OK if every job was run, in which case each job's
+ *         status is that of its run, BFX_STATUS_INVALID_PARAMETERS, or
+ *         BFX_STATUS_NO_MEMORY.
+ */
+int bfx_batch_run(bfx_job_t* jobs, size_t len, bfx_parameters_t params) {
+    bfx_batch_t   batch;
+    bfx_worker_t* workers;
+    size_t        started;
+    size_t        i;
+    long          cpus;
+    int           ret;
+
+    if (len == 0) {
+        return BFX_STATUS_OK;
+    }
+
+    batch.workers = params.jobs;
+    if (params.jobs <= 0) {
+        cpus          = sysconf(_SC_NPROCESSORS_ONLN);
+        batch.workers = cpus > 0 ? cpus : 1;
+    }
+    if (batch.workers > len) {
+        batch.workers = len;
+    }
+
+    batch.jobs   = jobs;
+    batch.queues = malloc(sizeof(bfx_batch_queue_t) * batch.workers);
+    workers      = malloc(sizeof(bfx_worker_t) * batch.workers);
+    if (!batch.queues || !workers) {
+        free(batch.queues);
+        free(workers);
+        return BFX_STATUS_NO_MEMORY;
+    }
+
+    ret = BFX_STATUS_OK;
+    for (i = 0; i < batch.workers && !ret; i++) {
+        pthread_mutex_init(&batch.queues[i].lock, NULL);
+        batch.queues[i].head = len * i / batch.workers;
+        batch.queues[i].tail = len * (i + 1) / batch.workers;
+        workers[i].batch     = &batch;
+        workers[i].id        = i;
+        if ((ret = bfx_state_init(&workers[i].bf, params))) {
+            pthread_mutex_destroy(&batch.queues[i].lock);
+            break;
+        }
+        workers[i].bf.io.read  = read_job;
+        workers[i].bf.io.write = write_job;
+        workers[i].bf.io.data  = &workers[i];
+    }
+    started = i;
+
+    /* the calling thread is the first worker */
+    if (!ret) {
+        for (i = 1; i < batch.workers; i++) {
+            if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i])) {
+                break;
+            }
+        }
+        started = i;
+        run_worker(&workers[0]);
+        for (i = 1; i < started; i++) {
+            pthread_join(workers[i].thread, NULL);
+        }
+        started = batch.workers;
+    }
+
+    for (i = 0; i < started; i++) {
+        bfx_state_free(&workers[i].bf);
+        pthread_mutex_destroy(&batch.queues[i].lock);
+    }
+    free(batch.queues);
+    free(workers);
+    return ret;
+}
+
+/**
+ * @brief Runs the jobs listed in a manifest file and writes their output in order.
+ *
+ * Each line of the manifest names a program file, optionally followed by an input
+ * file, separated by whitespace. Blank lines and lines starting with '#' are skipped.
+ * Every program is compiled once, however many jobs run it, and the part of it which
+ * runs before its first input is evaluated once too (see bfx_program_evaluate()).
+ *
+ * @param path Path to the manifest, or "-" for stdin.
+ * @param params Parameters for every job (see bfx_batch_run()).
+ */
+void bfx_run_batch(const char* path, bfx_parameters_t params) {
+    bfx_batch_entry_t* entries;
+    bfx_program_t**    programs;
+    bfx_job_t*         jobs;
+    char*              manifest;
+    char*              src;
+    size_t             len;
+    size_t             src_len;
+    size_t             i;
+    size_t             j;
+    bool               failed;
+
+    if (!(manifest = read_path(path, &len))) {
+        exit(EXIT_FAILURE);
+    }
+    len = parse_manifest(manifest, &entries);
+
+    jobs     = calloc(len > 0 ? len : 1, sizeof(bfx_job_t));
+    programs = calloc(len > 0 ? len : 1, sizeof(bfx_program_t*));
+    if (!jobs || !programs) {
+        BFX_ERROR("Cannot allocate memory for the batch.");
+    }
+
+    /* sort by program, so each program is compiled once for all of its jobs */
+    qsort(entries, len, sizeof(bfx_batch_entry_t), compare_entries);
+    failed = false;
+    src    = NULL;
+    for (i = 0; i < len && !failed; i++) {
+        j = entries[i].job;
+        if (i > 0 && !strcmp(entries[i].program, entries[i - 1].program)) {
+            jobs[j].program = jobs[entries[i - 1].job].program;
+        } else if (!(src = read_path(entries[i].program, &src_len))) {
+            failed = true;
+        } else if (bfx_program_create(&programs[j], src, src_len, params.flags)) {
+            fprintf(stderr, "Error: Cannot compile %s.\n", entries[i].program);
+            failed = true;
+        } else {
+            /* the prefix is only an optimization, so jobs still run if it fails */
+            bfx_program_evaluate(programs[j], params);
+            jobs[j].program = programs[j];
+        }
+        free(src);
+        src = NULL;
+
+        if (!failed && entries[i].input
+            && !(jobs[j].input = (uint8_t*) read_path(entries[i].input, &jobs[j].input_len))) {
+            failed = true;
+        }
+    }
+
+    if (!failed) {
+        switch (bfx_batch_run(jobs, len, params)) {
+        case BFX_STATUS_OK:
+            break;
+        case BFX_STATUS_INVALID_PARAMETERS:
+            fprintf(stderr, "Error: Invalid batch parameters.\n");
+            failed = true;
+            break;
+        default:
+            BFX_ERROR("Cannot allocate memory for the batch.");
+        }
+    }
+
+    for (i = 0; i < len; i++) {
+        if (!failed) {
+            fwrite(jobs[i].output, 1, jobs[i].output_len, stdout);
+            if (jobs[i].status) {
+                fprintf(stderr, "Error: Cannot store the output of job %lu.\n", (unsigned long) i);
+                failed = true;
+            }
+        }
+        free(jobs[i].output);
+        free((uint8_t*) jobs[i].input);
+        bfx_program_destroy(programs[i]);
+    }
+    fflush(stdout);
+
+    free(jobs);
+    free(programs);
+    free(entries);
+    free(manifest);
+    if (failed) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Orders manifest entries by program path, then by position in the manifest.
+ */
+static int compare_entries(const void* a, const void* b) {
+    const bfx_batch_entry_t* x;
+    const bfx_batch_entry_t* y;
+    int                      cmp;
+
+    x = a;
+    y = b;
+    if ((cmp = strcmp(x->program, y->program))) {
+        return cmp;
+    }
+    return x->job < y->job ? -1 : x->job > y->job;
+}
+
+/**
+ * @brief Takes the next job for a worker, stealing from other workers if it has none.
+ *
+ * @param worker Pointer to the worker.
+ * @param job Set to the index of the job.
+ *
+ * @return Returns 1 if a job was taken, or 0 if every queue is empty.
+ */
+static int next_job(bfx_worker_t* worker, size_t* job) {
+    bfx_batch_t*       batch;
+    bfx_batch_queue_t* own;
+    bfx_batch_queue_t* victim;
+    size_t             half;
+    size_t             i;
+
+    batch = worker->batch;
+    own   = &batch->queues[worker->id];
+
+    pthread_mutex_lock(&own->lock);
+    if (own->head < own->tail) {
+        *job = own->head++;
+        pthread_mutex_unlock(&own->lock);
+        return 1;
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    for (i = 1; i < batch->workers; i++) {
+        victim = &batch->queues[(worker->id + i) % batch->workers];
+        pthread_mutex_lock(&victim->lock);
+        if (victim->head < victim->tail) {
+            half = (victim->tail - victim->head + 1) / 2;
+            victim->tail -= half;
+            *job = victim->tail;
+            pthread_mutex_unlock(&victim->lock);
+
+            /* keep the rest of the stolen jobs, so others can steal them in turn */
+            pthread_mutex_lock(&own->lock);
+            own->head = *job + 1;
+            own->tail = *job + half;
+            pthread_mutex_unlock(&own->lock);
+            return 1;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return 0;
+}
+
+/**
+ * @brief Splits a manifest into entries, in place.
+ *
+ * @param manifest Contents of the manifest, which must be terminated by a NUL byte.
+ * @param entries Set to the entries, which point into `manifest`.
+ *
+ * @return Returns the number of entries.
+ */
+static size_t parse_manifest(char* manifest, bfx_batch_entry_t** entries) {
+    const char* fields[2];
+    size_t      len;
+    size_t      size;
+    size_t      n;
+    char*       line;
+    char*       end;
+    char*       p;
+
+    len  = 0;
+    size = BFX_INITIAL_LOOP_SIZE;
+    if (!(*entries = malloc(sizeof(bfx_batch_entry_t) * size))) {
+        BFX_ERROR("Cannot allocate memory for the batch.");
+    }
+
+    for (line = manifest; *line; line = end) {
+        if ((end = strchr(line, '\n'))) {
+            *end++ = '\0';
+        } else {
+            end = line + strlen(line);
+        }
+
+        fields[0] = NULL;
+        fields[1] = NULL;
+        for (p = line, n = 0; n < 2; n++) {
+            p += strspn(p, " \t\r");
+            if (!*p) {
+                break;
+            }
+            fields[n] = p;
+            p += strcspn(p, " \t\r");
+            if (*p) {
+                *p++ = '\0';
+            }
+        }
+        if (!fields[0] || *fields[0] == '#') {
+            continue;
+        }
+
+        if (len >= size) {
+            size *= 2;
+            if (!(*entries = realloc(*entries, sizeof(bfx_batch_entry_t) * size))) {
+                BFX_ERROR("Cannot reallocate memory for the batch.");
+            }
+        }
+        (*entries)[len].program = fields[0];
+        (*entries)[len].input   = fields[1];
+        (*entries)[len].job     = len;
+        len++;
+    }
+    return len;
+}
+
+/**
+ * @brief Reads the input of a worker's current job.
+ */
+static size_t read_job(void* data, uint8_t* buf, size_t size) {
+    bfx_worker_t* worker;
+    size_t        n;
+
+    worker = data;
+    n      = worker->job->input_len - worker->input_pos;
+    if (n > size) {
+        n = size;
+    }
+    memcpy(buf, worker->job->input + worker->input_pos, n);
+    worker->input_pos += n;
+    return n;
+}
+
+/**
+ * @brief Reads a whole file into memory, followed by a NUL byte.
+ *
+ * @param path Path to the file, or "-" for stdin.
+ * @param len Set to the length of the file.
+ *
+ * @return Returns the contents of the file, or NULL if it cannot be read.
+ */
+static char* read_path(const char* path, size_t* len) {
+    FILE*  file;
+    char*  buf;
+    size_t size;
+    size_t n;
+
+    if (!strcmp(path, "-")) {
+        file = stdin;
+    } else if (!(file = fopen(path, "rb"))) {
+        fprintf(stderr, "Error: Cannot open file %s for reading.\n", path);
+        return NULL;
+    }
+
+    *len = 0;
+    size = BFX_INITIAL_PROGRAM_SIZE;
+    if (!(buf = malloc(size))) {
+        BFX_ERROR("Cannot allocate memory for the batch.");
+    }
+    while ((n = fread(buf + *len, 1, size - *len - 1, file)) > 0) {
+        *len += n;
+        if (*len + 1 == size) {
+            size *= 2;
+            if (!(buf = realloc(buf, size))) {
+                BFX_ERROR("Cannot reallocate memory for the batch.");
+            }
+        }
+    }
+    buf[*len] = '\0';
+
+    if (ferror(file)) {
+        fprintf(stderr, "Error: Cannot read %s: %s.\n", path, strerror(errno));
+        free(buf);
+        buf = NULL;
+    }
+    if (file != stdin) {
+        fclose(file);
+    }
+    return buf;
+}
+
+/**
+ * @brief Runs jobs until there are none left.
+ * @param data Pointer to the worker.
+ */
+static void* run_worker(void* data) {
+    bfx_worker_t* worker;
+    size_t        job;
+
+    worker = data;
+    while (next_job(worker, &job)) {
+        bfx_state_reset(&worker->bf);
+        worker->job             = &worker->batch->jobs[job];
+        worker->input_pos       = 0;
+        worker->output_size     = 0;
+        worker->job->output     = NULL;
+        worker->job->output_len = 0;
+
+        bfx_run_program(&worker->bf, worker->job->program);
+        bfx_io_flush(&worker->bf);
+        worker->job->status = worker->bf.status;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Appends output to a worker's current job.
+ *
+ * @return Returns `len`, or 0 if the output cannot be grown.
+ */
+static size_t write_job(void* data, const uint8_t* buf, size_t len) {
+    bfx_worker_t* worker;
+    bfx_job_t*    job;
+    uint8_t*      output;
+    size_t        size;
+
+    worker = data;
+    job    = worker->job;
+    if (job->output_len + len > worker->output_size) {
+        size = worker->output_size ? worker->output_size : BFX_DEFAULT_IO_BUFFER_SIZE;
+        while (size < job->output_len + len) {
+            size *= 2;
+        }
+        if (!(output = realloc(job->output, size))) {
+            return 0;
+        }
+        job->output         = output;
+        worker->output_size = size;
+    }
+
+    memcpy(job->output + job->output_len, buf, len);
+    job->output_len += len;
+    return len;
+}
@@ -13,179 +13,247 @@
 
 #include "bfx.h"
 
+#include "checkpoint.h"
+#include "fork.h"
+#include "instance.h"
 #include "interpret.h"
+#include "io.h"
+#include "profile.h"
+#include "program.h"
+#include "stats.h"
+#include "tape.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-static void build_loops(bfx_t*);
+static int  check_line(const bfx_builder_t*, const char*, size_t);
 static void free_bf(bfx_t*);
 static void init_bf(bfx_t*, bfx_parameters_t);
 static void init_tokens(void);
-static int  load_file(bfx_t*, const char*);
+static int  load_file(bfx_t*, bfx_program_t*, const char*);
+static void print_unmatched(const bfx_file_index_t*, bool);
+static int  read_input(bfx_t*, int, const char*, size_t);
 static void reset(bfx_t*);
-static void reset_loops(bfx_t*);
+static void separate_input(bfx_t*);
+static int  stream_file(bfx_t*, bfx_program_t*, int);
 
 /**
  * @brief Resets the brainfuck program state.
  *
  * This function resets the program state by clearing the program buffer,
  * tape, and loop structure, and resetting the instruction pointer and tape pointer.
+ * Only the cells up to `tp_max` are cleared, since no others can have been written.
  */
 void bfx_reset(bfx_t* bf) {
-    reset_loops(bf);
-    memset(bf->prog, 0, bf->prog_len * sizeof(char));
-    memset(bf->tape, 0, bf->tape_size * sizeof(uint8_t));
-    bf->prog_len = 0;
-    bf->ip       = 0;
-    bf->tp       = 0;
-    bf->tp_max   = 0;
+    if (bf->prog) {
+        memset(bf->prog, 0, bf->prog_len * sizeof(char));
+    }
+    bfx_tape_clear(bf->tape, bf->tape_size * BFX_CELL_SIZE(*bf), BFX_DIRTY_SIZE(*bf));
+    bf->prog_len  = 0;
+    bf->ip        = 0;
+    bf->tp        = 0;
+    bf->tp_max    = 0;
+    bf->lines_len = 1;
 }
 
 /**
  * @brief Runs the brainfuck program loaded from a file.
  *
- * This function builds the loop structure for the brainfuck program,
- * then iterates through the program instructions, interpreting each one
- * until the end of the program is reached.
+ * This function compiles the brainfuck program to the intermediate representation,
+ * replaces common loop idioms, then executes it until the end of the program is reached,
+ * using the JIT if `BFX_FLAG_JIT` is set or the threaded engine if `BFX_FLAG_THREADED` is set.
+ *
+ * If `path` is NULL or "-", the program is read from stdin. If `BFX_FLAG_GROWABLE_TAPE`
+ * is set, the tape is reserved in virtual memory and grows as it is used.
+ *
+ * If `BFX_FLAG_INTERPRET_SOURCE` is set, the source is run by bfx_interpret() instead,
+ * which is much slower but serves as a baseline for the other engines. The source
+ * must then be a regular file, since streamed sources are not kept.
+ *
+ * If `BFX_FLAG_PROFILE` is set, the program is run by bfx_profile(), which reports
+ * its hot loops and instructions to stderr once it ends. If `BFX_FLAG_STATS` is set, it
+ * is run by bfx_stats(), which measures the run of the selected engine and reports it
+ * to stderr as JSON.
+ *
+ * If `params.input_path` is set, input is read from that file instead of stdin (see
+ * bfx_io_open()). If `params.resume_path` is set, the run continues from that snapshot. If
+ * `params.checkpoint_interval` is set, the program is run by bfx_run_checkpointed(),
+ * which writes a snapshot to `params.checkpoint_path` that often.
+ *
+ * If `BFX_FLAG_BRAINFORK` is set, brainfork's 'Y' forks the program into threads (see
+ * fork.c), and this returns once every thread has ended.
  */
 void bfx_run_file(const char* path, bfx_parameters_t params) {
-    bfx_t            bf;
-    bfx_file_index_t idx;
+    bfx_t         bf;
+    bfx_program_t program;
+    int           ret;
 
     init_bf(&bf, params);
-    load_file(&bf, path);
-    idx.line     = 1;
-    idx.line_idx = 0;
-    build_loops(&bf);
+    if ((ret = load_file(&bf, &program, path))) {
+        if (ret == BFX_STATUS_NO_MEMORY) {
+            BFX_ERROR("Cannot allocate memory for program storage.");
+        }
+        free_bf(&bf);
+        exit(EXIT_FAILURE);
+    }
+    if (params.input_path && bfx_io_open(&bf, params.input_path)) {
+        BFX_ERROR("Cannot open the input file.");
+    }
+
+    if (bf.flags & BFX_FLAG_INTERPRET_SOURCE) {
+        if (!bf.prog) {
+            BFX_ERROR("The source interpreter needs the program in a regular file.");
+        }
+        if ((ret = bfx_build_loops(&bf))) {
+            BFX_ERROR(ret == BFX_STATUS_NO_MEMORY ? "Cannot allocate memory for loop storage."
+                                                  : "Unbalanced brackets");
+        }
+        bfx_interpret(&bf);
+        bfx_program_free(&program);
+        free_bf(&bf);
+        return;
+    }
+
+    if (bfx_program_optimize(&program)) {
+        BFX_ERROR("Cannot allocate memory for loop storage.");
+    }
+    if (bf.flags & BFX_FLAG_GROWABLE_TAPE) {
+        bfx_tape_init(&bf, &program);
+    }
+    if (params.resume_path && (ret = bfx_snapshot_load(&bf, &program, params.resume_path))) {
+        BFX_ERROR(ret == BFX_STATUS_INVALID_PARAMETERS
+                      ? "The snapshot was not taken of this program with these options."
+                      : "Cannot resume from the snapshot.");
+    }
+    if ((bf.flags & BFX_FLAG_BRAINFORK) && bfx_forks_init(&bf)) {
+        BFX_ERROR("Cannot allocate memory for forked threads.");
+    }
 
-    for (bf.ip = 0; (size_t) bf.ip < bf.prog_len; bf.ip++) {
-        bfx_interpret(&bf, &idx);
+    if (params.checkpoint_interval) {
+        bfx_run_checkpointed(&bf, &program, params.checkpoint_path, params.checkpoint_interval);
+    } else if (bf.flags & BFX_FLAG_STATS) {
+        bfx_stats(&bf, &program, stderr);
+    } else if (!(bf.flags & BFX_FLAG_PROFILE)) {
+        bfx_run_program(&bf, &program);
+    } else if (bfx_profile(&bf, &program, stderr)) {
+        BFX_ERROR("Cannot allocate memory for the profile.");
+    }
+    bfx_forks_join(&bf);
+    if (bf.status == BFX_STATUS_NO_MEMORY) {
+        BFX_ERROR("Cannot allocate memory for a forked thread.");
     }
-    free(bf.prog);
+    bfx_program_free(&program);
+    free_bf(&bf);
 }
 
 /**
  * @brief Runs the brainfuck interpreter in REPL (Read-Eval-Print Loop) mode.
  *
- * This function continuously reads input from the user, appends it to the program,
- * and interprets the brainfuck instructions until the user terminates the program.
- * This allows for interactive execution of brainfuck code.
+ * This function continuously reads input from the user and runs each line as it is
+ * entered, until the user terminates the program. The tape persists between lines.
+ *
+ * Only the new line is compiled, and once every bracket is closed its instructions
+ * are run and dropped, so each prompt costs the same however long the session has
+ * been. A line which leaves a bracket open is kept until a later line closes it,
+ * and a line with an unmatched closing bracket is rejected. `@` resets the tape and
+ * discards the rest of its line.
  */
 void bfx_run_repl(bfx_parameters_t params) {
-    bfx_t            bf;
-    bfx_file_index_t index;
-    char*            input;
-    size_t           prog_len_old;
+    bfx_t         bf;
+    bfx_program_t program;
+    bfx_builder_t builder;
+    char*         input;
+    char*         reset;
+    size_t        len;
 
+    /* the REPL has no program to size guard pages for, so it always uses a fixed tape */
+    params.flags &= ~BFX_FLAG_GROWABLE_TAPE;
     init_bf(&bf, params);
 
-    bf.prog_size = params.input_max;
-
-    if (!(bf.prog = (char*) malloc(bf.prog_size + 1))
-        || !(input = (char*) malloc(bf.prog_size + 1))) {
+    if (!(input = (char*) malloc(params.input_max + 1))
+        || bfx_builder_init(&builder, &program, bf.flags)) {
         BFX_ERROR("Cannot allocate memory for program storage.");
     }
 
     while (1) {
-        printf("> ");
+        bfx_io_flush(&bf);
+        printf(builder.stack_top ? "... " : "> ");
+        fflush(stdout);
         if (!fgets(input, params.input_max, stdin)) {
             break;
         }
 
-        prog_len_old = bf.prog_len;
-        bf.prog_len += strlen(input);
-        if (bf.prog_len > bf.prog_size) {
-            bf.prog_size *= 2;
-            if (!(bf.prog = realloc(bf.prog, bf.prog_size))) {
-                BFX_ERROR("Cannot reallocate memory for program storage.");
-            }
+        len   = strlen(input);
+        reset = BFX_SPECIAL_INSTRUCTIONS_ENABLED(bf) ? memchr(input, '@', len) : NULL;
+        if (reset) {
+            len = reset - input;
+        }
+        if (check_line(&builder, input, len)) {
+            continue;
+        }
+        if (bfx_builder_feed(&builder, input, len)) {
+            BFX_ERROR("Cannot allocate memory for program storage.");
         }
 
-        snprintf(bf.prog + prog_len_old, bf.prog_size - prog_len_old, "%s", input);
-        reset_loops(&bf);
-        build_loops(&bf);
-        index.line     = 1;
-        index.line_idx = 0;
-        for (; (size_t) bf.ip < bf.prog_len; bf.ip++) {
-            bfx_interpret(&bf, &index);
+        if (builder.stack_top == 0) {
+            if (bfx_program_optimize(&program)) {
+                BFX_ERROR("Cannot allocate memory for loop storage.");
+            }
+            bfx_run_program(&bf, &program);
+            bfx_builder_discard(&builder);
+            bf.ip = 0;
+        }
+        if (reset) {
+            bfx_reset(&bf);
+            bfx_builder_reset(&builder);
         }
     }
 
+    if (bfx_builder_finish(&builder) == BFX_STATUS_SYNTAX_ERROR) {
+        print_unmatched(&builder.error, true);
+    }
+    bfx_program_free(&program);
     free(input);
     free_bf(&bf);
 }
 
 /**
- * @brief Builds the loop structure for the brainfuck interpreter.
+ * @brief Checks a line entered in the REPL for an unmatched closing bracket.
+ *
+ * Brackets left open by earlier lines are taken into account. Since a builder is
+ * freed when it fails, lines are checked before they are compiled, so an error does
+ * not end the session.
  *
- * This function scans the brainfuck program and constructs the necessary
- * data structures to efficiently handle loop constructs ('[' and ']').
- * It ensures that matching brackets are correctly paired, allowing for
- * proper execution flow during interpretation.
+ * @param builder Pointer to the REPL's builder.
+ * @param line The line.
+ * @param len Length of the line.
  *
- * @note This function does not return a value. If an error occurs (such as exceeding MAX_LOOPS),
- *       it prints an error message and terminates the program using exit(EXIT_FAILURE).
+ * @return Returns 0 if the line can be compiled, or 1 after printing an error.
  */
-static void build_loops(bfx_t* bf) {
-    bfx_file_index_t* stack;
-    bfx_file_index_t  start;
-    int               stack_top;
-    int               stack_size;
-    int               line;
-    int               line_idx;
-    size_t            i;
-
-    stack          = malloc(sizeof(bfx_file_index_t) * BFX_INITIAL_LOOP_SIZE);
-    stack_top      = 0;
-    stack_size     = BFX_INITIAL_LOOP_SIZE;
-    line           = 1;
-    line_idx       = 0;
-    bf->loops_len  = 0;
-    bf->loops_size = BFX_INITIAL_LOOP_SIZE;
-    bf->loops      = malloc(sizeof(bfx_loop_t) * BFX_INITIAL_LOOP_SIZE);
-
-    for (i = 0; i < bf->prog_len; i++) {
-        line_idx++;
-        if (bf->prog[i] == '[') {
-            if (stack_top >= stack_size) {
-                stack_size *= 2;
-                stack = realloc(stack, sizeof(bfx_file_index_t) * stack_size);
-            }
-            stack[stack_top].idx      = i;
-            stack[stack_top].line     = line;
-            stack[stack_top].line_idx = line_idx;
-            stack_top++;
-        } else if (bf->prog[i] == ']') {
-            if (stack_top <= 0) {
-                fprintf(stderr,
-                        "libbfx: Error (%d,%d): Unmatched closing bracket ']'.\n",
-                        line,
-                        line_idx);
-                free(stack);
-                exit(EXIT_FAILURE);
-            }
-            start                                 = stack[--stack_top];
-            bf->loops[bf->loops_len].start        = start;
-            bf->loops[bf->loops_len].end.idx      = i;
-            bf->loops[bf->loops_len].end.line     = line;
-            bf->loops[bf->loops_len].end.line_idx = line_idx;
-            bf->loops_len++;
-        } else if (bf->prog[i] == '\n') {
-            line++;
-            line_idx = 0;
-        }
-    }
+static int check_line(const bfx_builder_t* builder, const char* line, size_t len) {
+    bfx_file_index_t pos;
+    size_t           depth;
+    size_t           i;
 
-    if (stack_top != 0) {
-        fprintf(stderr, "libbfx: Error (%d,%d): Unmatched opening bracket '['.\n", line, line_idx);
-        free(stack);
-        exit(EXIT_FAILURE);
+    depth = builder->stack_top;
+    for (i = 0; i < len; i++) {
+        if (line[i] == '[') {
+            depth++;
+        } else if (line[i] == ']' && depth-- == 0) {
+            pos = builder->pos;
+            pos.line_idx += (int) i + 1;
+            print_unmatched(&pos, false);
+            return 1;
+        }
     }
-
-    free(stack);
+    return 0;
 }
 
 /**
@@ -194,15 +262,23 @@ static void build_loops(bfx_t* bf) {
  */
 static void free_bf(bfx_t* bf) {
     if (bf) {
-        if (bf->prog) {
+        if (bf->prog_mapped) {
+            munmap(bf->prog, bf->prog_mapped);
+        } else if (bf->prog) {
             free(bf->prog);
         }
-        if (bf->tape) {
-            free(bf->tape);
+        if (bf->tape_guard) {
+            bfx_tape_free(bf);
+        } else {
+            bfx_tape_release(bf->tape, bf->tape_size * BFX_CELL_SIZE(*bf), BFX_DIRTY_SIZE(*bf));
+        }
+        if (bf->jumps) {
+            free(bf->jumps);
         }
-        if (bf->loops) {
-            free(bf->loops);
+        if (bf->lines) {
+            free(bf->lines);
         }
+        bfx_io_free(bf);
     }
 }
 
@@ -215,74 +291,212 @@ static void init_bf(bfx_t* bf, bfx_parameters_t params) {
     memset(bf, 0, sizeof(bfx_t));
     bf->flags        = params.flags;
     bf->tape_size    = params.tape_size;
-    bf->tape         = calloc(params.tape_size, sizeof(uint8_t));
+    bf->cell_width   = params.cell_width;
+    if (!(params.flags & BFX_FLAG_GROWABLE_TAPE)
+        && !(bf->tape = bfx_tape_acquire(params.tape_size * BFX_CELL_SIZE(*bf)))) {
+        BFX_ERROR("Cannot allocate memory for the tape.");
+    }
     bf->receiving    = true;
     bf->eof_behavior = params.eof_behavior;
+    if (bfx_io_init(bf, params.io_buffer_size)) {
+        BFX_ERROR("Cannot allocate memory for I/O buffers.");
+    }
 }
 
 /**
- *  @brief Loads a brainfuck program from a file into memory.
- *
- *   This function opens the specified file, reads its contents into a dynamically allocated buffer,
- *   and stores the program length. If the file cannot be opened or memory allocation fails,
- *   it prints an error message and returns a non-zero value to indicate failure.
+ *  @brief Loads a brainfuck program from a file and compiles it.
  *
- *  @param path The path to the brainfuck program file.
+ *   Regular files are mapped into memory rather than copied, so the source given to
+ *   the IR builder is the page cache itself. Anything else (pipes, terminals, or a
+ *   file which cannot be mapped) is read in chunks by stream_file(), so the source
+ *   is never held in memory as a whole.
  *
- *  @return Returns 0 on success, or 1 if an error occurs (e.g., file not found, memory allocation failure).
+ *  @param bf Pointer to the brainfuck program.
+ *  @param program Pointer to the program to build.
+ *  @param path The path to the brainfuck program file, or NULL or "-" for stdin.
  *
- *  @note The program is expected to be in plain text format, with brainfuck instructions.
- *        The function allocates memory for the program and reads the entire file into this buffer.
- *        The caller is responsible for freeing the allocated memory.
+ *  @return Returns 0 on success, or a BFX_STATUS_* code if an error occurs (e.g., file
+ *          not found, unmatched bracket).
  */
-static int load_file(bfx_t* bf, const char* path) {
-    FILE*  f;
-    size_t i;
-
-    if ((f = fopen(path, "r"))) {
-        fseek(f, 0, SEEK_END);
-        bf->prog_len = ftell(f);
-        fseek(f, 0, SEEK_SET);
-
-        if ((bf->prog = (char*) malloc(bf->prog_len))) {
-            if (fread(bf->prog, 1, bf->prog_len, f) != (unsigned long) bf->prog_len) {
-                fprintf(stderr, "Error: Cannot read file %s.\n", path);
-                free(bf->prog);
-                fclose(f);
-                return 1;
-            }
-        } else {
-            fprintf(stderr, "Error: Cannot allocate memory for program storage.\n");
-            fclose(f);
-            return 1;
-        }
-        fclose(f);
-    } else {
+static int load_file(bfx_t* bf, bfx_program_t* program, const char* path) {
+    bfx_file_index_t error;
+    struct stat      st;
+    int              fd;
+    int              ret;
+    void*            map;
+
+    if (!path || !strcmp(path, "-")) {
+        return stream_file(bf, program, STDIN_FILENO);
+    }
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
         fprintf(stderr, "Error: Cannot open file %s for reading.\n", path);
-        return 1;
+        return BFX_STATUS_IO_ERROR;
+    }
+
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size <= 0
+        || (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        ret = stream_file(bf, program, fd);
+        close(fd);
+        return ret;
+    }
+    close(fd);
+
+    bf->prog        = map;
+    bf->prog_len    = st.st_size;
+    bf->prog_mapped = st.st_size;
+#ifdef MADV_SEQUENTIAL
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+#endif
+    separate_input(bf);
+
+    if ((ret = bfx_program_build(program, bf->prog, bf->prog_len, bf->flags, &error))
+        == BFX_STATUS_SYNTAX_ERROR) {
+        print_unmatched(&error, bf->prog[error.idx] == '[');
+    }
+    return ret;
+}
+
+/**
+ * @brief Prints the error for an unmatched bracket found by the IR builder.
+ * @param pos Source position of the bracket.
+ * @param opening If the bracket is an opening one.
+ */
+static void print_unmatched(const bfx_file_index_t* pos, bool opening) {
+    fprintf(stderr,
+            "libbfx: Error (%d,%d): Unmatched %s.\n",
+            pos->line,
+            pos->line_idx,
+            opening ? "opening bracket '['" : "closing bracket ']'");
+}
+
+/**
+ * @brief Reads the rest of a stream as the program's input.
+ *
+ * @param bf Pointer to the brainfuck program.
+ * @param fd File descriptor to read from.
+ * @param head Bytes of input which were already read.
+ * @param len Number of bytes in `head`.
+ *
+ * @return Returns 0 on success, or 1 if the stream cannot be read.
+ */
+static int read_input(bfx_t* bf, int fd, const char* head, size_t len) {
+    ssize_t n;
+
+    bf->prog_size = len + BFX_DEFAULT_INPUT_MAX;
+    if (!(bf->prog = malloc(bf->prog_size))) {
+        BFX_ERROR("Cannot allocate memory for input storage.");
     }
+    memcpy(bf->prog, head, len);
 
-    if (bf->flags & BFX_FLAG_SEPARATE_INPUT_AND_SOURCE) {
-        for (i = 0; i < bf->prog_len; i++) {
-            if (bf->prog[i] == '!') {
-                bf->input_start = i + 1;
-                bf->input_ptr   = bf->input_start;
-                bf->input_len   = bf->prog_len;
-                bf->prog[i]     = '\0';
-                bf->prog_len    = i;
+    while ((n = read(fd, bf->prog + len, bf->prog_size - len)) != 0) {
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0) {
+            fprintf(stderr, "Error: Cannot read input: %s.\n", strerror(errno));
+            return 1;
+        }
+        len += n;
+        if (len == bf->prog_size) {
+            bf->prog_size *= 2;
+            if (!(bf->prog = realloc(bf->prog, bf->prog_size))) {
+                BFX_ERROR("Cannot reallocate memory for input storage.");
             }
         }
     }
 
+    bf->input_start = 0;
+    bf->input_ptr   = 0;
+    bf->input_len   = len;
     return 0;
 }
 
 /**
- * @brief Resets the loop structure.
+ * @brief Splits the program at the first '!' if input is separated from source.
+ *
+ * The bytes after the '!' are used as the program's input.
+ */
+static void separate_input(bfx_t* bf) {
+    char* sep;
+
+    if ((bf->flags & BFX_FLAG_SEPARATE_INPUT_AND_SOURCE)
+        && (sep = memchr(bf->prog, '!', bf->prog_len))) {
+        bf->input_start = sep - bf->prog + 1;
+        bf->input_ptr   = bf->input_start;
+        bf->input_len   = bf->prog_len;
+        bf->prog_len    = sep - bf->prog;
+    }
+}
+
+/**
+ * @brief Compiles a program read from a file descriptor in chunks.
  *
- * This function resets the loop structure by clearing the loop buffer.
+ * Each chunk is passed to the IR builder as soon as it is read. If input is separated
+ * from source, reading stops at the first '!', whatever was read after it is moved
+ * to the input buffer, and the rest of the stream is read by ',' as usual.
+ *
+ * @param bf Pointer to the brainfuck program.
+ * @param program Pointer to the program to build.
+ * @param fd File descriptor to read from.
+ *
+ * @return Returns 0 on success, or a BFX_STATUS_* code if an error occurs.
  */
-static void reset_loops(bfx_t* bf) {
-    memset(bf->loops, 0, bf->loops_len);
-    bf->loops_len = 0;
+static int stream_file(bfx_t* bf, bfx_program_t* program, int fd) {
+    bfx_builder_t builder;
+    char*         chunk;
+    char*         sep;
+    ssize_t       n;
+    size_t        len;
+    int           ret;
+
+    if (!(chunk = malloc(bf->io_size))) {
+        BFX_ERROR("Cannot allocate memory for program storage.");
+    }
+
+    if ((ret = bfx_builder_init(&builder, program, bf->flags))) {
+        free(chunk);
+        return ret;
+    }
+    sep = NULL;
+    while (!sep && ((n = read(fd, chunk, bf->io_size)) > 0 || (n < 0 && errno == EINTR))) {
+        if (n < 0) {
+            continue;
+        }
+        len = n;
+        if ((bf->flags & BFX_FLAG_SEPARATE_INPUT_AND_SOURCE) && (sep = memchr(chunk, '!', n))) {
+            len = sep - chunk;
+            if (fd == STDIN_FILENO) {
+                /* the rest of the stream is the input, so ',' reads it like stdin */
+                bf->in_len = n - len - 1;
+                bf->in_pos = 0;
+                memcpy(bf->in, sep + 1, bf->in_len);
+                bf->flags &= ~BFX_FLAG_SEPARATE_INPUT_AND_SOURCE;
+            } else if (read_input(bf, fd, sep + 1, n - len - 1)) {
+                free(chunk);
+                free(builder.stack);
+                bfx_program_free(program);
+                return BFX_STATUS_IO_ERROR;
+            }
+        }
+        if ((ret = bfx_builder_feed(&builder, chunk, len))) {
+            if (ret == BFX_STATUS_SYNTAX_ERROR) {
+                print_unmatched(&builder.error, false);
+            }
+            free(chunk);
+            return ret;
+        }
+    }
+    free(chunk);
+
+    if (n < 0) {
+        fprintf(stderr, "Error: Cannot read program: %s.\n", strerror(errno));
+        free(builder.stack);
+        bfx_program_free(program);
+        return BFX_STATUS_IO_ERROR;
+    }
+
+    if ((ret = bfx_builder_finish(&builder)) == BFX_STATUS_SYNTAX_ERROR) {
+        print_unmatched(&builder.error, true);
+    }
+    return ret;
 }
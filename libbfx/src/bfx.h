@@ -23,6 +23,22 @@
 #define BFX_DEFAULT_COMPILE_FLAGS "-O3 -s -ffast-math"
 #endif
 
+#ifndef BFX_DEFAULT_ASSEMBLER
+#define BFX_DEFAULT_ASSEMBLER "as"
+#endif
+
+#ifndef BFX_DEFAULT_LINKER
+#define BFX_DEFAULT_LINKER "ld"
+#endif
+
+#ifndef BFX_DEFAULT_LINK_FLAGS
+#define BFX_DEFAULT_LINK_FLAGS "-s"
+#endif
+
+#ifndef BFX_DEFAULT_CELL_WIDTH
+#define BFX_DEFAULT_CELL_WIDTH 8
+#endif
+
 #ifndef BFX_DEFAULT_INPUT_MAX
 #define BFX_DEFAULT_INPUT_MAX 1024
 #endif
@@ -31,13 +47,46 @@
 #define BFX_DEFAULT_TAPE_SIZE 30000
 #endif
 
+#ifndef BFX_DEFAULT_IO_BUFFER_SIZE
+#define BFX_DEFAULT_IO_BUFFER_SIZE 65536
+#endif
+
 #ifndef BFX_INITIAL_LOOP_SIZE
 #define BFX_INITIAL_LOOP_SIZE 2048
 #endif
 
+#ifndef BFX_INITIAL_PROGRAM_SIZE
+#define BFX_INITIAL_PROGRAM_SIZE 4096
+#endif
+
+#ifndef BFX_MAX_TAPE_SIZE
+#define BFX_MAX_TAPE_SIZE 1073741824
+#endif
+
+#ifndef BFX_TAPE_COMMIT_SIZE
+#define BFX_TAPE_COMMIT_SIZE 65536
+#endif
+
+#ifndef BFX_TAPE_MAP_SIZE
+#define BFX_TAPE_MAP_SIZE 1048576
+#endif
+
+#ifndef BFX_TAPE_POOL_SIZE
+#define BFX_TAPE_POOL_SIZE 16
+#endif
+
+#ifndef BFX_TIER_THRESHOLD
+#define BFX_TIER_THRESHOLD 1000
+#endif
+
+/* the build defines LIBBFX_VERSION as the commit the library was built from */
 #ifndef BFX_VERSION
+#ifdef LIBBFX_VERSION
+#define BFX_VERSION LIBBFX_VERSION
+#else
 #define BFX_VERSION "unknown"
 #endif
+#endif
 
 #define BFX_EOF_BEHAVIOR_ZERO      0
 #define BFX_EOF_BEHAVIOR_DECREMENT 1
@@ -52,9 +101,23 @@
 #define BFX_FLAG_PBRAIN                       64
 #define BFX_FLAG_GRIN                         128
 #define BFX_FLAG_SEPARATE_INPUT_AND_SOURCE    256
+#define BFX_FLAG_THREADED                     512
+#define BFX_FLAG_JIT                          1024
+#define BFX_FLAG_GROWABLE_TAPE                2048
+#define BFX_FLAG_ASSEMBLY                     4096
+#define BFX_FLAG_INTERPRET_SOURCE             8192
+#define BFX_FLAG_PROFILE                      16384
+#define BFX_FLAG_STATS                        32768
+#define BFX_FLAG_TIERED                       65536
 
 #define BFX_DEFAULT_EOF_BEHAVIOR BFX_EOF_BEHAVIOR_ZERO
 
+#define BFX_STATUS_OK                 0
+#define BFX_STATUS_SYNTAX_ERROR       1
+#define BFX_STATUS_NO_MEMORY          2
+#define BFX_STATUS_IO_ERROR           3
+#define BFX_STATUS_INVALID_PARAMETERS 4
+
 #define BFX_ERROR(s)                                                                               \
     fprintf(stderr, "libbfx: Error: %s\n", s);                                                     \
     exit(EXIT_FAILURE);
@@ -62,6 +125,8 @@
 #define BFX_IN_DEBUG_MODE(b)                ((b).flags & BFX_FLAG_DEBUG)
 #define BFX_IN_REPL_MODE(b)                 ((b).flags & BFX_FLAG_REPL)
 #define BFX_SPECIAL_INSTRUCTIONS_ENABLED(b) (!((b).flags & BFX_FLAG_DISABLE_SPECIAL_INSTRUCTIONS))
+#define BFX_CELL_SIZE(b)                    ((size_t) (b).cell_width / 8)
+#define BFX_DIRTY_SIZE(b)                   (((size_t) (b).tp_max + 1) * BFX_CELL_SIZE(b))
 
 /**
  * @brief Structure to represent an index in a file (or user input).
@@ -70,23 +135,64 @@
  * @param line_idx Index within the line.
  */
 typedef struct {
-    int idx; /* only used for build_loops() */
+    int idx;
     int line;
     int line_idx;
 } bfx_file_index_t;
 
 /**
- *  @brief Structure to represent a loop in the brainfuck program.
- *   This structure holds the start and end indices of a loop,
- *   allowing the interpreter to efficiently jump between matching
- *   brackets during execution.
- *   @note The `start` field represents the index of the opening bracket '[',
- *         and the `end` field represents the index of the closing bracket ']'.
+ * @brief A compiled, optimized program (see program.h). A program is never modified
+ * once it is built, so any number of instances may run it at the same time.
+ */
+typedef struct bfx_program bfx_program_t;
+
+/**
+ * @brief The state of one run of a program: its tape, pointers and I/O buffers.
+ */
+typedef struct bfx_instance bfx_instance_t;
+
+/**
+ * @brief The threads forked by a brainfork program (see fork.c).
+ */
+typedef struct bfx_forks bfx_forks_t;
+
+/**
+ * @brief Reads program input.
+ * @return Returns the number of bytes read into `buf`, or 0 at the end of input.
+ */
+typedef size_t (*bfx_read_fn)(void* data, uint8_t* buf, size_t size);
+
+/**
+ * @brief Writes program output.
+ * @return Returns the number of bytes written. Writing fewer than `len` bytes is an error.
+ */
+typedef size_t (*bfx_write_fn)(void* data, const uint8_t* buf, size_t len);
+
+/**
+ * @brief Structure to hold the I/O callbacks of an interpreter.
+ * @param read Callback which reads input, or NULL if there is no input.
+ * @param write Callback which writes output, or NULL to discard output.
+ * @param data Pointer passed to both callbacks.
  */
 typedef struct {
-    bfx_file_index_t start;
-    bfx_file_index_t end;
-} bfx_loop_t;
+    bfx_read_fn  read;
+    bfx_write_fn write;
+    void*        data;
+} bfx_io_t;
+
+/**
+ * @brief Structure to hold what the engines count while `BFX_FLAG_STATS` is set (see
+ * bfx_stats()).
+ * @param ops Number of instructions of the intermediate representation run.
+ * @param jz Number of times the opening jump of a loop was tested.
+ * @param jnz Number of times the closing jump of a loop was tested.
+ */
+typedef struct {
+    uint64_t ops;
+    uint64_t jz;
+    uint64_t jnz;
+} bfx_counts_t;
+
 /**
  * @brief Structure to represent a brainfuck interpreter.
  * @param flags Flags for the interpreter.
@@ -94,33 +200,70 @@ typedef struct {
  * @param prog Pointer to the brainfuck program string.
  * @param prog_len Length of the brainfuck program string.
  * @param prog_size Size of the brainfuck program string.
- * @param tape Pointer to the tape array.
+ * @param prog_mapped Length of the mapping if `prog` is a memory-mapped file, otherwise 0.
+ * @param tape Pointer to the tape array. Cells are `cell_width` bits wide.
  * @param tape_size Size of the tape array.
+ * @param tape_guard Size of the guard regions around a growable tape, or 0 for a fixed tape.
+ * @param tape_committed Number of accessible bytes of a growable tape.
+ * @param cell_width Width of a cell in bits (8, 16 or 32).
  * @param ip Instruction pointer.
  * @param tp Data pointer.
  * @param tp_max Maximum data pointer value.
- * @param loops Pointer to the loop array.
- * @param loops_len Length of the loop array.
- * @param loops_size Size of the loop array.
+ * @param jumps Jump table indexed by instruction pointer. For each bracket, holds the
+ *              index of the matching bracket.
+ * @param lines Index of the first byte of each line of the program, used to find the
+ *              line and column of an instruction pointer (only used for diagnostics).
+ * @param lines_len Number of lines.
+ * @param lines_size Allocated size of the line array.
+ * @param out Output buffer.
+ * @param out_len Number of bytes in the output buffer.
+ * @param in Input buffer.
+ * @param in_len Number of bytes in the input buffer.
+ * @param in_pos Index of the next byte to read from the input buffer.
+ * @param in_read Number of bytes read by the read callback, or mapped.
+ * @param in_mapped Length of the mapping if `in` is a memory-mapped input file, otherwise 0.
+ * @param io_size Size of the input and output buffers.
+ * @param io I/O callbacks.
+ * @param status Status of the run (BFX_STATUS_*), set if writing output fails.
+ * @param forks Threads forked by brainfork's 'Y', shared by every thread of the run, or
+ *              NULL if threads are not started.
+ * @param counts Instructions and jumps run, only counted if `BFX_FLAG_STATS` is set.
  */
 typedef struct {
-    int         flags;
-    bool        receiving;
-    char*       prog;
-    size_t      prog_len;
-    size_t      prog_size;
-    size_t      input_start;
-    size_t      input_ptr;
-    size_t      input_len;
-    uint8_t*    tape;
-    size_t      tape_size;
-    int         ip;
-    int         tp;
-    int         tp_max;
-    bfx_loop_t* loops;
-    size_t      loops_len;
-    size_t      loops_size;
-    int         eof_behavior;
+    int          flags;
+    bool         receiving;
+    char*        prog;
+    size_t       prog_len;
+    size_t       prog_size;
+    size_t       prog_mapped;
+    size_t       input_start;
+    size_t       input_ptr;
+    size_t       input_len;
+    uint8_t*     tape;
+    size_t       tape_size;
+    size_t       tape_guard;
+    size_t       tape_committed;
+    int          cell_width;
+    int          ip;
+    int          tp;
+    int          tp_max;
+    int*         jumps;
+    size_t*      lines;
+    size_t       lines_len;
+    size_t       lines_size;
+    int          eof_behavior;
+    uint8_t*     out;
+    size_t       out_len;
+    uint8_t*     in;
+    size_t       in_len;
+    size_t       in_pos;
+    size_t       in_read;
+    size_t       in_mapped;
+    size_t       io_size;
+    bfx_io_t     io;
+    int          status;
+    bfx_forks_t* forks;
+    bfx_counts_t counts;
 } bfx_t;
 
 /**
@@ -130,17 +273,62 @@ typedef struct {
  * @param input_max User input buffer size.
  * @param graphics_start Start cell for graphical display.
  * @param graphics_end End cell for graphical display.
+ * @param eof_behavior Behavior of ',' when EOF is encountered.
+ * @param io_buffer_size Size of the input and output buffers.
+ * @param cell_width Width of a cell in bits (8, 16 or 32).
+ * @param jobs Number of worker threads for batches, or 0 for one per online CPU.
+ * @param checkpoint_interval Number of seconds between snapshots of a file's run, or 0
+ *                            for none.
+ * @param checkpoint_path Path of the snapshots of a file's run.
+ * @param resume_path Path of a snapshot to resume a file's run from, or NULL.
+ * @param input_path Path of a file to read a file's input from instead of stdin, or NULL.
  */
 typedef struct {
-    uint16_t flags;
-    size_t   tape_size;
-    size_t   input_max;
-    int      graphics_start;
-    int      graphics_end;
-    int      eof_behavior;
+    int         flags;
+    size_t      tape_size;
+    size_t      input_max;
+    int         graphics_start;
+    int         graphics_end;
+    int         eof_behavior;
+    size_t      io_buffer_size;
+    int         cell_width;
+    int         jobs;
+    unsigned    checkpoint_interval;
+    const char* checkpoint_path;
+    const char* resume_path;
+    const char* input_path;
 } bfx_parameters_t;
 
+/**
+ * @brief Structure to represent one run of a program in a batch.
+ * @param program Pointer to the program, which may be shared with other jobs.
+ * @param input Input of the run, or NULL if it has none.
+ * @param input_len Length of the input.
+ * @param output Output of the run, allocated by bfx_batch_run() and freed by the caller.
+ * @param output_len Length of the output.
+ * @param status Status of the run (BFX_STATUS_*).
+ */
+typedef struct {
+    const bfx_program_t* program;
+    const uint8_t*       input;
+    size_t               input_len;
+    uint8_t*             output;
+    size_t               output_len;
+    int                  status;
+} bfx_job_t;
+
+int  bfx_batch_run(bfx_job_t*, size_t, bfx_parameters_t);
+int  bfx_instance_create(bfx_instance_t**,
+                         const bfx_program_t*,
+                         bfx_parameters_t,
+                         const bfx_io_t*);
+void bfx_instance_destroy(bfx_instance_t*);
+void bfx_instance_reset(bfx_instance_t*);
+int  bfx_instance_run(bfx_instance_t*);
+int  bfx_program_create(bfx_program_t**, const char*, size_t, int);
+void bfx_program_destroy(bfx_program_t*);
 void bfx_reset(bfx_t*);
+void bfx_run_batch(const char*, bfx_parameters_t);
 void bfx_run_file(const char*, bfx_parameters_t);
 void bfx_run_repl(bfx_parameters_t);
 
@@ -0,0 +1,308 @@
+/**
+ * @file checkpoint.c
+ * @brief snapshots of a running program, so it can be resumed after being stopped
+ *
+ * A snapshot holds the pointers of a run, how much input it has consumed and its
+ * cells up to `tp_max`, since no others can have been written. It is written through
+ * a shared mapping of a temporary file, which is only renamed over the previous
+ * snapshot once it is complete, so a run stopped while writing one leaves the last
+ * snapshot intact.
+ *
+ * Checkpointed runs write a snapshot every few seconds from a child process, which
+ * has a copy-on-write view of the tape at the moment it was forked, so the program
+ * keeps running while the snapshot is written and synced.
+ */
+
+#include "checkpoint.h"
+#include "bfx.h"
+#include "compile.h"
+#include "interpret.h"
+#include "io.h"
+#include "program.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static uint64_t hash_program(const bfx_program_t*);
+static void     report_writer(int, const char*);
+static void     request_checkpoint(int);
+static int      skip_input(bfx_t*, uint64_t);
+static pid_t    start_writer(bfx_t*, const bfx_program_t*, const char*);
+
+volatile sig_atomic_t bfx_checkpoint_pending;
+
+/**
+ * @brief Restores a run from a snapshot written by bfx_snapshot_save().
+ *
+ * The interpreter state must be freshly initialized, with the tape size and cell width
+ * the snapshot was taken with, and the program must have the same instructions. The
+ * input the run had consumed is read again and discarded, so it must be given the
+ * same input.
+ *
+ * @param bf Pointer to the interpreter state.
+ * @param program Pointer to the program the snapshot was taken of.
+ * @param path Path of the snapshot.
+ *
+ * @return Returns BFX_STATUS_OK on success, BFX_STATUS_IO_ERROR if the snapshot cannot
+ *         be read or the input is shorter than the snapshot's, or
+ *         BFX_STATUS_INVALID_PARAMETERS if it is not a snapshot of this program with
+ *         these parameters.
+ */
+int bfx_snapshot_load(bfx_t* bf, const bfx_program_t* program, const char* path) {
+    bfx_snapshot_header_t header;
+    struct stat           st;
+    uint8_t*              map;
+    int                   fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        return BFX_STATUS_IO_ERROR;
+    }
+    if (fstat(fd, &st) || (size_t) st.st_size < sizeof(header)
+        || (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        return BFX_STATUS_IO_ERROR;
+    }
+    close(fd);
+
+    memcpy(&header, map, sizeof(header));
+    if (memcmp(header.magic, BFX_SNAPSHOT_MAGIC, sizeof(header.magic))
+        || header.program != hash_program(program) || header.tape_size != bf->tape_size
+        || header.cell_width != bf->cell_width || header.ip < 0
+        || (size_t) header.ip > program->len || header.tp < 0 || header.tp > header.tp_max
+        || (uint64_t) header.tp_max >= header.tape_size
+        || (size_t) st.st_size
+               != sizeof(header) + ((size_t) header.tp_max + 1) * BFX_CELL_SIZE(*bf)
+        || header.input_ptr > bf->input_len) {
+        munmap(map, st.st_size);
+        return BFX_STATUS_INVALID_PARAMETERS;
+    }
+
+    memcpy(bf->tape, map + sizeof(header), st.st_size - sizeof(header));
+    munmap(map, st.st_size);
+    bf->ip        = header.ip;
+    bf->tp        = header.tp;
+    bf->tp_max    = header.tp_max;
+    bf->receiving = header.receiving;
+    bf->input_ptr = header.input_ptr;
+    return skip_input(bf, header.input_read);
+}
+
+/**
+ * @brief Writes a snapshot of a run, replacing any previous snapshot at the same path.
+ *
+ * Pending output is not part of the snapshot, so it should be flushed first.
+ *
+ * @param bf Pointer to the interpreter state.
+ * @param program Pointer to the program being run.
+ * @param path Path of the snapshot. The snapshot is written to the same path
+ *             followed by ".tmp" first.
+ *
+ * @return Returns BFX_STATUS_OK on success, BFX_STATUS_IO_ERROR if the snapshot cannot
+ *         be written, or BFX_STATUS_NO_MEMORY.
+ */
+int bfx_snapshot_save(const bfx_t* bf, const bfx_program_t* program, const char* path) {
+    bfx_snapshot_header_t header;
+    uint8_t*              map;
+    char*                 temp;
+    size_t                size;
+    int                   fd;
+    int                   ret;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BFX_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.program    = hash_program(program);
+    header.tape_size  = bf->tape_size;
+    header.input_read = bf->in_read - (bf->in_len - bf->in_pos);
+    header.input_ptr  = bf->input_ptr;
+    header.ip         = bf->ip;
+    header.tp         = bf->tp;
+    header.tp_max     = bf->tp_max;
+    header.cell_width = bf->cell_width;
+    header.receiving  = bf->receiving;
+    size              = sizeof(header) + BFX_DIRTY_SIZE(*bf);
+
+    if (!(temp = malloc(strlen(path) + sizeof(".tmp")))) {
+        return BFX_STATUS_NO_MEMORY;
+    }
+    sprintf(temp, "%s.tmp", path);
+    if ((fd = open(temp, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+        free(temp);
+        return BFX_STATUS_IO_ERROR;
+    }
+
+    ret = BFX_STATUS_IO_ERROR;
+    if (!ftruncate(fd, size)
+        && (map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) != MAP_FAILED) {
+        memcpy(map, &header, sizeof(header));
+        memcpy(map + sizeof(header), bf->tape, BFX_DIRTY_SIZE(*bf));
+        if (!munmap(map, size) && !fsync(fd)) {
+            ret = BFX_STATUS_OK;
+        }
+    }
+    if (close(fd) || (!ret && rename(temp, path))) {
+        ret = BFX_STATUS_IO_ERROR;
+    }
+    if (ret) {
+        unlink(temp);
+    }
+    free(temp);
+    return ret;
+}
+
+/**
+ * @brief Runs a program to its end, writing a snapshot every `interval` seconds.
+ *
+ * The program is run by bfx_execute_checkpoint(), which stops at the next backward
+ * jump once SIGALRM has requested a snapshot. Output is flushed, so the snapshot
+ * accounts for all of it, and a child process writes the snapshot while the program
+ * continues. If the previous snapshot is still being written, the request is skipped.
+ *
+ * Output written after the last snapshot is written again when the run is resumed
+ * from it. Once the program ends, its snapshot is removed.
+ *
+ * @param bf Pointer to the interpreter state.
+ * @param program Pointer to the program to run.
+ * @param path Path of the snapshot.
+ * @param interval Number of seconds between snapshots.
+ */
+void bfx_run_checkpointed(bfx_t*               bf,
+                          const bfx_program_t* program,
+                          const char*          path,
+                          unsigned             interval) {
+    struct sigaction action;
+    struct sigaction previous;
+    struct itimerval timer;
+    pid_t            writer;
+    int              status;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_checkpoint;
+    action.sa_flags   = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGALRM, &action, &previous);
+
+    memset(&timer, 0, sizeof(timer));
+    timer.it_interval.tv_sec = interval;
+    timer.it_value.tv_sec    = interval;
+    bfx_checkpoint_pending   = 0;
+    setitimer(ITIMER_REAL, &timer, NULL);
+
+    writer = -1;
+    for (bfx_execute_checkpoint(bf, program); (size_t) bf->ip < program->len;
+         bfx_execute_checkpoint(bf, program)) {
+        bfx_checkpoint_pending = 0;
+        if (writer > 0) {
+            if (waitpid(writer, &status, WNOHANG) == 0) {
+                continue;
+            }
+            report_writer(status, path);
+        }
+        writer = start_writer(bf, program, path);
+    }
+
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_REAL, &timer, NULL);
+    sigaction(SIGALRM, &previous, NULL);
+
+    if (writer > 0 && waitpid(writer, &status, 0) == writer) {
+        report_writer(status, path);
+    }
+    unlink(path);
+}
+
+/**
+ * @brief Hashes the instructions of a program with 64-bit FNV-1a.
+ */
+static uint64_t hash_program(const bfx_program_t* program) {
+    const uint8_t* bytes;
+    uint64_t       hash;
+    size_t         i;
+    size_t         j;
+    int            words[2];
+
+    hash = BFX_FNV_OFFSET_BASIS;
+    for (i = 0; i < program->len; i++) {
+        words[0] = program->ops[i].arg;
+        words[1] = program->ops[i].offset;
+        bytes    = (const uint8_t*) words;
+        hash     = (hash ^ program->ops[i].op) * BFX_FNV_PRIME;
+        for (j = 0; j < sizeof(words); j++) {
+            hash = (hash ^ bytes[j]) * BFX_FNV_PRIME;
+        }
+    }
+    return hash;
+}
+
+/**
+ * @brief Warns if a snapshot writer failed.
+ * @param status Status of the writer, from waitpid().
+ * @param path Path of the snapshot.
+ */
+static void report_writer(int status, const char* path) {
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "libbfx: Warning: Cannot write the checkpoint %s.\n", path);
+    }
+}
+
+/**
+ * @brief Handles SIGALRM by requesting a snapshot.
+ */
+static void request_checkpoint(int sig) { bfx_checkpoint_pending = 1; }
+
+/**
+ * @brief Reads and discards the input a resumed run had already consumed.
+ *
+ * Input which is already buffered, such as a mapped input file, is skipped first. The
+ * last block read is kept in the input buffer, so the bytes after the consumed ones
+ * are the next to be read.
+ *
+ * @return Returns BFX_STATUS_OK on success, or BFX_STATUS_IO_ERROR if the input ends first.
+ */
+static int skip_input(bfx_t* bf, uint64_t n) {
+    size_t len;
+
+    len = bf->in_len - bf->in_pos < n ? bf->in_len - bf->in_pos : n;
+    bf->in_pos += len;
+    n -= len;
+    while (n > 0) {
+        if (!bf->io.read || (len = bf->io.read(bf->io.data, bf->in, bf->io_size)) == 0) {
+            return BFX_STATUS_IO_ERROR;
+        }
+        bf->in_read += len;
+        if (len > n) {
+            bf->in_len = len;
+            bf->in_pos = n;
+            break;
+        }
+        n -= len;
+    }
+    return BFX_STATUS_OK;
+}
+
+/**
+ * @brief Starts a child process which writes a snapshot of the run.
+ *
+ * If no process can be started, the snapshot is written before this returns instead.
+ *
+ * @return Returns the process ID of the writer, or -1 if there is none.
+ */
+static pid_t start_writer(bfx_t* bf, const bfx_program_t* program, const char* path) {
+    pid_t pid;
+
+    /* the child must not write the output again when it exits */
+    bfx_io_flush(bf);
+    if ((pid = fork()) == 0) {
+        _exit(bfx_snapshot_save(bf, program, path) ? BFX_SNAPSHOT_WRITE_FAILED : EXIT_SUCCESS);
+    }
+    if (pid < 0 && bfx_snapshot_save(bf, program, path)) {
+        fprintf(stderr, "libbfx: Warning: Cannot write the checkpoint %s.\n", path);
+    }
+    return pid;
+}
@@ -0,0 +1,49 @@
+#ifndef BFX_CHECKPOINT_H
+#define BFX_CHECKPOINT_H
+
+#include "bfx.h"
+#include "program.h"
+
+#include <signal.h>
+
+#define BFX_SNAPSHOT_MAGIC "BFXSNAP1"
+
+/* exit status of a checkpoint writer which could not write its snapshot */
+#define BFX_SNAPSHOT_WRITE_FAILED 70
+
+/**
+ * @brief Structure at the start of a snapshot file, which is followed by the cells
+ * from 0 to `tp_max`. Snapshots are in the byte order of the machine which wrote them.
+ * @param magic BFX_SNAPSHOT_MAGIC, without its terminator.
+ * @param program Hash of the program's instructions, which must match on resume.
+ * @param tape_size Number of cells of the tape, which must match on resume.
+ * @param input_read Number of bytes of input consumed.
+ * @param input_ptr Index of the next byte of input in the source (with `-i`).
+ * @param ip Instruction pointer.
+ * @param tp Tape pointer.
+ * @param tp_max Maximum tape pointer value.
+ * @param cell_width Width of a cell in bits, which must match on resume.
+ * @param receiving If the program had not reached the end of its input.
+ */
+typedef struct {
+    char     magic[8];
+    uint64_t program;
+    uint64_t tape_size;
+    uint64_t input_read;
+    uint64_t input_ptr;
+    int32_t  ip;
+    int32_t  tp;
+    int32_t  tp_max;
+    uint8_t  cell_width;
+    uint8_t  receiving;
+    uint8_t  reserved[2];
+} bfx_snapshot_header_t;
+
+/* set by SIGALRM while a checkpointed run is waiting for its next snapshot */
+extern volatile sig_atomic_t bfx_checkpoint_pending;
+
+int  bfx_snapshot_load(bfx_t*, const bfx_program_t*, const char*);
+int  bfx_snapshot_save(const bfx_t*, const bfx_program_t*, const char*);
+void bfx_run_checkpointed(bfx_t*, const bfx_program_t*, const char*, unsigned);
+
+#endif
@@ -1,13 +1,41 @@
 #include "compile.h"
+#include "assemble.h"
+#include "prefix.h"
+#include "program.h"
 
-#include <stdbool.h>
+#include <errno.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
-static void        init_tokens(void);
+static void        build_binary(const bfx_program_t*, bfx_parameters_t, const char*);
+static char*       cache_binary(const bfx_program_t*, bfx_parameters_t);
+static char*       cache_path(const char*);
+static const char* cell_type(int);
+static int         clear_run(const bfx_program_t*, size_t);
+static void        compile_source(char*, bfx_parameters_t, const char*);
+static int         copy_file(const char*, const char*);
+static size_t      emit_op(FILE*, const bfx_program_t*, size_t, bfx_parameters_t);
+static uint64_t    fnv1a(uint64_t, const void*, size_t);
+static void        install(const char*, const char*);
+static void        load_program(const char*, bfx_program_t*, int);
+static char*       output_name(const char*, int);
+static char*       read_source(FILE*, size_t*);
+static int         run_assembler(const char*, const char*);
+static int         run_compiler(const char*, const char*);
+static int         spawn(char* const[]);
+static size_t      split_flags(char*, char**);
+static char*       temp_path(int*);
+static int         wait_for(pid_t);
+static void        write_data(FILE*, const bfx_prefix_t*, bfx_parameters_t);
+static void        write_source(FILE*, const bfx_program_t*, bfx_parameters_t);
+static char*       write_temp_source(const bfx_program_t*, bfx_parameters_t);
 
-static const char* tokens[']' + 1];
+extern char** environ;
 
 /**
  * @brief Compile Brainfuck code from input_path to output_path.
@@ -18,81 +46,868 @@ static const char* tokens[']' + 1];
  * If input_path is NULL, the function will read from stdin. If output_path is NULL, the function
  * will write to ./a.out(.c).
  *
+ * The source is first compiled to the intermediate representation and optimized,
+ * so folded runs and loop idioms are emitted as single statements. The generated
+ * program buffers its input and output like the interpreter does, and its tape has
+ * cells of `params.cell_width` bits. The part of the program which runs before it
+ * first reads input is evaluated ahead of time (see bfx_prefix_evaluate()), so the
+ * generated program starts from the cells and output it reached, which are
+ * initialized data, instead of computing them again on every run.
+ *
+ * Executables are kept in a cache (see cache_path()), so compiling a program again
+ * with the same parameters links or copies the cached binary instead of running the
+ * C compiler.
+ *
  * @param input_path Path to the input Brainfuck source code file.
  * @param output_path Path to the output binary or C file.
  * @param params Compilation parameters
  */
 void bfx_compile(const char* input_path, const char* output_path, bfx_parameters_t params) {
-    FILE* input;
-    FILE* output;
-    bool  binary_output = !(params.flags & BFX_FLAG_ONLY_GENERATE_C_SOURCE);
-    int   c;
-    int   depth;
-    int   sys_ret;
+    FILE*         output;
+    bfx_program_t program;
+    char*         cached;
+
+    load_program(input_path, &program, params.flags);
+
+    if (params.flags & BFX_FLAG_ONLY_GENERATE_C_SOURCE) {
+        if (!output_path) {
+            output_path = (params.flags & BFX_FLAG_ASSEMBLY) ? "./a.out.s" : "./a.out.c";
+        }
+        if (!(output = fopen(output_path, "w"))) {
+            BFX_ERROR("Failed to open output file");
+        }
+        write_source(output, &program, params);
+        fclose(output);
+        bfx_program_free(&program);
+        return;
+    }
+
+    if (!output_path) {
+        output_path = "./a.out";
+    }
+
+    if ((cached = cache_binary(&program, params))) {
+        install(cached, output_path);
+        free(cached);
+    } else {
+        build_binary(&program, params, output_path);
+    }
+    bfx_program_free(&program);
+}
+
+/**
+ * @brief Compiles a Brainfuck program and runs the executable.
+ *
+ * The executable comes from the cache if it was compiled before, and the current
+ * process is replaced by it, so it reads and writes the same stdin and stdout. If
+ * there is no cache directory, the program is compiled to a temporary file which is
+ * removed after it has run.
+ *
+ * @param input_path Path to the input Brainfuck source code file, or NULL for stdin.
+ * @param params Compilation parameters
+ *
+ * @return Returns the exit status of the program.
+ */
+int bfx_compile_run(const char* input_path, bfx_parameters_t params) {
+    bfx_program_t program;
+    char*         path;
+    pid_t         pid = -1;
+    int           status;
+
+    load_program(input_path, &program, params.flags);
+
+    if ((path = cache_binary(&program, params))) {
+        bfx_program_free(&program);
+        execl(path, path, (char*) NULL);
+        BFX_ERROR("Failed to run compiled program");
+    }
+
+    path = temp_path(NULL);
+    build_binary(&program, params, path);
+    bfx_program_free(&program);
+    fflush(stdout);
+    if (chmod(path, 0755) == 0 && (pid = fork()) == 0) {
+        execl(path, path, (char*) NULL);
+        _exit(127);
+    }
+    status = pid > 0 ? wait_for(pid) : -1;
+    remove(path);
+    free(path);
+    if (status < 0) {
+        BFX_ERROR("Failed to run compiled program");
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+}
+
+/**
+ * @brief Compiles several Brainfuck source files at once.
+ *
+ * Each file is compiled by its own process, with up to `params.jobs` running at a
+ * time (one per online CPU if it is 0), so an error in one file does not stop the
+ * others. The output of `dir/name.b` is written to `dir/name`, or to `dir/name.c`
+ * when only generating C, and files without an extension get `.out` or `.c`
+ * appended.
+ *
+ * @param paths Paths of the source files.
+ * @param len Number of source files.
+ * @param params Compilation parameters
+ *
+ * @return Returns the number of files which failed to compile.
+ */
+size_t bfx_compile_many(char* const* paths, size_t len, bfx_parameters_t params) {
+    pid_t* pids;
+    char*  output_path;
+    size_t running;
+    size_t failed;
+    size_t next;
+    size_t i;
+    long   jobs;
+    pid_t  pid;
+    int    status;
+
+    jobs = params.jobs;
+    if (jobs <= 0 && (jobs = sysconf(_SC_NPROCESSORS_ONLN)) <= 0) {
+        jobs = 1;
+    }
+    if (!(pids = calloc(len > 0 ? len : 1, sizeof(pid_t)))) {
+        BFX_ERROR("Cannot allocate memory for compile jobs.");
+    }
+
+    running = 0;
+    failed  = 0;
+    next    = 0;
+    while (next < len || running > 0) {
+        if (next < len && running < (size_t) jobs) {
+            output_path = output_name(paths[next], params.flags);
+            fflush(stdout);
+            fflush(stderr);
+            if ((pid = fork()) == 0) {
+                bfx_compile(paths[next], output_path, params);
+                exit(EXIT_SUCCESS);
+            }
+            free(output_path);
+            if (pid < 0) {
+                fprintf(stderr, "libbfx: Error: Failed to start compiling %s\n", paths[next]);
+                failed++;
+            } else {
+                pids[next] = pid;
+                running++;
+            }
+            next++;
+            continue;
+        }
+
+        while ((pid = wait(&status)) < 0 && errno == EINTR) {
+        }
+        if (pid < 0) {
+            break;
+        }
+        for (i = 0; i < next && pids[i] != pid; i++) {
+        }
+        if (i == next) {
+            continue;
+        }
+        running--;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            fprintf(stderr, "libbfx: Error: Failed to compile %s\n", paths[i]);
+            failed++;
+        }
+    }
+
+    free(pids);
+    return failed;
+}
+
+/**
+ * @brief Writes the C translation of a program and compiles it to an executable.
+ *
+ * The compiler is started directly rather than through the shell.
+ *
+ * @param program Program to compile.
+ * @param params Compilation parameters
+ * @param output_path Path of the executable.
+ */
+static void build_binary(const bfx_program_t* program,
+                         bfx_parameters_t     params,
+                         const char*          output_path) {
+    compile_source(write_temp_source(program, params), params, output_path);
+}
+
+/**
+ * @brief Compiles or assembles a source written by write_temp_source() to an executable,
+ * then removes the source.
+ *
+ * @param src_path Path of the source, which is freed.
+ * @param params Compilation parameters
+ * @param output_path Path of the executable.
+ */
+static void compile_source(char* src_path, bfx_parameters_t params, const char* output_path) {
+    int ret;
+
+    ret = (params.flags & BFX_FLAG_ASSEMBLY) ? run_assembler(src_path, output_path)
+                                             : run_compiler(src_path, output_path);
+    remove(src_path);
+    free(src_path);
+    if (ret != 0) {
+        BFX_ERROR("Failed to compile program");
+    }
+}
+
+/**
+ * @brief Looks up a program in the cache, compiling it into the cache if it is missing.
+ *
+ * The program's source is generated first, since the cache is keyed by it (see
+ * cache_path()). A new binary is compiled under a temporary name and renamed into
+ * place, so other processes never see a partly written executable.
+ *
+ * @param program Program to compile.
+ * @param params Compilation parameters
+ *
+ * @return Returns the path of the cached executable, which the caller is responsible
+ * for freeing, or NULL if there is no cache directory.
+ */
+static char* cache_binary(const bfx_program_t* program, bfx_parameters_t params) {
+    char* src_path;
+    char* path;
+    char* tmp;
+    int   fd;
+
+    src_path = write_temp_source(program, params);
+    if (!(path = cache_path(src_path)) || access(path, X_OK) == 0) {
+        remove(src_path);
+        free(src_path);
+        return path;
+    }
+
+    if (!(tmp = malloc(strlen(path) + sizeof BFX_TMP_FILE_SUFFIX))) {
+        BFX_ERROR("Cannot allocate memory for cache path.");
+    }
+    sprintf(tmp, "%s" BFX_TMP_FILE_SUFFIX, path);
+    if ((fd = mkstemp(tmp)) < 0) {
+        BFX_ERROR("Failed to write to the compile cache");
+    }
+    close(fd);
+    compile_source(src_path, params, tmp);
+    if (chmod(tmp, 0755) != 0 || rename(tmp, path) != 0) {
+        remove(tmp);
+        BFX_ERROR("Failed to write to the compile cache");
+    }
+    free(tmp);
+    return path;
+}
+
+/**
+ * @brief Returns the path of a program's executable in the cache.
+ *
+ * The cache lives in $XDG_CACHE_HOME/bfx, or ~/.cache/bfx, and is created if it does
+ * not exist. Entries are named by a 64-bit FNV-1a hash of everything which goes into
+ * the executable: the generated C or assembly source, which holds the program and
+ * every parameter it was compiled with, the compiler, assembler and linker with their
+ * flags, and the version of bfx. The generated source is hashed rather than the
+ * brainfuck source, so comments and formatting do not produce new entries, while any
+ * change to the code generator does.
+ *
+ * @param src_path Path of the generated source.
+ *
+ * @return Returns the path, which the caller is responsible for freeing, or NULL if
+ * there is no cache directory or the source cannot be read.
+ */
+static char* cache_path(const char* src_path) {
+    const char* base;
+    const char* home;
+    char*       path;
+    char        buf[BUFSIZ];
+    FILE*       src;
+    uint64_t    hash;
+    size_t      n;
+
+    if ((base = getenv("XDG_CACHE_HOME")) && *base) {
+        home = "";
+    } else if ((home = getenv("HOME")) && *home) {
+        base = "/.cache";
+    } else {
+        return NULL;
+    }
+
+    if (!(path = malloc(strlen(home) + strlen(base) + sizeof BFX_CACHE_DIR_NAME + 24))) {
+        BFX_ERROR("Cannot allocate memory for cache path.");
+    }
+    sprintf(path, "%s%s", home, base);
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        free(path);
+        return NULL;
+    }
+    strcat(path, "/" BFX_CACHE_DIR_NAME);
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        free(path);
+        return NULL;
+    }
+
+    hash = BFX_FNV_OFFSET_BASIS;
+    hash = fnv1a(hash, BFX_VERSION, sizeof BFX_VERSION);
+    hash = fnv1a(hash, BFX_DEFAULT_COMPILER, sizeof BFX_DEFAULT_COMPILER);
+    hash = fnv1a(hash, BFX_DEFAULT_COMPILE_FLAGS, sizeof BFX_DEFAULT_COMPILE_FLAGS);
+    hash = fnv1a(hash, BFX_DEFAULT_ASSEMBLER, sizeof BFX_DEFAULT_ASSEMBLER);
+    hash = fnv1a(hash, BFX_DEFAULT_LINKER, sizeof BFX_DEFAULT_LINKER);
+    hash = fnv1a(hash, BFX_DEFAULT_LINK_FLAGS, sizeof BFX_DEFAULT_LINK_FLAGS);
+    if (!(src = fopen(src_path, "rb"))) {
+        free(path);
+        return NULL;
+    }
+    while ((n = fread(buf, 1, sizeof buf, src)) > 0) {
+        hash = fnv1a(hash, buf, n);
+    }
+    if (ferror(src)) {
+        fclose(src);
+        free(path);
+        return NULL;
+    }
+    fclose(src);
+
+    sprintf(path + strlen(path),
+            "/%08lx%08lx",
+            (unsigned long) (hash >> 32),
+            (unsigned long) (hash & 0xffffffffUL));
+    return path;
+}
+
+/**
+ * @brief Copies a file, making the copy executable.
+ * @param from Path of the file to copy.
+ * @param to Path of the copy.
+ * @return Returns 0 on success, or -1 on failure.
+ */
+static int copy_file(const char* from, const char* to) {
+    char   buf[BUFSIZ];
+    FILE*  in;
+    FILE*  out;
+    size_t n;
+    int    ret = 0;
+
+    if (!(in = fopen(from, "rb"))) {
+        return -1;
+    }
+    if (!(out = fopen(to, "wb"))) {
+        fclose(in);
+        return -1;
+    }
+    while ((n = fread(buf, 1, sizeof buf, in)) > 0) {
+        if (fwrite(buf, 1, n, out) != n) {
+            ret = -1;
+            break;
+        }
+    }
+    if (ferror(in) || fclose(out) != 0) {
+        ret = -1;
+    }
+    fclose(in);
+    return ret == 0 ? chmod(to, 0755) : ret;
+}
+
+/**
+ * @brief Updates a 64-bit FNV-1a hash with a block of bytes.
+ */
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t len) {
+    const unsigned char* p = data;
+    size_t               i;
+
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ p[i]) * BFX_FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+ * @brief Places a cached executable at output_path.
+ *
+ * The executable is hard linked if possible, and copied otherwise, e.g. when the
+ * cache is on another file system.
+ *
+ * @param cached Path of the cached executable.
+ * @param output_path Path to write the executable to.
+ */
+static void install(const char* cached, const char* output_path) {
+    remove(output_path);
+    if (link(cached, output_path) != 0 && copy_file(cached, output_path) != 0) {
+        BFX_ERROR("Failed to write output file");
+    }
+}
+
+/**
+ * @brief Reads a Brainfuck source file and compiles it to optimized intermediate representation.
+ * @param input_path Path to the source file, or NULL to read from stdin.
+ * @param program Program to build.
+ * @param flags Flags to compile with (BFX_FLAG_*).
+ */
+static void load_program(const char* input_path, bfx_program_t* program, int flags) {
+    bfx_file_index_t error;
+    FILE*            input;
+    char*            src;
+    size_t           src_len;
+    int              ret;
+
+#ifndef BFX_ASSEMBLE_SUPPORTED
+    if (flags & BFX_FLAG_ASSEMBLY) {
+        BFX_ERROR("Assembly output is not supported on this platform");
+    }
+#endif
 
-    /**** Set up files ****/
     if (!input_path) {
         input = stdin;
     } else if (!(input = fopen(input_path, "r"))) {
         BFX_ERROR("Failed to open input file");
     }
 
-    if (!output_path) {
-        output_path = binary_output ? "./a.out" : "./a.out.c";
+    src = read_source(input, &src_len);
+    if (input != stdin) {
+        fclose(input);
+    }
+
+    if ((ret = bfx_program_build(program, src, src_len, flags, &error))) {
+        if (ret == BFX_STATUS_SYNTAX_ERROR) {
+            fprintf(stderr,
+                    "libbfx: Error (%d,%d): Unmatched %s.\n",
+                    error.line,
+                    error.line_idx,
+                    src[error.idx] == '[' ? "opening bracket '['" : "closing bracket ']'");
+        }
+        free(src);
+        BFX_ERROR(ret == BFX_STATUS_NO_MEMORY ? "Cannot allocate memory for program storage."
+                                              : "Unbalanced brackets");
+    }
+    free(src);
+    if (bfx_program_optimize(program)) {
+        BFX_ERROR("Cannot allocate memory for loop storage.");
+    }
+}
+
+/**
+ * @brief Returns the path bfx_compile_many() writes a source file's output to.
+ * @param path Path of the source file.
+ * @param flags Compilation flags (BFX_FLAG_*).
+ * @return Returns the path. The caller is responsible for freeing it.
+ */
+static char* output_name(const char* path, int flags) {
+    const char* suffix = !(flags & BFX_FLAG_ONLY_GENERATE_C_SOURCE) ? ""
+                         : (flags & BFX_FLAG_ASSEMBLY)             ? ".s"
+                                                                   : ".c";
+    char*       name;
+    char*       base;
+    char*       ext;
+
+    if (!(name = malloc(strlen(path) + 5))) {
+        BFX_ERROR("Cannot allocate memory for output path.");
+    }
+    strcpy(name, path);
+    base = (base = strrchr(name, '/')) ? base + 1 : name;
+    if ((ext = strrchr(base, '.')) && ext != base) {
+        *ext = '\0';
+    } else if (!*suffix) {
+        suffix = ".out";
+    }
+    strcat(name, suffix);
+    return name;
+}
+
+/**
+ * @brief Assembles and links a source file written by bfx_assemble().
+ * @param src_path Path of the assembly source file.
+ * @param output_path Path of the executable.
+ * @return Returns 0 if the assembler and linker succeeded, or -1 otherwise.
+ */
+static int run_assembler(const char* src_path, const char* output_path) {
+    char   flags[] = BFX_DEFAULT_LINK_FLAGS;
+    char*  argv[sizeof flags / 2 + 8];
+    char*  obj_path;
+    size_t argc;
+    int    ret;
+
+    obj_path = temp_path(NULL);
+    argv[0]  = BFX_DEFAULT_ASSEMBLER;
+    argv[1]  = "-o";
+    argv[2]  = obj_path;
+    argv[3]  = (char*) src_path;
+    argv[4]  = NULL;
+    if ((ret = spawn(argv)) == 0) {
+        argc         = 0;
+        argv[argc++] = BFX_DEFAULT_LINKER;
+        argc += split_flags(flags, argv + argc);
+        argv[argc++] = "-o";
+        argv[argc++] = (char*) output_path;
+        argv[argc++] = obj_path;
+        argv[argc]   = NULL;
+        ret          = spawn(argv);
     }
+    remove(obj_path);
+    free(obj_path);
+    return ret;
+}
+
+/**
+ * @brief Runs the C compiler on a source file.
+ *
+ * The source is marked as C with `-x c`, since temporary files have no extension.
+ *
+ * @param src_path Path of the C source file.
+ * @param output_path Path of the executable.
+ *
+ * @return Returns 0 if the compiler succeeded, or -1 otherwise.
+ */
+static int run_compiler(const char* src_path, const char* output_path) {
+    char   flags[] = BFX_DEFAULT_COMPILE_FLAGS;
+    char*  argv[sizeof flags / 2 + 8];
+    size_t argc;
+
+    argc         = 0;
+    argv[argc++] = BFX_DEFAULT_COMPILER;
+    argc += split_flags(flags, argv + argc);
+    argv[argc++] = "-o";
+    argv[argc++] = (char*) output_path;
+    argv[argc++] = "-x";
+    argv[argc++] = "c";
+    argv[argc++] = (char*) src_path;
+    argv[argc]   = NULL;
+    return spawn(argv);
+}
+
+/**
+ * @brief Runs a program and waits for it to exit.
+ * @param argv Arguments, starting with the program to run, which is looked up in $PATH.
+ * @return Returns 0 if the program exited successfully, or -1 otherwise.
+ */
+static int spawn(char* const argv[]) {
+    pid_t pid;
+    int   status;
 
-    if (binary_output && !(output = fopen(BFX_TMP_FILE_PATH, "w"))) {
+    fflush(stdout);
+    if (posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ) != 0) {
+        return -1;
+    }
+    status = wait_for(pid);
+    return status >= 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Splits a string of flags on spaces into separate arguments.
+ * @param flags Flags to split, which are modified.
+ * @param argv Set to the arguments.
+ * @return Returns the number of arguments.
+ */
+static size_t split_flags(char* flags, char** argv) {
+    char*  flag;
+    size_t argc;
+
+    argc = 0;
+    for (flag = strtok(flags, " "); flag; flag = strtok(NULL, " ")) {
+        argv[argc++] = flag;
+    }
+    return argc;
+}
+
+/**
+ * @brief Creates a uniquely named temporary file.
+ *
+ * The file is created in $TMPDIR, or BFX_TMP_DIR if it is not set.
+ *
+ * @param fd Set to a descriptor open for writing to the file, or NULL to close it.
+ *
+ * @return Returns the path of the file. The caller is responsible for freeing it.
+ */
+static char* temp_path(int* fd) {
+    const char* dir;
+    char*       path;
+    int         ret;
+
+    if (!(dir = getenv("TMPDIR")) || !*dir) {
+        dir = BFX_TMP_DIR;
+    }
+    if (!(path = malloc(strlen(dir) + sizeof("/" BFX_TMP_FILE_PREFIX BFX_TMP_FILE_SUFFIX)))) {
+        BFX_ERROR("Cannot allocate memory for temporary file path.");
+    }
+    sprintf(path, "%s/" BFX_TMP_FILE_PREFIX BFX_TMP_FILE_SUFFIX, dir);
+    if ((ret = mkstemp(path)) < 0) {
         BFX_ERROR("Failed to create temporary file");
-    } else if (!(output = fopen(output_path, "w"))) {
-        BFX_ERROR("Failed to open output file");
     }
 
-    /*** Actual compilation ***/
-    init_tokens();
-    depth = 0;
-    fprintf(output, BFX_COMPILE_HEAD, params.tape_size);
-    while ((c = fgetc(input)) != EOF) {
-        if (tokens[c]) {
-            fprintf(output, "%s", tokens[c]);
+    if (fd) {
+        *fd = ret;
+    } else {
+        close(ret);
+    }
+    return path;
+}
+
+/**
+ * @brief Waits for a child process to exit.
+ * @param pid Process ID of the child.
+ * @return Returns the child's wait status, or -1 if it cannot be waited for.
+ */
+static int wait_for(pid_t pid) {
+    int status;
+
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return -1;
         }
     }
+    return status;
+}
 
-    if (depth != 0) {
-        fclose(output);
-        remove(output_path);
-        BFX_ERROR("Unbalanced brackets");
+/**
+ * @brief Returns the C type of a cell of the given width in bits.
+ */
+static const char* cell_type(int width) {
+    switch (width) {
+    case 16:
+        return "uint16_t";
+    case 32:
+        return "uint32_t";
+    default:
+        return "uint8_t";
     }
+}
 
-    fprintf(output, "return 0;}");
-    fclose(output);
+/**
+ * @brief Returns the number of cells cleared by a run of instructions.
+ *
+ * `[-]>[-]>[-]` becomes a SET of 0 for each cell at consecutive offsets, which is
+ * written as a single memset() once the run is at least BFX_COMPILE_MEMSET_MIN cells
+ * long. The run may also go left.
+ *
+ * @param program Program to translate.
+ * @param i Index of the first instruction.
+ *
+ * @return Returns the number of SETs from `i` which clear consecutive cells, with the
+ * sign of the direction they go in.
+ */
+static int clear_run(const bfx_program_t* program, size_t i) {
+    const bfx_op_t* ops = program->ops;
+    int             dir;
+    int             n;
 
-    if (binary_output) {
-        char* cmd = malloc(128);
-        sprintf(cmd,
-                "%s %s -o %s %s",
-                BFX_DEFAULT_COMPILER,
-                BFX_DEFAULT_COMPILE_FLAGS,
-                output_path,
-                BFX_TMP_FILE_PATH);
-        sys_ret = system(cmd);
-        remove(BFX_TMP_FILE_PATH);
-        if (sys_ret != 0) {
-            BFX_ERROR("Failed to compile program");
+    if (i + 1 >= program->len || ops[i].arg != 0 || ops[i + 1].op != BFX_OP_SET
+        || (ops[i + 1].offset - ops[i].offset != 1 && ops[i + 1].offset - ops[i].offset != -1)) {
+        return 0;
+    }
+
+    dir = ops[i + 1].offset - ops[i].offset;
+    for (n = 1; i + n < program->len; n++) {
+        if (ops[i + n].op != BFX_OP_SET || ops[i + n].arg != 0
+            || ops[i + n].offset != ops[i].offset + n * dir) {
+            break;
+        }
+    }
+    return n * dir;
+}
+
+/**
+ * @brief Writes the C statements for the instruction at an index.
+ *
+ * Cells are addressed through the pointer `p`, at their offsets from it. CHECKs write
+ * nothing, since compiled programs do not check the tape bounds. A scan for a zero
+ * cell moving right one cell at a time on a tape of bytes is written as memchr(), and
+ * runs of cleared cells as memset() (see clear_run()), as are the copies written by an OUT
+ * folded from a run of '.'.
+ *
+ * @param output File to write to.
+ * @param program Program to translate.
+ * @param i Index of the instruction.
+ * @param params Compilation parameters
+ *
+ * @return Returns the number of instructions written.
+ */
+static size_t emit_op(FILE*                output,
+                      const bfx_program_t* program,
+                      size_t               i,
+                      bfx_parameters_t     params) {
+    const bfx_op_t* op = &program->ops[i];
+    int             n;
+
+    switch (op->op) {
+    case BFX_OP_ADD:
+        fprintf(output, "p[%d]+=%d;", op->offset, op->arg);
+        break;
+    case BFX_OP_MOVE:
+        fprintf(output, "p+=%d;", op->arg);
+        break;
+    case BFX_OP_JZ:
+        fprintf(output, "while(*p){");
+        break;
+    case BFX_OP_JNZ:
+        fprintf(output, "}");
+        break;
+    case BFX_OP_IN:
+        switch (params.eof_behavior) {
+        case BFX_EOF_BEHAVIOR_ZERO:
+            fprintf(output, "{int c=g();p[%d]=c==EOF?0:c;}", op->offset);
+            break;
+        case BFX_EOF_BEHAVIOR_DECREMENT:
+            fprintf(output, "{int c=g();p[%d]=c==EOF?p[%d]-1:c;}", op->offset, op->offset);
+            break;
+        default:
+            fprintf(output, "{int c=g();if(c!=EOF)p[%d]=c;}", op->offset);
+            break;
+        }
+        break;
+    case BFX_OP_OUT:
+        if (op->arg > 1) {
+            fprintf(output, BFX_COMPILE_REPEAT, op->arg, op->offset);
+        } else {
+            fprintf(output, "o[n++]=p[%d];if(n==sizeof o)f();", op->offset);
+        }
+        break;
+    case BFX_OP_SET:
+        n = clear_run(program, i);
+        if (n >= BFX_COMPILE_MEMSET_MIN) {
+            fprintf(output, "memset(p%+d,0,%d*sizeof*p);", op->offset, n);
+            return n;
+        } else if (-n >= BFX_COMPILE_MEMSET_MIN) {
+            fprintf(output, "memset(p%+d,0,%d*sizeof*p);", op->offset + n + 1, -n);
+            return -n;
+        }
+        fprintf(output, "p[%d]=%d;", op->offset, op->arg);
+        break;
+    case BFX_OP_SCAN:
+        if (op->arg == 1 && params.cell_width == 8) {
+            fprintf(output, "p=memchr(p,0,t+%ld-p);", params.tape_size);
+        } else {
+            fprintf(output, "while(*p)p+=%d;", op->arg);
+        }
+        break;
+    case BFX_OP_MULADD:
+        fprintf(output, "p[%d]+=(unsigned)*p*%d;", op->offset, op->arg);
+        break;
+    }
+    return 1;
+}
+
+/**
+ * @brief Reads a whole stream into memory.
+ * @param input Stream to read.
+ * @param len Set to the number of bytes read.
+ * @return Returns a buffer holding the stream's contents. The caller is responsible for freeing it.
+ */
+static char* read_source(FILE* input, size_t* len) {
+    char*  buf;
+    size_t size;
+
+    size = BFX_DEFAULT_INPUT_MAX;
+    *len = 0;
+    if (!(buf = malloc(size))) {
+        BFX_ERROR("Cannot allocate memory for program storage.");
+    }
+
+    while ((*len += fread(buf + *len, 1, size - *len, input)) == size) {
+        size *= 2;
+        if (!(buf = realloc(buf, size))) {
+            BFX_ERROR("Cannot reallocate memory for program storage.");
+        }
+    }
+
+    return buf;
+}
+
+/**
+ * @brief Writes the cells and output of a program's prefix as the arrays `d` and `s`.
+ *
+ * Arrays which would be empty are left out, since C has no empty arrays.
+ *
+ * @param output File to write to.
+ * @param prefix Prefix to write.
+ * @param params Compilation parameters
+ */
+static void write_data(FILE* output, const bfx_prefix_t* prefix, bfx_parameters_t params) {
+    size_t i;
+
+    if (prefix->cells > 0) {
+        fprintf(output, "static const %s d[]={", cell_type(params.cell_width));
+        for (i = 0; i < prefix->cells; i++) {
+            fprintf(output,
+                    i % BFX_COMPILE_DATA_LINE ? "%lu," : "\n%lu,",
+                    (unsigned long) prefix->tape[i]);
+        }
+        fprintf(output, "};\n");
+    }
+    if (prefix->output_len > 0) {
+        fprintf(output, "static const unsigned char s[]={");
+        for (i = 0; i < prefix->output_len; i++) {
+            fprintf(output, i % BFX_COMPILE_DATA_LINE ? "%u," : "\n%u,", prefix->output[i]);
         }
+        fprintf(output, "};\n");
     }
 }
 
 /**
- * @brief Initializes compiler tokens
+ * @brief Writes the C translation of a program.
+ *
+ * The translation starts where the program's prefix ends (see write_data()).
+ *
+ * @param output File to write to.
+ * @param program Program to translate.
+ * @param params Compilation parameters
  */
-static void init_tokens(void) {
-    memset(tokens, 0, (']' + 1) * sizeof(char*));
-    tokens['>'] = "p++;";
-    tokens['<'] = "p--;";
-    tokens['+'] = "t[p]++;";
-    tokens['-'] = "t[p]--;";
-    tokens['.'] = "putchar(t[p]);";
-    tokens[','] = "t[p]=getchar();";
-    tokens['['] = "while(t[p]){";
-    tokens[']'] = "}";
+static void write_source(FILE* output, const bfx_program_t* program, bfx_parameters_t params) {
+    bfx_prefix_t prefix;
+    size_t       io_size;
+    size_t       i;
+
+    if (bfx_prefix_evaluate(&prefix, program, params) == BFX_STATUS_NO_MEMORY) {
+        BFX_ERROR("Cannot allocate memory for partial evaluation.");
+    }
+
+    if (params.flags & BFX_FLAG_ASSEMBLY) {
+        bfx_assemble(output, program, &prefix, params);
+        bfx_prefix_free(&prefix);
+        return;
+    }
+
+    io_size = params.io_buffer_size > 0 ? params.io_buffer_size : 1;
+    fprintf(output,
+            BFX_COMPILE_HEAD,
+            (unsigned long) io_size,
+            (unsigned long) io_size,
+            cell_type(params.cell_width),
+            params.tape_size);
+    write_data(output, &prefix, params);
+    fprintf(output, BFX_COMPILE_MAIN, cell_type(params.cell_width), prefix.tp);
+    if (prefix.cells > 0) {
+        fprintf(output, BFX_COMPILE_CELLS);
+    }
+    if (prefix.output_len > 0) {
+        fprintf(output, BFX_COMPILE_OUTPUT);
+    }
+    i = prefix.ip;
+    while (i < program->len) {
+        i += emit_op(output, program, i, params);
+    }
+    fprintf(output, BFX_COMPILE_TAIL);
+    bfx_prefix_free(&prefix);
+}
+
+/**
+ * @brief Writes the C or assembly translation of a program to a temporary file.
+ *
+ * The file is uniquely named, so any number of compiles can run at once.
+ *
+ * @param program Program to translate.
+ * @param params Compilation parameters
+ *
+ * @return Returns the path of the file. The caller is responsible for freeing it.
+ */
+static char* write_temp_source(const bfx_program_t* program, bfx_parameters_t params) {
+    FILE* output;
+    char* src_path;
+    int   fd;
+
+    src_path = temp_path(&fd);
+    if (!(output = fdopen(fd, "w"))) {
+        remove(src_path);
+        BFX_ERROR("Failed to create temporary file");
+    }
+    write_source(output, program, params);
+    if (fclose(output) != 0) {
+        remove(src_path);
+        BFX_ERROR("Failed to write temporary file");
+    }
+    return src_path;
 }
@@ -3,14 +3,73 @@
 
 #include "bfx.h"
 
+/* o/n buffer output and f() writes it; i/a/z buffer input and g() reads a byte or EOF */
 #ifndef BFX_COMPILE_HEAD
-#define BFX_COMPILE_HEAD "#include <stdio.h>\nint main(void) {unsigned char t[%ld];int p=0;"
+#define BFX_COMPILE_HEAD                                                                           \
+    "#include <stdint.h>\n#include <stdio.h>\n#include <string.h>\n#include <unistd.h>\n"          \
+    "static unsigned char o[%lu],i[%lu];static size_t n,a,z;"                                      \
+    "static void f(void){size_t w=0;ssize_t r;while(w<n&&(r=write(1,o+w,n-w))>0)w+=r;n=0;}"        \
+    "static int g(void){ssize_t r;if(a==z){f();if((r=read(0,i,sizeof i))<=0)return EOF;a=0;z=r;}"  \
+    "return i[a++];}static %s t[%ld];"
 #endif
 
-#ifndef BFX_TMP_FILE_PATH
-#define BFX_TMP_FILE_PATH "/tmp/bfx.c"
+/* p starts where the evaluated prefix left the tape pointer (see bfx_prefix_evaluate()) */
+#ifndef BFX_COMPILE_MAIN
+#define BFX_COMPILE_MAIN "int main(void) {%s*p=t+%d;"
 #endif
 
-void bfx_compile(const char*, const char*, bfx_parameters_t);
+/* the prefix's cells are copied from d, and its output is written from s */
+#ifndef BFX_COMPILE_CELLS
+#define BFX_COMPILE_CELLS "memcpy(t,d,sizeof d);"
+#endif
+
+#ifndef BFX_COMPILE_OUTPUT
+#define BFX_COMPILE_OUTPUT "{size_t k;for(k=0;k<sizeof s;k++){o[n++]=s[k];if(n==sizeof o)f();}}"
+#endif
+
+/* an OUT folded from a run of '.' fills the output buffer with its cell in blocks */
+#ifndef BFX_COMPILE_REPEAT
+#define BFX_COMPILE_REPEAT                                                                         \
+    "{size_t k=%d,r;while(k){r=sizeof o-n<k?sizeof o-n:k;memset(o+n,p[%d],r);n+=r;k-=r;"           \
+    "if(n==sizeof o)f();}}"
+#endif
+
+/* values of d and s written on each line of the generated source */
+#ifndef BFX_COMPILE_DATA_LINE
+#define BFX_COMPILE_DATA_LINE 32
+#endif
+
+/* shortest run of cleared cells written as a memset() instead of separate stores */
+#ifndef BFX_COMPILE_MEMSET_MIN
+#define BFX_COMPILE_MEMSET_MIN 4
+#endif
+
+#ifndef BFX_COMPILE_TAIL
+#define BFX_COMPILE_TAIL "f();return 0;}"
+#endif
+
+/* temporary files are named $TMPDIR/<prefix><suffix>, with the X's replaced by mkstemp() */
+#ifndef BFX_TMP_DIR
+#define BFX_TMP_DIR "/tmp"
+#endif
+
+#ifndef BFX_TMP_FILE_PREFIX
+#define BFX_TMP_FILE_PREFIX "bfx"
+#endif
+
+#define BFX_TMP_FILE_SUFFIX ".XXXXXX"
+
+/* compiled executables are cached in this directory under $XDG_CACHE_HOME or ~/.cache */
+#ifndef BFX_CACHE_DIR_NAME
+#define BFX_CACHE_DIR_NAME "bfx"
+#endif
+
+/* 64-bit FNV-1a parameters, built from halves since C89 has no 64-bit constants */
+#define BFX_FNV_OFFSET_BASIS ((uint64_t) 0xcbf29ce4UL << 32 | 0x84222325UL)
+#define BFX_FNV_PRIME        ((uint64_t) 0x100UL << 32 | 0x1b3UL)
+
+void   bfx_compile(const char*, const char*, bfx_parameters_t);
+size_t bfx_compile_many(char* const*, size_t, bfx_parameters_t);
+int    bfx_compile_run(const char*, bfx_parameters_t);
 
 #endif
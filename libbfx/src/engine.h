@@ -0,0 +1,223 @@
+/*
+ * Cell width specific engines.
+ *
+ * This file has no include guard: interpret.c includes it once per cell width, with
+ * BFX_CELL defined as the cell type, BFX_CELL_BITS as its width and BFX_CELL_NAME(name)
+ * expanding to the name of each function for that width. The width is chosen once per
+ * run, so none of the engines check it while running.
+ */
+
+static void   BFX_CELL_NAME(checkpoint)(bfx_t*, const bfx_program_t*, uint64_t*);
+static void   BFX_CELL_NAME(execute)(bfx_t*, const bfx_program_t*, uint64_t*);
+static void   BFX_CELL_NAME(interpret)(bfx_t*);
+static void   BFX_CELL_NAME(profile)(bfx_t*, const bfx_program_t*, uint64_t*);
+static int    BFX_CELL_NAME(scan)(const BFX_CELL*, int, int, size_t);
+static void   BFX_CELL_NAME(stats)(bfx_t*, const bfx_program_t*, uint64_t*);
+static size_t BFX_CELL_NAME(unfold)(bfx_t*, const bfx_program_t*, size_t);
+#if BFX_CELL_BITS == 8
+static void   BFX_CELL_NAME(tiered)(bfx_t*, const bfx_program_t*, bfx_tier_t*);
+static void   BFX_CELL_NAME(tiered_stats)(bfx_t*, const bfx_program_t*, bfx_tier_t*);
+#endif
+
+#define BFX_EXECUTE_NAME BFX_CELL_NAME(execute)
+#include "execute.h"
+#undef BFX_EXECUTE_NAME
+
+#define BFX_PROFILE
+#define BFX_EXECUTE_NAME BFX_CELL_NAME(profile)
+#include "execute.h"
+#undef BFX_EXECUTE_NAME
+#undef BFX_PROFILE
+
+#define BFX_CHECKPOINT
+#define BFX_EXECUTE_NAME BFX_CELL_NAME(checkpoint)
+#include "execute.h"
+#undef BFX_EXECUTE_NAME
+#undef BFX_CHECKPOINT
+
+#define BFX_STATS
+#define BFX_EXECUTE_NAME BFX_CELL_NAME(stats)
+#include "execute.h"
+#undef BFX_EXECUTE_NAME
+#undef BFX_STATS
+
+#if BFX_CELL_BITS == 8
+#define BFX_TIERED
+#define BFX_EXECUTE_NAME BFX_CELL_NAME(tiered)
+#include "execute.h"
+#undef BFX_EXECUTE_NAME
+
+#define BFX_STATS
+#define BFX_EXECUTE_NAME BFX_CELL_NAME(tiered_stats)
+#include "execute.h"
+#undef BFX_EXECUTE_NAME
+#undef BFX_STATS
+#undef BFX_TIERED
+#endif
+
+/**
+ * @brief Interprets the program source from `bf->ip` to its end (see bfx_interpret()).
+ */
+static void BFX_CELL_NAME(interpret)(bfx_t* bf) {
+    bfx_file_index_t index;
+    BFX_CELL*        tape;
+
+    tape = (BFX_CELL*) bf->tape;
+
+    for (; (size_t) bf->ip < bf->prog_len; bf->ip++) {
+        switch (bf->prog[bf->ip]) {
+        case '+':
+            tape[bf->tp]++;
+            break;
+        case '-':
+            tape[bf->tp]--;
+            break;
+        case '>':
+            bf->tp++;
+            if ((size_t) bf->tp >= bf->tape_size) {
+                index = bfx_locate(bf, bf->ip);
+                fprintf(stderr,
+                        "Warning (%d,%d): Tape pointer overflow. Tape pointer set to zero.\n",
+                        index.line,
+                        index.line_idx);
+                bf->tp = 0;
+            } else if (bf->tp > bf->tp_max) {
+                bf->tp_max = bf->tp;
+            }
+            break;
+        case '<':
+            bf->tp--;
+            if (bf->tp < 0) {
+                index = bfx_locate(bf, bf->ip);
+                fprintf(stderr,
+                        "Warning (%d,%d): Tape pointer underflow. Tape pointer set to zero.\n",
+                        index.line,
+                        index.line_idx);
+                bf->tp = 0;
+            }
+            break;
+        case ',':
+            tape[bf->tp] = bfx_getchar(bf, tape[bf->tp]);
+            break;
+        case '.':
+            bfx_putchar(bf, tape[bf->tp]);
+            break;
+        case '[':
+            if (!tape[bf->tp]) {
+                bf->ip = bf->jumps[bf->ip];
+            }
+            break;
+        case ']':
+            if (tape[bf->tp]) {
+                bf->ip = bf->jumps[bf->ip];
+            }
+            break;
+        case '#':
+            if (BFX_IN_DEBUG_MODE(*bf) && BFX_SPECIAL_INSTRUCTIONS_ENABLED(*bf)) {
+                index = bfx_locate(bf, bf->ip);
+                bfx_diagnose(bf, &index);
+            }
+            break;
+        case '@':
+            if (BFX_IN_REPL_MODE(*bf) && BFX_SPECIAL_INSTRUCTIONS_ENABLED(*bf)) {
+                /* the program is gone, so stop before ip moves past the start */
+                bfx_reset(bf);
+                return;
+            }
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Finds the nearest zero cell in steps of `stride` (see bfx_scan()).
+ */
+static int BFX_CELL_NAME(scan)(const BFX_CELL* tape, int tp, int stride, size_t tape_size) {
+#if BFX_CELL_BITS == 8
+    return bfx_scan(tape, tp, stride, tape_size);
+#else
+    for (; tp >= 0 && (size_t) tp < tape_size; tp += stride) {
+        if (!tape[tp]) {
+            return tp;
+        }
+    }
+    return -1;
+#endif
+}
+
+/**
+ * @brief Runs the instructions guarded by a failed CHECK (see bfx_unfold()).
+ */
+static size_t BFX_CELL_NAME(unfold)(bfx_t* bf, const bfx_program_t* program, size_t ip) {
+    const bfx_op_t* ops;
+    BFX_CELL*       tape;
+    size_t          end;
+    int             tp;
+    int             at;
+    int             to;
+    bool            counted;
+
+    ops     = program->ops;
+    tape    = (BFX_CELL*) bf->tape;
+    tp      = bf->tp;
+    end     = bfx_program_check_end(program, ip);
+    counted = bf->flags & BFX_FLAG_STATS;
+
+    /* `at` is the offset the tape pointer has been moved to; jumps use offset 0 */
+    for (at = 0, ip++; ip <= end; ip++) {
+        to = ops[ip].op == BFX_OP_MOVE ? ops[ip].arg : ops[ip].offset;
+        if (to != at) {
+            tp += to - at;
+            at = to;
+            if (tp < 0 || (size_t) tp >= bf->tape_size) {
+                tp = bfx_move_warning(bf, program, ip, tp);
+            } else if (tp > bf->tp_max) {
+                bf->tp_max = tp;
+            }
+        }
+
+        if (counted) {
+            bf->counts.ops++;
+            bf->counts.jz += ops[ip].op == BFX_OP_JZ;
+            bf->counts.jnz += ops[ip].op == BFX_OP_JNZ;
+        }
+
+        switch (ops[ip].op) {
+        case BFX_OP_ADD:
+            tape[tp] += ops[ip].arg;
+            break;
+        case BFX_OP_JZ:
+            if (!tape[tp]) {
+                ip = ops[ip].arg;
+            }
+            break;
+        case BFX_OP_JNZ:
+            if (tape[tp]) {
+                ip = ops[ip].arg;
+            }
+            break;
+        case BFX_OP_IN:
+            tape[tp] = bfx_getchar(bf, tape[tp]);
+            break;
+        case BFX_OP_OUT:
+            bfx_putchars(bf, tape[tp], ops[ip].arg);
+            break;
+        case BFX_OP_SET:
+            tape[tp] = ops[ip].arg;
+            break;
+        }
+    }
+
+    /* a run without a MOVE at its end returns to where it started */
+    if (at != 0 && ops[end].op != BFX_OP_MOVE) {
+        tp -= at;
+        if (tp < 0 || (size_t) tp >= bf->tape_size) {
+            tp = bfx_move_warning(bf, program, end, tp);
+        } else if (tp > bf->tp_max) {
+            bf->tp_max = tp;
+        }
+    }
+
+    bf->tp = tp;
+    return end;
+}
@@ -0,0 +1,230 @@
+/*
+ * The intermediate representation engine for one cell width.
+ *
+ * This file has no include guard: engine.h includes it three times per cell width, with
+ * BFX_EXECUTE_NAME defined as the name of the function. The second copy has BFX_PROFILE
+ * defined and counts how many times each instruction runs in `counts`, which the first
+ * ignores, so runs which are not being profiled pay nothing for it. The third has
+ * BFX_CHECKPOINT defined and stops at a backward jump once a snapshot is requested.
+ *
+ * For 8-bit cells, which the JIT supports, a fourth copy has BFX_TIERED defined and
+ * takes a bfx_tier_t instead of counts. It counts the backward jumps of each loop, and
+ * once a loop has taken BFX_TIER_THRESHOLD of them it is compiled with bfx_jit_compile()
+ * and the rest of its run moves to the native code, starting at the loop's head. Later
+ * entries into the loop run the native code straight away.
+ *
+ * The plain and tiered copies each have a twin with BFX_STATS defined, used when
+ * `BFX_FLAG_STATS` is set, which adds the instructions and jumps it runs to `bf->counts`
+ * for bfx_stats(). A superinstruction counts as the two instructions it runs.
+ *
+ * Every copy but the profiler's dispatches on the program's opcode stream, so a
+ * superinstruction runs a pair of instructions and then moves past both.
+ */
+
+#ifdef BFX_STATS
+#define BFX_COUNT(n) bf->counts.n++
+/* compiled loops start by testing their opening jump, which the interpreter has just
+   counted or skips, so that test is taken back off the counts */
+#define BFX_UNCOUNT_ENTRY() (bf->counts.ops--, bf->counts.jz--)
+#else
+#define BFX_COUNT(n)
+#define BFX_UNCOUNT_ENTRY()
+#endif
+
+/**
+ * @brief Executes a program compiled to the intermediate representation (see bfx_execute(),
+ * bfx_execute_profile(), bfx_execute_checkpoint() and bfx_execute_tiered()).
+ */
+#ifdef BFX_TIERED
+static void BFX_EXECUTE_NAME(bfx_t* bf, const bfx_program_t* program, bfx_tier_t* tier) {
+#else
+static void BFX_EXECUTE_NAME(bfx_t* bf, const bfx_program_t* program, uint64_t* counts) {
+#endif
+    const bfx_op_t* ops;
+    BFX_CELL*       tape;
+    size_t          ip;
+    int             tp;
+    int             cell;
+#ifndef BFX_PROFILE
+    const uint8_t* opcodes;
+#endif
+
+    ops  = program->ops;
+    tape = (BFX_CELL*) bf->tape;
+    tp   = bf->tp;
+#ifndef BFX_PROFILE
+    opcodes = program->opcodes;
+#endif
+
+    for (ip = bf->ip; ip < program->len; ip++) {
+        BFX_COUNT(ops);
+#ifdef BFX_PROFILE
+        /* every instruction is counted, so superinstructions are not used */
+        counts[ip]++;
+        switch (ops[ip].op) {
+#else
+        switch (opcodes[ip]) {
+#endif
+        case BFX_OP_ADD_ADD:
+            tape[tp + ops[ip].offset] += ops[ip].arg;
+            ip++;
+            BFX_COUNT(ops);
+            /* fall through */
+        case BFX_OP_ADD:
+            tape[tp + ops[ip].offset] += ops[ip].arg;
+            break;
+        case BFX_OP_ADD_MOVE:
+            tape[tp + ops[ip].offset] += ops[ip].arg;
+            ip++;
+            BFX_COUNT(ops);
+            /* fall through */
+        case BFX_OP_MOVE:
+            tp += ops[ip].arg;
+            if (tp < 0 || (size_t) tp >= bf->tape_size) {
+                tp = bfx_move_warning(bf, program, ip, tp);
+            } else if (tp > bf->tp_max) {
+                bf->tp_max = tp;
+            }
+            break;
+        case BFX_OP_MOVE_ADD:
+            tp += ops[ip].arg;
+            if (tp < 0 || (size_t) tp >= bf->tape_size) {
+                tp = bfx_move_warning(bf, program, ip, tp);
+            } else if (tp > bf->tp_max) {
+                bf->tp_max = tp;
+            }
+            ip++;
+            BFX_COUNT(ops);
+            tape[tp + ops[ip].offset] += ops[ip].arg;
+            break;
+        case BFX_OP_JZ:
+            BFX_COUNT(jz);
+            if (!tape[tp]) {
+                ip = ops[ip].arg;
+            }
+#ifdef BFX_TIERED
+            else if (tier->code[ip]) {
+                BFX_UNCOUNT_ENTRY();
+                bf->tp = tp;
+                bfx_jit_run(bf, program, tier->code[ip]);
+                ip = bf->ip - 1;
+                tp = bf->tp;
+            }
+#endif
+            break;
+        case BFX_OP_ADD_JNZ:
+            tape[tp + ops[ip].offset] += ops[ip].arg;
+            ip++;
+            BFX_COUNT(ops);
+            goto jnz;
+        case BFX_OP_MOVE_JNZ:
+            tp += ops[ip].arg;
+            if (tp < 0 || (size_t) tp >= bf->tape_size) {
+                tp = bfx_move_warning(bf, program, ip, tp);
+            } else if (tp > bf->tp_max) {
+                bf->tp_max = tp;
+            }
+            ip++;
+            BFX_COUNT(ops);
+            /* fall through */
+        case BFX_OP_JNZ:
+        jnz:
+            BFX_COUNT(jnz);
+            if (tape[tp]) {
+#ifdef BFX_CHECKPOINT
+                /* the jump is taken again when the run resumes */
+                if (bfx_checkpoint_pending) {
+                    bf->ip = ip;
+                    bf->tp = tp;
+                    return;
+                }
+#endif
+#ifdef BFX_TIERED
+                /* the loop's head sees the cell is nonzero and enters the body again */
+                if (++tier->counts[ip] == BFX_TIER_THRESHOLD
+                    && (tier->code[ops[ip].arg]
+                        = bfx_jit_compile(bf, program, ops[ip].arg, ip + 1, tier->track))) {
+                    BFX_UNCOUNT_ENTRY();
+                    bf->tp = tp;
+                    bfx_jit_run(bf, program, tier->code[ops[ip].arg]);
+                    ip = bf->ip - 1;
+                    tp = bf->tp;
+                    break;
+                }
+#endif
+                ip = ops[ip].arg;
+            }
+            break;
+        case BFX_OP_IN:
+            cell       = tp + ops[ip].offset;
+            tape[cell] = BFX_GETCHAR(bf, tape[cell]);
+            break;
+        case BFX_OP_OUT:
+            if (ops[ip].arg == 1) {
+                bfx_putchar(bf, tape[tp + ops[ip].offset]);
+            } else {
+                bfx_putchars(bf, tape[tp + ops[ip].offset], ops[ip].arg);
+            }
+            break;
+        case BFX_OP_DEBUG:
+            bf->tp = tp;
+            bf->ip = program->index[ip].idx;
+            bfx_diagnose(bf, &program->index[ip]);
+            break;
+        case BFX_OP_FORK:
+            bf->tp = tp;
+            if (bfx_fork(bf, program, ip)) {
+                bf->ip = program->len;
+                return;
+            }
+            tape[tp] = 0;
+            break;
+        case BFX_OP_SET:
+            tape[tp + ops[ip].offset] = ops[ip].arg;
+            break;
+        case BFX_OP_SCAN:
+            while ((cell = BFX_CELL_NAME(scan)(tape, tp, ops[ip].arg, bf->tape_size)) < 0) {
+                /* the scan walked off the tape, so wrap around like '>' and '<' */
+                if (ops[ip].arg > 0) {
+                    bf->tp_max = bf->tape_size - 1;
+                }
+                tp = bfx_move_warning(bf, program, ip, ops[ip].arg);
+            }
+            tp = cell;
+            if (tp > bf->tp_max) {
+                bf->tp_max = tp;
+            }
+            break;
+        case BFX_OP_MULADD:
+            if (tape[tp]) {
+                cell = tp + ops[ip].offset;
+                if (cell < 0 || (size_t) cell >= bf->tape_size) {
+                    bfx_offset_warning(program, ip, cell);
+                } else {
+                    /* unsigned arithmetic, so wide cells wrap instead of overflowing */
+                    tape[cell] += (BFX_CELL) ((unsigned long) tape[tp]
+                                              * (unsigned long) ops[ip].arg);
+                    if (cell > bf->tp_max) {
+                        bf->tp_max = cell;
+                    }
+                }
+            }
+            break;
+        case BFX_OP_CHECK:
+            if (tp + ops[ip].arg < 0 || (size_t) (tp + ops[ip].offset) >= bf->tape_size) {
+                bf->tp = tp;
+                ip     = BFX_CELL_NAME(unfold)(bf, program, ip);
+                tp     = bf->tp;
+            } else if (tp + ops[ip].offset > bf->tp_max) {
+                bf->tp_max = tp + ops[ip].offset;
+            }
+            break;
+        }
+    }
+
+    bf->ip = ip;
+    bf->tp = tp;
+}
+
+#undef BFX_COUNT
+#undef BFX_UNCOUNT_ENTRY
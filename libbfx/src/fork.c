@@ -0,0 +1,266 @@
+/**
+ * @file fork.c
+ * @brief threads of brainfork programs
+ *
+ * Brainfork's 'Y' forks the thread running it. The parent's current cell is set to
+ * zero, and the child continues after the 'Y' with a copy of the tape, its pointer
+ * one cell to the right and that cell set to one. Each child is an instance (see
+ * instance.c) run on a thread of its own, so forked threads use every core.
+ *
+ * A child's tape is taken from the tape pool, which hands out cleared tapes, so
+ * only the cells up to the parent's `tp_max` are copied, since no others can have
+ * been written. Every thread buffers its own output, and buffers are written with
+ * the I/O callbacks of the run while holding a lock, so the output of different
+ * threads is interleaved a whole buffer at a time and never mixed within one. Input
+ * is shared the same way: each thread reads the next block of the input when its
+ * own buffer runs out.
+ */
+
+#include "fork.h"
+#include "bfx.h"
+#include "instance.h"
+#include "interpret.h"
+#include "io.h"
+#include "program.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Structure to hold the threads of a run.
+ * @param lock Lock held while the thread list is changed or the I/O callbacks are called.
+ * @param io I/O callbacks of the run, which are only called with the lock held.
+ * @param threads Threads which have not been joined.
+ * @param len Number of threads.
+ * @param size Allocated size of the thread list.
+ * @param status Status of the first thread which failed to write its output, or
+ *               BFX_STATUS_OK.
+ */
+struct bfx_forks {
+    pthread_mutex_t lock;
+    bfx_io_t        io;
+    pthread_t*      threads;
+    size_t          len;
+    size_t          size;
+    int             status;
+};
+
+static size_t read_locked(void*, uint8_t*, size_t);
+static void*  run_child(void*);
+static bool   start_child(bfx_forks_t*, bfx_instance_t*);
+static size_t write_locked(void*, const uint8_t*, size_t);
+
+/**
+ * @brief Forks the thread running a program at a 'Y'.
+ *
+ * The child starts at the instruction after `ip`. Its cell is set to one here, and
+ * the parent's is set to zero by the engine once this returns. If the run was not
+ * prepared with bfx_forks_init(), or no thread can be started, the child runs to its
+ * end before this returns, which gives the same cells and output, only in a fixed
+ * order. Either way, the parent's output so far is flushed before the child starts,
+ * so it comes before anything the child writes.
+ *
+ * If the child cannot be created, the status of the run is set to
+ * BFX_STATUS_NO_MEMORY and the engine stops the parent.
+ *
+ * @param bf Pointer to the interpreter state, with `bf->tp` up to date.
+ * @param program Pointer to the program.
+ * @param ip Index of the FORK instruction.
+ *
+ * @return Returns BFX_STATUS_OK on success, or BFX_STATUS_NO_MEMORY.
+ */
+int bfx_fork(bfx_t* bf, const bfx_program_t* program, size_t ip) {
+    bfx_parameters_t params;
+    bfx_instance_t*  child;
+    bfx_t*           cbf;
+    int              tp;
+
+    bfx_io_flush(bf);
+    memset(&params, 0, sizeof(params));
+    params.flags          = bf->flags;
+    params.tape_size      = bf->tape_size;
+    params.eof_behavior   = bf->eof_behavior;
+    params.io_buffer_size = bf->io_size;
+    params.cell_width     = bf->cell_width;
+    if (bfx_instance_create(&child, program, params, &bf->io)) {
+        if (bf->status == BFX_STATUS_OK) {
+            bf->status = BFX_STATUS_NO_MEMORY;
+        }
+        return BFX_STATUS_NO_MEMORY;
+    }
+
+    cbf = &child->bf;
+    memcpy(cbf->tape, bf->tape, BFX_DIRTY_SIZE(*bf));
+    cbf->ip        = ip + 1;
+    cbf->tp_max    = bf->tp_max;
+    cbf->receiving = bf->receiving;
+    cbf->forks     = bf->forks;
+
+    tp = bf->tp + 1;
+    if ((size_t) tp >= cbf->tape_size) {
+        tp = bfx_move_warning(cbf, program, ip, tp);
+    } else if (tp > cbf->tp_max) {
+        cbf->tp_max = tp;
+    }
+    cbf->tp = tp;
+    switch (cbf->cell_width) {
+    case 16:
+        ((uint16_t*) cbf->tape)[tp] = 1;
+        break;
+    case 32:
+        ((uint32_t*) cbf->tape)[tp] = 1;
+        break;
+    default:
+        cbf->tape[tp] = 1;
+        break;
+    }
+
+    if (!bf->forks || !start_child(bf->forks, child)) {
+        run_child(child);
+    }
+    return BFX_STATUS_OK;
+}
+
+/**
+ * @brief Prepares a run for forked threads.
+ *
+ * The run's I/O callbacks are replaced by ones which call them with the lock held,
+ * and are passed on to every thread forked from it.
+ *
+ * @param bf Pointer to the interpreter state of the first thread.
+ *
+ * @return Returns BFX_STATUS_OK on success, or BFX_STATUS_NO_MEMORY.
+ */
+int bfx_forks_init(bfx_t* bf) {
+    bfx_forks_t* forks;
+
+    if (!(forks = malloc(sizeof(bfx_forks_t)))) {
+        return BFX_STATUS_NO_MEMORY;
+    }
+    if (pthread_mutex_init(&forks->lock, NULL)) {
+        free(forks);
+        return BFX_STATUS_NO_MEMORY;
+    }
+    forks->io      = bf->io;
+    forks->threads = NULL;
+    forks->len     = 0;
+    forks->size    = 0;
+    forks->status  = BFX_STATUS_OK;
+
+    bf->io.read  = forks->io.read ? read_locked : NULL;
+    bf->io.write = forks->io.write ? write_locked : NULL;
+    bf->io.data  = forks;
+    bf->forks    = forks;
+    return BFX_STATUS_OK;
+}
+
+/**
+ * @brief Waits for every thread forked during a run, including those forked by other
+ * forked threads, then restores the run's I/O callbacks.
+ *
+ * The first thread's output is flushed first, so it is not held back until the
+ * others end. If a thread failed to write its output, the status of the run is set
+ * to BFX_STATUS_IO_ERROR.
+ *
+ * @param bf Pointer to the interpreter state of the first thread.
+ */
+void bfx_forks_join(bfx_t* bf) {
+    bfx_forks_t* forks;
+    pthread_t    thread;
+
+    if (!(forks = bf->forks)) {
+        return;
+    }
+    bfx_io_flush(bf);
+
+    pthread_mutex_lock(&forks->lock);
+    while (forks->len > 0) {
+        thread = forks->threads[--forks->len];
+        pthread_mutex_unlock(&forks->lock);
+        pthread_join(thread, NULL);
+        pthread_mutex_lock(&forks->lock);
+    }
+    pthread_mutex_unlock(&forks->lock);
+
+    if (forks->status != BFX_STATUS_OK && bf->status == BFX_STATUS_OK) {
+        bf->status = forks->status;
+    }
+    bf->io    = forks->io;
+    bf->forks = NULL;
+    pthread_mutex_destroy(&forks->lock);
+    free(forks->threads);
+    free(forks);
+}
+
+/**
+ * @brief Calls the run's read callback with the lock held.
+ */
+static size_t read_locked(void* data, uint8_t* buf, size_t size) {
+    bfx_forks_t* forks = data;
+    size_t       n;
+
+    pthread_mutex_lock(&forks->lock);
+    n = forks->io.read(forks->io.data, buf, size);
+    pthread_mutex_unlock(&forks->lock);
+    return n;
+}
+
+/**
+ * @brief Runs a forked thread's instance to its end, then frees it.
+ * @param arg Pointer to the instance.
+ * @return Returns NULL.
+ */
+static void* run_child(void* arg) {
+    bfx_instance_t* child = arg;
+    bfx_forks_t*    forks = child->bf.forks;
+
+    if (bfx_instance_run(child) != BFX_STATUS_OK && forks) {
+        pthread_mutex_lock(&forks->lock);
+        if (forks->status == BFX_STATUS_OK) {
+            forks->status = child->bf.status;
+        }
+        pthread_mutex_unlock(&forks->lock);
+    }
+    bfx_instance_destroy(child);
+    return NULL;
+}
+
+/**
+ * @brief Starts a thread which runs a forked instance, and adds it to the run's threads.
+ * @return Returns true if the thread was started.
+ */
+static bool start_child(bfx_forks_t* forks, bfx_instance_t* child) {
+    pthread_t* threads;
+    bool       started;
+
+    pthread_mutex_lock(&forks->lock);
+    if (forks->len == forks->size) {
+        threads = realloc(forks->threads, sizeof(pthread_t) * (forks->size ? forks->size * 2 : 16));
+        if (!threads) {
+            pthread_mutex_unlock(&forks->lock);
+            return false;
+        }
+        forks->threads = threads;
+        forks->size    = forks->size ? forks->size * 2 : 16;
+    }
+    started = !pthread_create(&forks->threads[forks->len], NULL, run_child, child);
+    if (started) {
+        forks->len++;
+    }
+    pthread_mutex_unlock(&forks->lock);
+    return started;
+}
+
+/**
+ * @brief Calls the run's write callback with the lock held.
+ */
+static size_t write_locked(void* data, const uint8_t* buf, size_t len) {
+    bfx_forks_t* forks = data;
+    size_t       n;
+
+    pthread_mutex_lock(&forks->lock);
+    n = forks->io.write(forks->io.data, buf, len);
+    pthread_mutex_unlock(&forks->lock);
+    return n;
+}
@@ -0,0 +1,11 @@
+#ifndef BFX_FORK_H
+#define BFX_FORK_H
+
+#include "bfx.h"
+#include "program.h"
+
+int  bfx_fork(bfx_t*, const bfx_program_t*, size_t);
+int  bfx_forks_init(bfx_t*);
+void bfx_forks_join(bfx_t*);
+
+#endif
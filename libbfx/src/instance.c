@@ -0,0 +1,187 @@
+#include "instance.h"
+#include "interpret.h"
+#include "io.h"
+#include "jit.h"
+#include "prefix.h"
+#include "tape.h"
+#include "threaded.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define BFX_INSTANCE_IGNORED_FLAGS                                                                 \
+    (BFX_FLAG_GROWABLE_TAPE | BFX_FLAG_REPL | BFX_FLAG_SEPARATE_INPUT_AND_SOURCE)
+
+/**
+ * @brief Creates an instance which runs a program.
+ *
+ * An instance owns its tape and I/O buffers and nothing else, so it is cheap to
+ * create one per run of a program built once with bfx_program_create(). Instances
+ * share no state, so different instances may run in different threads.
+ *
+ * `BFX_FLAG_GROWABLE_TAPE` is ignored, since a growable tape relies on a fault
+ * handler which is shared by the whole process, and so are the flags which only
+ * apply to source read by the interpreter itself (`BFX_FLAG_REPL` and
+ * `BFX_FLAG_SEPARATE_INPUT_AND_SOURCE`).
+ *
+ * @param instance Set to the new instance on success.
+ * @param program Pointer to the program to run. It must outlive the instance.
+ * @param params Parameters for the run. `input_max` and the graphics parameters are
+ *               not used.
+ * @param io I/O callbacks, or NULL to use stdin and stdout.
+ *
+ * @return Returns BFX_STATUS_OK on success, BFX_STATUS_INVALID_PARAMETERS if the
+ *         tape size or cell width is invalid, or BFX_STATUS_NO_MEMORY.
+ */
+int bfx_instance_create(bfx_instance_t**     instance,
+                        const bfx_program_t* program,
+                        bfx_parameters_t     params,
+                        const bfx_io_t*      io) {
+    bfx_instance_t* inst;
+    int             ret;
+
+    if (!(inst = malloc(sizeof(bfx_instance_t)))) {
+        return BFX_STATUS_NO_MEMORY;
+    }
+    if ((ret = bfx_state_init(&inst->bf, params))) {
+        free(inst);
+        return ret;
+    }
+    if (io) {
+        inst->bf.io = *io;
+    }
+    inst->program = program;
+
+    *instance = inst;
+    return BFX_STATUS_OK;
+}
+
+/**
+ * @brief Frees an instance, writing any output it has not written yet.
+ * @param instance Pointer to the instance.
+ */
+void bfx_instance_destroy(bfx_instance_t* instance) {
+    if (instance) {
+        bfx_state_free(&instance->bf);
+        free(instance);
+    }
+}
+
+/**
+ * @brief Returns an instance to the state it was created in, so it can run again.
+ *
+ * The tape is cleared, and buffered input is discarded.
+ *
+ * @param instance Pointer to the instance.
+ */
+void bfx_instance_reset(bfx_instance_t* instance) { bfx_state_reset(&instance->bf); }
+
+/**
+ * @brief Runs an instance's program until it ends.
+ *
+ * Output is written before this returns. Once the program has ended, running the
+ * instance again does nothing until it is reset with bfx_instance_reset().
+ *
+ * @param instance Pointer to the instance.
+ *
+ * @return Returns BFX_STATUS_OK on success, or BFX_STATUS_IO_ERROR if the write
+ *         callback failed, in which case output after the failure was discarded.
+ */
+int bfx_instance_run(bfx_instance_t* instance) {
+    bfx_run_program(&instance->bf, instance->program);
+    bfx_io_flush(&instance->bf);
+    return instance->bf.status;
+}
+
+/**
+ * @brief Executes a program with the engine selected by the interpreter's flags.
+ *
+ * The JIT is used if `BFX_FLAG_JIT` is set, the threaded engine if
+ * `BFX_FLAG_THREADED` is set and bfx_execute_tiered() if `BFX_FLAG_TIERED` is set,
+ * otherwise bfx_execute() is. A run which has not started
+ * yet starts from the program's prefix, if it has one (see bfx_prefix_load()).
+ *
+ * @param bf Pointer to the interpreter state.
+ * @param program Pointer to the program to execute.
+ */
+void bfx_run_program(bfx_t* bf, const bfx_program_t* program) {
+    bfx_prefix_load(bf, program->prefix);
+    if (bf->flags & BFX_FLAG_JIT) {
+        bfx_execute_jit(bf, program);
+    } else if (bf->flags & BFX_FLAG_THREADED) {
+        bfx_execute_threaded(bf, program);
+    } else if (bf->flags & BFX_FLAG_TIERED) {
+        bfx_execute_tiered(bf, program);
+    } else {
+        bfx_execute(bf, program);
+    }
+}
+
+/**
+ * @brief Frees the tape and I/O buffers of an interpreter state made by bfx_state_init(),
+ * writing any output which has not been written yet.
+ * @param bf Pointer to the interpreter state.
+ */
+void bfx_state_free(bfx_t* bf) {
+    bfx_io_free(bf);
+    bfx_tape_release(bf->tape, bf->tape_size * BFX_CELL_SIZE(*bf), BFX_DIRTY_SIZE(*bf));
+    bf->tape = NULL;
+}
+
+/**
+ * @brief Initializes an interpreter state which runs compiled programs.
+ *
+ * Only the tape, which is taken from the tape pool, and the I/O buffers are
+ * allocated. I/O uses stdin and stdout
+ * until other callbacks are set. See bfx_instance_create() for the flags which
+ * are ignored.
+ *
+ * @param bf Pointer to the interpreter state.
+ * @param params Parameters for the state.
+ *
+ * @return Returns BFX_STATUS_OK on success, BFX_STATUS_INVALID_PARAMETERS if the
+ *         tape size or cell width is invalid, or BFX_STATUS_NO_MEMORY.
+ */
+int bfx_state_init(bfx_t* bf, bfx_parameters_t params) {
+    if (params.tape_size == 0
+        || (params.cell_width != 8 && params.cell_width != 16 && params.cell_width != 32)) {
+        return BFX_STATUS_INVALID_PARAMETERS;
+    }
+
+    memset(bf, 0, sizeof(bfx_t));
+    bf->flags        = params.flags & ~BFX_INSTANCE_IGNORED_FLAGS;
+    bf->tape_size    = params.tape_size;
+    bf->cell_width   = params.cell_width;
+    bf->eof_behavior = params.eof_behavior;
+    bf->receiving    = true;
+
+    if (!(bf->tape = bfx_tape_acquire(bf->tape_size * BFX_CELL_SIZE(*bf)))
+        || bfx_io_init(bf, params.io_buffer_size)) {
+        bfx_tape_release(bf->tape, bf->tape_size * BFX_CELL_SIZE(*bf), 0);
+        return BFX_STATUS_NO_MEMORY;
+    }
+    return BFX_STATUS_OK;
+}
+
+/**
+ * @brief Returns an interpreter state made by bfx_state_init() to its initial state.
+ *
+ * Pending output is written, the cells up to `tp_max` are cleared, buffered
+ * input is discarded and the counts are zeroed.
+ * The I/O callbacks are kept.
+ *
+ * @param bf Pointer to the interpreter state.
+ */
+void bfx_state_reset(bfx_t* bf) {
+    bfx_io_flush(bf);
+    bfx_tape_clear(bf->tape, bf->tape_size * BFX_CELL_SIZE(*bf), BFX_DIRTY_SIZE(*bf));
+    bf->ip        = 0;
+    bf->tp        = 0;
+    bf->tp_max    = 0;
+    bf->receiving = true;
+    bf->in_len    = 0;
+    bf->in_pos    = 0;
+    bf->in_read   = 0;
+    bf->status    = BFX_STATUS_OK;
+    memset(&bf->counts, 0, sizeof(bf->counts));
+}
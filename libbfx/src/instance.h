@@ -0,0 +1,23 @@
+#ifndef BFX_INSTANCE_H
+#define BFX_INSTANCE_H
+
+#include "bfx.h"
+#include "program.h"
+
+/**
+ * @brief Structure to represent one run of a shared program.
+ * @param bf Interpreter state. Only the tape, pointers and I/O are used; the
+ *           source fields are unused, since the program is already compiled.
+ * @param program Pointer to the program, which is not owned by the instance.
+ */
+struct bfx_instance {
+    bfx_t                bf;
+    const bfx_program_t* program;
+};
+
+void bfx_run_program(bfx_t*, const bfx_program_t*);
+void bfx_state_free(bfx_t*);
+int  bfx_state_init(bfx_t*, bfx_parameters_t);
+void bfx_state_reset(bfx_t*);
+
+#endif
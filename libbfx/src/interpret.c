@@ -1,77 +1,318 @@
 #include "interpret.h"
 #include "bfx.h"
+#include "checkpoint.h"
+#include "fork.h"
+#include "io.h"
+#include "jit.h"
+#include "program.h"
+#include "scan.h"
+#include "tape.h"
 
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-static void diagnose(bfx_t*, bfx_file_index_t*);
-
-static void op_inc_tp(bfx_t*, bfx_file_index_t*);
-static void op_dec_tp(bfx_t*, bfx_file_index_t*);
-static void op_inc_t(bfx_t*);
-static void op_dec_t(bfx_t*);
-static void op_loop_start(bfx_t*, bfx_file_index_t*);
-static void op_loop_end(bfx_t*, bfx_file_index_t*);
-static void op_getchar(bfx_t*);
-static void op_putchar(bfx_t*);
-
-void        bfx_interpret(bfx_t* bf, bfx_file_index_t* index) {
-    size_t i;
-    char   c;
-
-    index->line_idx++;
-    switch (bf->prog[bf->ip]) {
-    case '+':
-        op_inc_t(bf);
+#define BFX_CELL         uint8_t
+#define BFX_CELL_BITS    8
+#define BFX_CELL_NAME(n) n##_8
+#include "engine.h"
+#undef BFX_CELL
+#undef BFX_CELL_BITS
+#undef BFX_CELL_NAME
+
+#define BFX_CELL         uint16_t
+#define BFX_CELL_BITS    16
+#define BFX_CELL_NAME(n) n##_16
+#include "engine.h"
+#undef BFX_CELL
+#undef BFX_CELL_BITS
+#undef BFX_CELL_NAME
+
+#define BFX_CELL         uint32_t
+#define BFX_CELL_BITS    32
+#define BFX_CELL_NAME(n) n##_32
+#include "engine.h"
+#undef BFX_CELL
+#undef BFX_CELL_BITS
+#undef BFX_CELL_NAME
+
+/**
+ * @brief Builds the loop structure used by bfx_interpret().
+ *
+ * This function scans the brainfuck program and constructs the necessary
+ * data structures to efficiently handle loop constructs ('[' and ']').
+ * It ensures that matching brackets are correctly paired, allowing for
+ * proper execution flow during interpretation.
+ *
+ * Two tables are produced: `jumps`, a dense table indexed by instruction pointer
+ * holding the index of the matching bracket (so each jump is a single lookup), and
+ * `lines`, holding the start of each line so positions for diagnostics can be
+ * looked up when they are needed rather than tracked while running.
+ *
+ * @param bf Pointer to the interpreter state.
+ *
+ * @return Returns BFX_STATUS_OK on success, BFX_STATUS_SYNTAX_ERROR if the program
+ *         contains an unmatched bracket, or BFX_STATUS_NO_MEMORY.
+ */
+int bfx_build_loops(bfx_t* bf) {
+    bfx_file_index_t* stack;
+    bfx_file_index_t* grown;
+    bfx_file_index_t  start;
+    size_t*           lines;
+    int               stack_top;
+    int               stack_size;
+    int               line;
+    int               line_idx;
+    int               ret;
+    size_t            i;
+
+    free(bf->jumps);
+    free(bf->lines);
+
+    stack          = malloc(sizeof(bfx_file_index_t) * BFX_INITIAL_LOOP_SIZE);
+    stack_top      = 0;
+    stack_size     = BFX_INITIAL_LOOP_SIZE;
+    line           = 1;
+    line_idx       = 0;
+    ret            = BFX_STATUS_OK;
+    bf->jumps      = malloc(sizeof(int) * (bf->prog_len + 1));
+    bf->lines_len  = 1;
+    bf->lines_size = BFX_INITIAL_LOOP_SIZE;
+    bf->lines      = malloc(sizeof(size_t) * bf->lines_size);
+
+    if (!stack || !bf->jumps || !bf->lines) {
+        free(stack);
+        return BFX_STATUS_NO_MEMORY;
+    }
+    bf->lines[0] = 0;
+
+    for (i = 0; i < bf->prog_len && !ret; i++) {
+        line_idx++;
+        if (bf->prog[i] == '[') {
+            if (stack_top >= stack_size) {
+                if (!(grown = realloc(stack, sizeof(bfx_file_index_t) * stack_size * 2))) {
+                    ret = BFX_STATUS_NO_MEMORY;
+                    break;
+                }
+                stack = grown;
+                stack_size *= 2;
+            }
+            stack[stack_top].idx      = i;
+            stack[stack_top].line     = line;
+            stack[stack_top].line_idx = line_idx;
+            stack_top++;
+        } else if (bf->prog[i] == ']') {
+            if (stack_top <= 0) {
+                fprintf(stderr,
+                        "libbfx: Error (%d,%d): Unmatched closing bracket ']'.\n",
+                        line,
+                        line_idx);
+                ret = BFX_STATUS_SYNTAX_ERROR;
+                break;
+            }
+            start                = stack[--stack_top];
+            bf->jumps[start.idx] = i;
+            bf->jumps[i]         = start.idx;
+        } else if (bf->prog[i] == '\n') {
+            if (bf->lines_len >= bf->lines_size) {
+                if (!(lines = realloc(bf->lines, sizeof(size_t) * bf->lines_size * 2))) {
+                    ret = BFX_STATUS_NO_MEMORY;
+                    break;
+                }
+                bf->lines = lines;
+                bf->lines_size *= 2;
+            }
+            bf->lines[bf->lines_len++] = i + 1;
+            line++;
+            line_idx = 0;
+        }
+    }
+
+    if (!ret && stack_top != 0) {
+        fprintf(stderr, "libbfx: Error (%d,%d): Unmatched opening bracket '['.\n", line, line_idx);
+        ret = BFX_STATUS_SYNTAX_ERROR;
+    }
+
+    free(stack);
+    return ret;
+}
+
+/**
+ * @brief Interprets the program source from `bf->ip` to its end.
+ *
+ * The loop structure must have been built with bfx_build_loops(). Source positions
+ * are not tracked while running; when a warning or `#` needs one, it is looked up
+ * with bfx_locate().
+ *
+ * @param bf Pointer to the interpreter state.
+ */
+void bfx_interpret(bfx_t* bf) {
+    switch (bf->cell_width) {
+    case 16:
+        interpret_16(bf);
         break;
-    case '-':
-        op_dec_t(bf);
+    case 32:
+        interpret_32(bf);
         break;
-    case '>':
-        op_inc_tp(bf, index);
+    default:
+        interpret_8(bf);
+        break;
+    }
+}
+
+/**
+ * @brief Executes a program compiled to the intermediate representation.
+ *
+ * Execution starts at `bf->ip`, which is an index into the program's instructions.
+ * The instruction and tape pointers are kept in locals while running and written
+ * back to `bf` when execution ends. Each cell width has its own copy of the engine,
+ * and a second one which counts what it runs in `bf->counts` if `BFX_FLAG_STATS` is set.
+ *
+ * @param bf Pointer to the interpreter state.
+ * @param program Pointer to the program to execute.
+ */
+void bfx_execute(bfx_t* bf, const bfx_program_t* program) {
+    bool counted;
+
+    counted = bf->flags & BFX_FLAG_STATS;
+    switch (bf->cell_width) {
+    case 16:
+        (counted ? stats_16 : execute_16)(bf, program, NULL);
         break;
-    case '<':
-        op_dec_tp(bf, index);
+    case 32:
+        (counted ? stats_32 : execute_32)(bf, program, NULL);
         break;
-    case ',':
-        op_getchar(bf);
+    default:
+        (counted ? stats_8 : execute_8)(bf, program, NULL);
         break;
-    case '.':
-        op_putchar(bf);
+    }
+}
+
+/**
+ * @brief Executes a program like bfx_execute(), counting how many times each instruction runs.
+ *
+ * This is a separate copy of the engine, so bfx_execute() does no counting.
+ *
+ * @param bf Pointer to the interpreter state.
+ * @param program Pointer to the program to execute.
+ * @param counts Array of `program->len` counts, each of which is incremented when its
+ *               instruction runs.
+ */
+void bfx_execute_profile(bfx_t* bf, const bfx_program_t* program, uint64_t* counts) {
+    switch (bf->cell_width) {
+    case 16:
+        profile_16(bf, program, counts);
         break;
-    case '[':
-        op_loop_start(bf, index);
+    case 32:
+        profile_32(bf, program, counts);
         break;
-    case ']':
-        op_loop_end(bf, index);
+    default:
+        profile_8(bf, program, counts);
         break;
-    case '#':
-        if (BFX_IN_DEBUG_MODE(*bf) && BFX_SPECIAL_INSTRUCTIONS_ENABLED(*bf)) {
-            diagnose(bf, index);
-        }
+    }
+}
+
+/**
+ * @brief Executes a program like bfx_execute(), stopping early if a snapshot is requested.
+ *
+ * Once `bfx_checkpoint_pending` is set, execution stops at the next backward jump
+ * which is taken, leaving `bf->ip` at the jump, which is a point any engine can
+ * resume from. This is a separate copy of the engine, so bfx_execute() does not
+ * check for requests.
+ *
+ * @param bf Pointer to the interpreter state.
+ * @param program Pointer to the program to execute.
+ */
+void bfx_execute_checkpoint(bfx_t* bf, const bfx_program_t* program) {
+    switch (bf->cell_width) {
+    case 16:
+        checkpoint_16(bf, program, NULL);
         break;
-    case '@':
-        if (BFX_IN_REPL_MODE(*bf) && BFX_SPECIAL_INSTRUCTIONS_ENABLED(*bf)) {
-            bfx_reset(bf);
-        }
+    case 32:
+        checkpoint_32(bf, program, NULL);
         break;
-    case '\n':
-        index->line++;
-        index->line_idx = 0;
+    default:
+        checkpoint_8(bf, program, NULL);
         break;
     }
 }
 
+/**
+ * @brief Executes a program like bfx_execute(), moving its hot loops to native code.
+ *
+ * Every loop starts in the interpreter, so short runs do not wait for code to be
+ * generated, and a loop which takes BFX_TIER_THRESHOLD backward jumps is compiled by
+ * the JIT and continues there (see execute.h). The code is kept for the rest of the
+ * run, and counts what it runs like the interpreter if `BFX_FLAG_STATS` is set. Where
+ * the JIT is not supported, and for cells wider than 8 bits, this is
+ * bfx_execute(), as it is if there is no memory for the loop counts.
+ *
+ * @param bf Pointer to the interpreter state.
+ * @param program Pointer to the program to execute.
+ */
+void bfx_execute_tiered(bfx_t* bf, const bfx_program_t* program) {
+    bfx_tier_t tier;
+    size_t     i;
+
+    tier.counts = calloc(program->len + 1, sizeof(uint64_t));
+    tier.code   = calloc(program->len + 1, sizeof(bfx_jit_code_t*));
+    if (bf->cell_width != 8 || !tier.counts || !tier.code) {
+        free(tier.counts);
+        free(tier.code);
+        bfx_execute(bf, program);
+        return;
+    }
+
+    tier.track = bfx_jit_track(bf, program);
+    (bf->flags & BFX_FLAG_STATS ? tiered_stats_8 : tiered_8)(bf, program, &tier);
+
+    for (i = 0; i < program->len; i++) {
+        bfx_jit_free(tier.code[i]);
+    }
+    free(tier.counts);
+    free(tier.code);
+}
+
+/**
+ * @brief Runs the instructions guarded by a CHECK which failed.
+ *
+ * Offsets are reached by moving the tape pointer from one to the next, with a bounds
+ * check on each move, and a run which does not end with a MOVE moves back to where
+ * it started. The pointer is thus reset where the MOVEs replaced by offsets would
+ * have reset it, but like them, each move is only checked where it ends and not
+ * after every '<' or '>' (see bfx_program_build()). Since the moves are gone, a
+ * warning gives the position of the instruction whose cell was off the tape instead.
+ * If `BFX_FLAG_STATS` is set, the guarded instructions are counted as they run.
+ *
+ * @param bf Pointer to the interpreter state.
+ * @param program Pointer to the program.
+ * @param ip Index of the CHECK.
+ *
+ * @return Returns the index of the last instruction run (see bfx_program_check_end()).
+ */
+size_t bfx_unfold(bfx_t* bf, const bfx_program_t* program, size_t ip) {
+    switch (bf->cell_width) {
+    case 16:
+        return unfold_16(bf, program, ip);
+    case 32:
+        return unfold_32(bf, program, ip);
+    default:
+        return unfold_8(bf, program, ip);
+    }
+}
+
 /**
  * @brief Diagnoses the brainfuck program.
  *
  * This function prints the current state of the brainfuck program, including the line number,
  * tape pointer, instruction pointer, and memory map.
  */
-static void diagnose(bfx_t* bf, bfx_file_index_t* idx) {
+void bfx_diagnose(bfx_t* bf, const bfx_file_index_t* idx) {
     int i;
 
+    bfx_io_flush(bf);
     fprintf(stderr,
             "Line: %d,%d\nTape pointer: %d\nInstruction pointer: %d\n",
             idx->line,
@@ -81,95 +322,157 @@ static void diagnose(bfx_t* bf, bfx_file_index_t* idx) {
 
     fprintf(stderr, "Memory map:\n");
     for (i = 0; i < bf->tp_max; i++) {
-        fprintf(stderr, "%d: %d\n", i, bf->tape[i]);
+        switch (bf->cell_width) {
+        case 16:
+            fprintf(stderr, "%d: %u\n", i, (unsigned) ((uint16_t*) bf->tape)[i]);
+            break;
+        case 32:
+            fprintf(stderr, "%d: %lu\n", i, (unsigned long) ((uint32_t*) bf->tape)[i]);
+            break;
+        default:
+            fprintf(stderr, "%d: %d\n", i, bf->tape[i]);
+            break;
+        }
     }
 }
 
-static void op_inc_tp(bfx_t* bf, bfx_file_index_t* index) {
-    bf->tp++;
-    if ((size_t) bf->tp > bf->tape_size) {
-        fprintf(stderr,
-                "Warning (%d,%d): Tape pointer overflow. Tape pointer set to zero.\n",
-                index->line,
-                index->line_idx);
-        bf->tp = 0;
-    } else if (bf->tp > bf->tp_max) {
-        bf->tp_max = bf->tp;
+/**
+ * @brief Handles a folded MOVE which left the tape.
+ *
+ * Prints the same warning as a single '>' or '<' would and resets the tape pointer.
+ * A growable tape cannot be left, so this is an error which exits instead.
+ *
+ * @return Returns the new tape pointer.
+ */
+int bfx_move_warning(bfx_t* bf, const bfx_program_t* program, size_t ip, int tp) {
+    if (bf->tape_guard) {
+        bfx_tape_error(bf, program, ip, tp);
     }
+    fprintf(stderr,
+            "Warning (%d,%d): Tape pointer %s. Tape pointer set to zero.\n",
+            program->index[ip].line,
+            program->index[ip].line_idx,
+            tp < 0 ? "underflow" : "overflow");
+    return 0;
 }
 
-static void op_dec_tp(bfx_t* bf, bfx_file_index_t* index) {
-    bf->tp--;
-    if (bf->tp < 0) {
-        fprintf(stderr,
-                "Warning (%d,%d): Tape pointer underflow. Tape pointer set to zero.\n",
-                index->line,
-                index->line_idx);
-        bf->tp = 0;
-    }
+/**
+ * @brief Warns about a MULADD whose target cell is outside the tape.
+ *
+ * The addition is skipped.
+ */
+void bfx_offset_warning(const bfx_program_t* program, size_t ip, int cell) {
+    fprintf(stderr,
+            "Warning (%d,%d): Tape pointer %s. Cell %d is outside the tape.\n",
+            program->index[ip].line,
+            program->index[ip].line_idx,
+            cell < 0 ? "underflow" : "overflow",
+            cell);
 }
 
-static void op_inc_t(bfx_t* bf) { bf->tape[bf->tp]++; }
-
-static void op_dec_t(bfx_t* bf) { bf->tape[bf->tp]--; }
+/**
+ * @brief Finds the line and column of a position in the program source.
+ *
+ * The line is found by a binary search of `bf->lines`, which is built with the
+ * jump table, so nothing has to be tracked while the program runs.
+ *
+ * @param bf Pointer to the interpreter state.
+ * @param idx Index within the program source.
+ *
+ * @return Returns the position of `idx`.
+ */
+bfx_file_index_t bfx_locate(const bfx_t* bf, size_t idx) {
+    bfx_file_index_t index;
+    size_t           lo;
+    size_t           hi;
+    size_t           mid;
 
-static void op_loop_start(bfx_t* bf, bfx_file_index_t* index) {
-    size_t i;
-    if (!bf->tape[bf->tp]) {
-        for (i = 0; i < bf->loops_len; i++) {
-            if (bf->loops[i].start.idx == bf->ip) {
-                bf->ip          = bf->loops[i].end.idx;
-                index->line     = bf->loops[i].end.line;
-                index->line_idx = bf->loops[i].end.line_idx;
-            }
+    lo = 0;
+    hi = bf->lines_len;
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if (bf->lines[mid] <= idx) {
+            lo = mid;
+        } else {
+            hi = mid;
         }
     }
-}
 
-static void op_loop_end(bfx_t* bf, bfx_file_index_t* index) {
-    size_t i;
-    if (bf->tape[bf->tp]) {
-        for (i = 0; i < bf->loops_len; i++) {
-            if (bf->loops[i].end.idx == bf->ip) {
-                bf->ip          = bf->loops[i].start.idx;
-                index->line     = bf->loops[i].start.line;
-                index->line_idx = bf->loops[i].start.line_idx;
-            }
-        }
-    }
+    index.idx      = idx;
+    index.line     = lo + 1;
+    index.line_idx = idx - bf->lines[lo] + 1;
+    return index;
 }
 
-static void op_getchar(bfx_t* bf) {
-    char c;
-    if (bf->flags & BFX_FLAG_SEPARATE_INPUT_AND_SOURCE) {
-        if (bf->input_ptr < bf->input_len) {
-            c = bf->prog[bf->input_ptr];
-            bf->input_ptr++;
-        } else {
-            c = EOF;
-        }
-    } else {
-        c = fgetc(stdin);
-    }
+/**
+ * @brief Reads a byte for ',', applying the EOF behavior.
+ *
+ * Once EOF has been reached, no more input is read.
+ *
+ * @param bf Pointer to the interpreter state.
+ * @param cell Value of the current cell.
+ *
+ * @return Returns the new value of the current cell.
+ */
+unsigned long bfx_getchar(bfx_t* bf, unsigned long cell) {
+    int c;
 
     if (bf->receiving) {
-        if (c == EOF) {
-            bf->receiving = false;
+        if (bf->flags & BFX_FLAG_SEPARATE_INPUT_AND_SOURCE) {
+            c = bf->input_ptr < bf->input_len ? (uint8_t) bf->prog[bf->input_ptr++] : EOF;
         } else {
-            bf->tape[bf->tp] = c;
+            c = bfx_io_read(bf);
+        }
+        if (c != EOF) {
+            return c;
         }
+        bf->receiving = false;
     }
 
-    if (!bf->receiving) {
-        switch (bf->eof_behavior) {
-        case BFX_EOF_BEHAVIOR_ZERO:
-            bf->tape[bf->tp] = 0;
-            break;
-        case BFX_EOF_BEHAVIOR_DECREMENT:
-            bf->tape[bf->tp]--;
-            break;
-        }
+    switch (bf->eof_behavior) {
+    case BFX_EOF_BEHAVIOR_ZERO:
+        return 0;
+    case BFX_EOF_BEHAVIOR_DECREMENT:
+        return cell - 1;
+    default:
+        return cell;
+    }
+}
+
+/**
+ * @brief Writes the low byte of a cell to the output buffer for '.'.
+ * @param bf Pointer to the interpreter state.
+ * @param cell Value of the current cell.
+ */
+void bfx_putchar(bfx_t* bf, unsigned long cell) {
+    bf->out[bf->out_len++] = (uint8_t) cell;
+    if (bf->out_len >= bf->io_size || (BFX_IN_REPL_MODE(*bf) && (uint8_t) cell == '\n')) {
+        bfx_io_flush(bf);
     }
 }
 
-static void op_putchar(bfx_t* bf) { putchar(bf->tape[bf->tp]); }
+/**
+ * @brief Writes the low byte of a cell `n` times for an OUT folded from a run of '.'.
+ *
+ * The copies are set in the output buffer a block at a time, rather than one at a time.
+ *
+ * @param bf Pointer to the interpreter state.
+ * @param cell Value of the current cell.
+ * @param n Number of copies.
+ */
+void bfx_putchars(bfx_t* bf, unsigned long cell, size_t n) {
+    size_t len;
+
+    while (n > 0) {
+        len = bf->io_size - bf->out_len < n ? bf->io_size - bf->out_len : n;
+        memset(bf->out + bf->out_len, (uint8_t) cell, len);
+        bf->out_len += len;
+        n -= len;
+        if (bf->out_len >= bf->io_size) {
+            bfx_io_flush(bf);
+        }
+    }
+    if (BFX_IN_REPL_MODE(*bf) && (uint8_t) cell == '\n') {
+        bfx_io_flush(bf);
+    }
+}
@@ -2,7 +2,21 @@
 #define BFX_INTERPRET_H
 
 #include "bfx.h"
+#include "program.h"
 
-void bfx_interpret(bfx_t*, bfx_file_index_t*);
+int              bfx_build_loops(bfx_t*);
+void             bfx_diagnose(bfx_t*, const bfx_file_index_t*);
+void             bfx_execute(bfx_t*, const bfx_program_t*);
+void             bfx_execute_checkpoint(bfx_t*, const bfx_program_t*);
+void             bfx_execute_profile(bfx_t*, const bfx_program_t*, uint64_t*);
+void             bfx_execute_tiered(bfx_t*, const bfx_program_t*);
+unsigned long    bfx_getchar(bfx_t*, unsigned long);
+void             bfx_interpret(bfx_t*);
+bfx_file_index_t bfx_locate(const bfx_t*, size_t);
+int              bfx_move_warning(bfx_t*, const bfx_program_t*, size_t, int);
+void             bfx_offset_warning(const bfx_program_t*, size_t, int);
+void             bfx_putchar(bfx_t*, unsigned long);
+void             bfx_putchars(bfx_t*, unsigned long, size_t);
+size_t           bfx_unfold(bfx_t*, const bfx_program_t*, size_t);
 
 #endif
@@ -0,0 +1,196 @@
+#include "io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static size_t read_line(void*, uint8_t*, size_t);
+static size_t read_stdin(void*, uint8_t*, size_t);
+static size_t write_stdout(void*, const uint8_t*, size_t);
+
+/**
+ * @brief Writes the contents of the output buffer.
+ *
+ * If the write callback fails, the status of the run is set to BFX_STATUS_IO_ERROR
+ * and any further output is discarded.
+ *
+ * @param bf Pointer to the interpreter state.
+ */
+void bfx_io_flush(bfx_t* bf) {
+    if (bf->out_len > 0 && bf->io.write && bf->status == BFX_STATUS_OK
+        && bf->io.write(bf->io.data, bf->out, bf->out_len) < bf->out_len) {
+        bf->status = BFX_STATUS_IO_ERROR;
+    }
+    bf->out_len = 0;
+}
+
+/**
+ * @brief Flushes and frees the I/O buffers.
+ * @param bf Pointer to the interpreter state.
+ */
+void bfx_io_free(bfx_t* bf) {
+    if (bf->out) {
+        bfx_io_flush(bf);
+        free(bf->out);
+    }
+    if (bf->in_mapped) {
+        munmap(bf->in, bf->in_mapped);
+    }
+    bf->out       = NULL;
+    bf->in        = NULL;
+    bf->in_mapped = 0;
+}
+
+/**
+ * @brief Allocates the I/O buffers.
+ *
+ * Output is collected in a buffer of `size` bytes which is written when it is full,
+ * before input is read, and when the interpreter exits. In REPL mode it is also
+ * written after every newline. A size of 0 or 1 disables output buffering.
+ *
+ * Input is read in blocks of up to `size` bytes. Both buffers share a single
+ * allocation. Unless other callbacks are set afterwards, input is read from stdin
+ * and output is written to stdout. In REPL mode stdin is read through stdio a byte
+ * at a time instead, since the same stream also holds the program source.
+ *
+ * @param bf Pointer to the interpreter state.
+ * @param size Size of each buffer in bytes.
+ *
+ * @return Returns 0 on success, or 1 if the buffers cannot be allocated.
+ */
+int bfx_io_init(bfx_t* bf, size_t size) {
+    bf->io_size   = size > 0 ? size : 1;
+    bf->out_len   = 0;
+    bf->in_len    = 0;
+    bf->in_pos    = 0;
+    bf->in_read   = 0;
+    bf->in_mapped = 0;
+    bf->io.read   = BFX_IN_REPL_MODE(*bf) ? read_line : read_stdin;
+    bf->io.write  = write_stdout;
+    bf->io.data   = NULL;
+    if (!(bf->out = malloc(bf->io_size * 2))) {
+        return 1;
+    }
+    bf->in = bf->out + bf->io_size;
+    return 0;
+}
+
+/**
+ * @brief Reads input from a file instead of stdin.
+ *
+ * A regular file is mapped and becomes the input buffer, so `,` reads straight from
+ * the mapping and no read callback is used. Other files, such as pipes, are read in
+ * blocks like stdin, and replace it.
+ *
+ * @param bf Pointer to the interpreter state, whose buffers are allocated.
+ * @param path Path of the file.
+ *
+ * @return Returns BFX_STATUS_OK on success, or BFX_STATUS_IO_ERROR if the file cannot
+ *         be opened.
+ */
+int bfx_io_open(bfx_t* bf, const char* path) {
+    struct stat st;
+    int         fd;
+    int         ret;
+    void*       map;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        return BFX_STATUS_IO_ERROR;
+    }
+    if (fstat(fd, &st)) {
+        close(fd);
+        return BFX_STATUS_IO_ERROR;
+    }
+
+    /* an empty file cannot be mapped, but there is nothing to read from it either */
+    if (S_ISREG(st.st_mode) && st.st_size == 0) {
+        bf->io.read = NULL;
+        close(fd);
+        return BFX_STATUS_OK;
+    }
+    if (!S_ISREG(st.st_mode)
+        || (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        ret = dup2(fd, STDIN_FILENO) < 0 ? BFX_STATUS_IO_ERROR : BFX_STATUS_OK;
+        close(fd);
+        return ret;
+    }
+    close(fd);
+
+#ifdef MADV_SEQUENTIAL
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+#endif
+    bf->in        = map;
+    bf->in_len    = st.st_size;
+    bf->in_pos    = 0;
+    bf->in_read   = st.st_size;
+    bf->in_mapped = st.st_size;
+    bf->io.read   = NULL;
+    return BFX_STATUS_OK;
+}
+
+/**
+ * @brief Reads a byte of input.
+ *
+ * Pending output is flushed before blocking on a read, so an interactive program's
+ * prompt is shown before it waits for input.
+ *
+ * @param bf Pointer to the interpreter state.
+ *
+ * @return Returns the byte read, or EOF.
+ */
+int bfx_io_read(bfx_t* bf) {
+    size_t n;
+
+    if (bf->in_pos < bf->in_len) {
+        return bf->in[bf->in_pos++];
+    }
+
+    bfx_io_flush(bf);
+    if (!bf->io.read || (n = bf->io.read(bf->io.data, bf->in, bf->io_size)) == 0) {
+        return EOF;
+    }
+
+    bf->in_len = n;
+    bf->in_pos = 1;
+    bf->in_read += n;
+    return bf->in[0];
+}
+
+/**
+ * @brief Reads a byte from stdin through stdio.
+ */
+static size_t read_line(void* data, uint8_t* buf, size_t size) {
+    int c;
+
+    if ((c = getc(stdin)) == EOF) {
+        return 0;
+    }
+    buf[0] = c;
+    return 1;
+}
+
+/**
+ * @brief Reads a block from stdin.
+ */
+static size_t read_stdin(void* data, uint8_t* buf, size_t size) {
+    ssize_t n;
+
+    while ((n = read(STDIN_FILENO, buf, size)) < 0 && errno == EINTR) {
+    }
+    return n > 0 ? (size_t) n : 0;
+}
+
+/**
+ * @brief Writes a block to stdout.
+ *
+ * stdout is flushed, so the output is not held back by stdio's buffer as well.
+ */
+static size_t write_stdout(void* data, const uint8_t* buf, size_t len) {
+    len = fwrite(buf, 1, len, stdout);
+    fflush(stdout);
+    return len;
+}
@@ -0,0 +1,16 @@
+#ifndef BFX_IO_H
+#define BFX_IO_H
+
+#include "bfx.h"
+
+/* reads a byte for ',' straight from the input buffer, or calls bfx_getchar() */
+#define BFX_GETCHAR(bf, cell)                                                                      \
+    ((bf)->in_pos < (bf)->in_len ? (bf)->in[(bf)->in_pos++] : bfx_getchar((bf), (cell)))
+
+void bfx_io_flush(bfx_t*);
+void bfx_io_free(bfx_t*);
+int  bfx_io_init(bfx_t*, size_t);
+int  bfx_io_open(bfx_t*, const char*);
+int  bfx_io_read(bfx_t*);
+
+#endif
@@ -0,0 +1,1054 @@
+#include "jit.h"
+#include "fork.h"
+#include "interpret.h"
+#include "io.h"
+#include "scan.h"
+#include "tape.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__aarch64__)
+#define BFX_JIT_SUPPORTED
+#include <sys/mman.h>
+#endif
+
+/**
+ * @brief State shared between generated code and the helpers it calls.
+ *
+ * Generated code keeps the tape pointer and its maximum in registers and only
+ * writes them back here around helper calls and on return.
+ *
+ * @param bf Pointer to the interpreter state.
+ * @param program Pointer to the program being executed.
+ * @param tp Tape pointer.
+ * @param tp_max Maximum tape pointer value.
+ * @param stopped Set by a helper to make the code return at once, which it checks after
+ *                each 'Y' (see jit_fork()).
+ * @param counts Instructions and jumps run by code which counts them (see emit_count()),
+ *               added to `bf->counts` when it returns.
+ */
+typedef struct {
+    bfx_t*               bf;
+    const bfx_program_t* program;
+    long                 tp;
+    long                 tp_max;
+    long                 stopped;
+    bfx_counts_t         counts;
+} bfx_jit_context_t;
+
+#ifdef BFX_JIT_SUPPORTED
+
+#define CTX_TP      offsetof(bfx_jit_context_t, tp)
+#define CTX_TP_MAX  offsetof(bfx_jit_context_t, tp_max)
+#define CTX_STOPPED offsetof(bfx_jit_context_t, stopped)
+#define CTX_OPS     offsetof(bfx_jit_context_t, counts.ops)
+#define CTX_JZ      offsetof(bfx_jit_context_t, counts.jz)
+#define CTX_JNZ     offsetof(bfx_jit_context_t, counts.jnz)
+
+typedef void (*bfx_jit_fn)(bfx_jit_context_t*, uint8_t*, size_t);
+typedef void (*bfx_jit_helper_fn)(bfx_jit_context_t*, long);
+
+/**
+ * @brief Growable buffer of generated machine code.
+ * @param code Pointer to the code.
+ * @param len Number of bytes written.
+ * @param size Allocated size of the buffer.
+ * @param failed If the buffer could not be grown, in which case the code is incomplete.
+ */
+typedef struct {
+    uint8_t* code;
+    size_t   len;
+    size_t   size;
+    bool     failed;
+} bfx_jit_buffer_t;
+
+static bool can_enter(const bfx_program_t*, size_t);
+static void emit_call(bfx_jit_buffer_t*, bfx_jit_helper_fn, size_t);
+static void emit_count(bfx_jit_buffer_t*, const bfx_op_t*);
+static void emit_epilogue(bfx_jit_buffer_t*);
+static void emit_op(bfx_jit_buffer_t*, const bfx_op_t*, size_t, size_t*, bool, bool);
+static void emit_prologue(bfx_jit_buffer_t*);
+static void check_tp(bfx_jit_context_t*, long);
+static void jit_check(bfx_jit_context_t*, long);
+static void jit_debug(bfx_jit_context_t*, long);
+static void jit_fork(bfx_jit_context_t*, long);
+static void jit_in(bfx_jit_context_t*, long);
+static void jit_move(bfx_jit_context_t*, long);
+static void jit_offset(bfx_jit_context_t*, long);
+static void jit_out(bfx_jit_context_t*, long);
+static void jit_scan(bfx_jit_context_t*, long);
+static void link_jumps(bfx_jit_buffer_t*,
+                       const bfx_program_t*,
+                       size_t,
+                       size_t,
+                       const size_t*,
+                       const size_t*);
+static void put(bfx_jit_buffer_t*, const uint8_t*, size_t);
+static void put_u32(bfx_jit_buffer_t*, uint32_t);
+static void put_u64(bfx_jit_buffer_t*, uint64_t);
+
+#endif
+
+/**
+ * @brief Structure to represent code generated for a range of a program.
+ * @param mem Executable mapping holding the code.
+ * @param len Length of the mapping.
+ * @param starts Offset of the code of each instruction of the range within `mem`,
+ *               followed by the end of the code, for the tape's fault handler.
+ * @param start Index of the first instruction of the range.
+ * @param end Index of the instruction after the range.
+ */
+struct bfx_jit_code {
+    void*   mem;
+    size_t  len;
+    size_t* starts;
+    size_t  start;
+    size_t  end;
+};
+
+/**
+ * @brief Executes a program by compiling it to native machine code.
+ *
+ * The program is translated to x86-64 or AArch64 code in an executable mapping and
+ * run in-process. Cell arithmetic, pointer moves, jumps and CHECKs are generated inline;
+ * I/O, scans, '#', tape bound violations and failed CHECKs call back into the
+ * interpreter's helpers, so EOF behavior and tape warnings are the same as in
+ * bfx_execute(). On other architectures,
+ * or if no memory for the code can be allocated, the program is run by bfx_execute(), as are
+ * programs with cells wider than 8 bits. Code is only generated from `bf->ip` on, which
+ * must not be in a loop (see can_enter()), so that runs starting from a program's
+ * prefix are compiled too.
+ *
+ * With a growable tape, moves and cell offsets are generated without bounds checks:
+ * leaving the tape faults on a guard page, and the tape's fault handler finds the
+ * faulting instruction from the code offsets registered with bfx_tape_set_code().
+ *
+ * If `BFX_FLAG_STATS` is set, the code counts each instruction and jump it runs.
+ *
+ * @param bf Pointer to the interpreter state.
+ * @param program Pointer to the program to execute.
+ */
+void bfx_execute_jit(bfx_t* bf, const bfx_program_t* program) {
+#ifdef BFX_JIT_SUPPORTED
+    bfx_jit_code_t* code;
+
+    if (bf->cell_width == 8 && can_enter(program, bf->ip)
+        && (code = bfx_jit_compile(bf,
+                                   program,
+                                   bf->ip,
+                                   program->len,
+                                   bfx_jit_track(bf, program)))) {
+        bfx_jit_run(bf, program, code);
+        bfx_jit_free(code);
+        return;
+    }
+#endif
+    bfx_execute(bf, program);
+}
+
+/**
+ * @brief Compiles the instructions from `start` to just before `end` to native code.
+ *
+ * The range must be closed under jumps: every jump in it lands in it or just past
+ * it, as is the case for a whole loop or for the rest of a program from a point
+ * which is not in a loop. Code for a range which starts at a loop's opening jump can
+ * be entered whenever the interpreter reaches that jump, even from inside an outer
+ * loop, which is how bfx_execute_tiered() moves a running loop to native code.
+ *
+ * @param bf Pointer to the interpreter state the code will run with. Only its tape
+ *           kind, which decides whether bounds are checked, and `BFX_FLAG_STATS`, which
+ *           decides whether instructions are counted, matter.
+ * @param program Pointer to the program.
+ * @param start Index of the first instruction.
+ * @param end Index of the instruction after the last.
+ * @param track If the maximum tape pointer must be kept up to date even without bounds
+ *              checks (see bfx_jit_track()).
+ *
+ * @return Returns the code, or NULL if the machine is not supported, the cells are
+ *         wider than 8 bits, or memory for the code cannot be allocated.
+ */
+bfx_jit_code_t* bfx_jit_compile(const bfx_t*         bf,
+                                const bfx_program_t* program,
+                                size_t               start,
+                                size_t               end,
+                                bool                 track) {
+#ifdef BFX_JIT_SUPPORTED
+    bfx_jit_buffer_t buf;
+    bfx_jit_code_t*  code;
+    size_t*          starts;
+    size_t*          fixups;
+    void*            mem;
+    size_t           ip;
+    bool             checked;
+    bool             counted;
+
+    if (bf->cell_width != 8) {
+        return NULL;
+    }
+
+    buf.len    = 0;
+    buf.size   = BFX_INITIAL_PROGRAM_SIZE;
+    buf.code   = malloc(buf.size);
+    buf.failed = false;
+    code       = malloc(sizeof(bfx_jit_code_t));
+    starts     = malloc(sizeof(size_t) * (end - start + 1));
+    fixups     = malloc(sizeof(size_t) * (end - start));
+    if (!buf.code || !code || !starts || !fixups) {
+        free(buf.code);
+        free(code);
+        free(starts);
+        free(fixups);
+        return NULL;
+    }
+
+    checked = !bf->tape_guard;
+    counted = bf->flags & BFX_FLAG_STATS;
+    emit_prologue(&buf);
+    for (ip = start; ip < end; ip++) {
+        starts[ip - start] = buf.len;
+        if (counted) {
+            emit_count(&buf, &program->ops[ip]);
+        }
+        emit_op(&buf, &program->ops[ip], ip, &fixups[ip - start], checked, track || checked);
+    }
+    starts[end - start] = buf.len;
+    emit_epilogue(&buf);
+    mem = MAP_FAILED;
+    if (!buf.failed) {
+        link_jumps(&buf, program, start, end, starts, fixups);
+        mem = mmap(NULL, buf.len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    free(fixups);
+    if (mem == MAP_FAILED) {
+        free(buf.code);
+        free(code);
+        free(starts);
+        return NULL;
+    }
+    memcpy(mem, buf.code, buf.len);
+    free(buf.code);
+    if (mprotect(mem, buf.len, PROT_READ | PROT_EXEC)) {
+        munmap(mem, buf.len);
+        free(code);
+        free(starts);
+        return NULL;
+    }
+#ifdef __aarch64__
+    __builtin___clear_cache((char*) mem, (char*) mem + buf.len);
+#endif
+
+    code->mem    = mem;
+    code->len    = buf.len;
+    code->starts = starts;
+    code->start  = start;
+    code->end    = end;
+    return code;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * @brief Frees code from bfx_jit_compile().
+ * @param code Pointer to the code, or NULL.
+ */
+void bfx_jit_free(bfx_jit_code_t* code) {
+#ifdef BFX_JIT_SUPPORTED
+    if (code) {
+        munmap(code->mem, code->len);
+        free(code->starts);
+        free(code);
+    }
+#endif
+}
+
+/**
+ * @brief Checks if code generated for a program must keep the maximum tape pointer up
+ * to date even where it does not check bounds, which only '#', 'Y' and the report of
+ * bfx_stats() need.
+ *
+ * This scans the whole program, so callers which compile many ranges of it call this
+ * once and pass the result to every bfx_jit_compile().
+ *
+ * @param bf Pointer to the interpreter state.
+ * @param program Pointer to the program.
+ */
+bool bfx_jit_track(const bfx_t* bf, const bfx_program_t* program) {
+    size_t ip;
+
+    if (bf->flags & BFX_FLAG_STATS) {
+        return true;
+    }
+    for (ip = 0; ip < program->len; ip++) {
+        if (program->ops[ip].op == BFX_OP_DEBUG || program->ops[ip].op == BFX_OP_FORK) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Runs code from bfx_jit_compile() from the start of its range, leaving `bf->ip`
+ * just past it, or at the end of the program if a 'Y' stopped the run.
+ *
+ * @param bf Pointer to the interpreter state.
+ * @param program Pointer to the program the code was compiled from.
+ * @param code Pointer to the code.
+ */
+void bfx_jit_run(bfx_t* bf, const bfx_program_t* program, const bfx_jit_code_t* code) {
+#ifdef BFX_JIT_SUPPORTED
+    bfx_jit_context_t ctx;
+    bfx_jit_fn        fn;
+
+    ctx.bf      = bf;
+    ctx.program = program;
+    ctx.tp      = bf->tp;
+    ctx.tp_max  = bf->tp_max;
+    ctx.stopped = 0;
+    memset(&ctx.counts, 0, sizeof(ctx.counts));
+
+    /* ISO C has no conversion from object to function pointers */
+    memcpy(&fn, &code->mem, sizeof(fn));
+    /* only a growable tape's fault handler needs the code, and it serves a single run */
+    if (bf->tape_guard) {
+        bfx_tape_set_code(code->mem, code->starts, code->start, code->end - code->start);
+    }
+    fn(&ctx, bf->tape, bf->tape_size);
+    if (bf->tape_guard) {
+        bfx_tape_set_code(NULL, NULL, 0, 0);
+    }
+
+    bf->ip     = ctx.stopped ? program->len : code->end;
+    bf->tp     = ctx.tp;
+    bf->tp_max = ctx.tp_max;
+    bf->counts.ops += ctx.counts.ops;
+    bf->counts.jz += ctx.counts.jz;
+    bf->counts.jnz += ctx.counts.jnz;
+#endif
+}
+
+#ifdef BFX_JIT_SUPPORTED
+
+/**
+ * @brief Checks if generated code can start at an instruction, which it cannot if the
+ * instruction is in a loop or guarded by a CHECK before it.
+ */
+static bool can_enter(const bfx_program_t* program, size_t start) {
+    size_t ip;
+
+    for (ip = 0; ip < start; ip++) {
+        if ((program->ops[ip].op == BFX_OP_JZ && (size_t) program->ops[ip].arg >= start)
+            || (program->ops[ip].op == BFX_OP_CHECK
+                && bfx_program_check_end(program, ip) >= start)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Catches a cell outside the tape before a helper uses it.
+ *
+ * This can only happen with a growable tape, where moves and CHECKs are not generated.
+ */
+static void check_tp(bfx_jit_context_t* ctx, long ip) {
+    long cell;
+
+    cell = ctx->tp + ctx->program->ops[ip].offset;
+    if (cell < 0 || (size_t) cell >= ctx->bf->tape_size) {
+        ctx->tp = bfx_move_warning(ctx->bf, ctx->program, ip, cell);
+    }
+}
+
+/**
+ * @brief Runs the instructions guarded by a failed CHECK with bfx_unfold(). The generated
+ * code then jumps past them.
+ */
+static void jit_check(bfx_jit_context_t* ctx, long ip) {
+    ctx->bf->tp     = ctx->tp;
+    ctx->bf->tp_max = ctx->tp_max;
+    bfx_unfold(ctx->bf, ctx->program, ip);
+    ctx->tp     = ctx->bf->tp;
+    ctx->tp_max = ctx->bf->tp_max;
+}
+
+static void jit_debug(bfx_jit_context_t* ctx, long ip) {
+    check_tp(ctx, ip);
+    ctx->bf->tp     = ctx->tp;
+    ctx->bf->tp_max = ctx->tp_max;
+    ctx->bf->ip     = ctx->program->index[ip].idx;
+    bfx_diagnose(ctx->bf, &ctx->program->index[ip]);
+}
+
+/**
+ * @brief Forks a thread with bfx_fork(), which copies the cells up to `tp_max`, then
+ * zeroes the current cell. If the child cannot be created, the code is stopped instead.
+ */
+static void jit_fork(bfx_jit_context_t* ctx, long ip) {
+    check_tp(ctx, ip);
+    ctx->bf->tp     = ctx->tp;
+    ctx->bf->tp_max = ctx->tp_max;
+    if (bfx_fork(ctx->bf, ctx->program, ip)) {
+        ctx->stopped = 1;
+        return;
+    }
+    ctx->bf->tape[ctx->tp] = 0;
+}
+
+static void jit_in(bfx_jit_context_t* ctx, long ip) {
+    long cell;
+
+    check_tp(ctx, ip);
+    cell                 = ctx->tp + ctx->program->ops[ip].offset;
+    ctx->bf->tape[cell] = BFX_GETCHAR(ctx->bf, ctx->bf->tape[cell]);
+}
+
+static void jit_move(bfx_jit_context_t* ctx, long ip) {
+    ctx->tp = bfx_move_warning(ctx->bf, ctx->program, ip, ctx->tp);
+}
+
+static void jit_offset(bfx_jit_context_t* ctx, long ip) {
+    bfx_offset_warning(ctx->program, ip, ctx->tp + ctx->program->ops[ip].offset);
+}
+
+static void jit_out(bfx_jit_context_t* ctx, long ip) {
+    const bfx_op_t* op;
+
+    check_tp(ctx, ip);
+    op = &ctx->program->ops[ip];
+    if (op->arg == 1) {
+        bfx_putchar(ctx->bf, ctx->bf->tape[ctx->tp + op->offset]);
+    } else {
+        bfx_putchars(ctx->bf, ctx->bf->tape[ctx->tp + op->offset], op->arg);
+    }
+}
+
+static void jit_scan(bfx_jit_context_t* ctx, long ip) {
+    int stride;
+    int cell;
+
+    check_tp(ctx, ip);
+    stride = ctx->program->ops[ip].arg;
+    while ((cell = bfx_scan(ctx->bf->tape, ctx->tp, stride, ctx->bf->tape_size)) < 0) {
+        if (stride > 0) {
+            ctx->tp_max = ctx->bf->tape_size - 1;
+        }
+        ctx->tp = bfx_move_warning(ctx->bf, ctx->program, ip, stride);
+    }
+    ctx->tp = cell;
+    if (ctx->tp > ctx->tp_max) {
+        ctx->tp_max = ctx->tp;
+    }
+}
+
+/**
+ * @brief Appends bytes to a code buffer.
+ */
+static void put(bfx_jit_buffer_t* buf, const uint8_t* bytes, size_t len) {
+    uint8_t* code;
+
+    if (buf->failed) {
+        return;
+    }
+    if (buf->len + len > buf->size) {
+        if (!(code = realloc(buf->code, buf->size * 2))) {
+            buf->failed = true;
+            return;
+        }
+        buf->code = code;
+        buf->size *= 2;
+    }
+    memcpy(buf->code + buf->len, bytes, len);
+    buf->len += len;
+}
+
+/**
+ * @brief Appends a little-endian 32-bit value to a code buffer.
+ */
+static void put_u32(bfx_jit_buffer_t* buf, uint32_t v) {
+    uint8_t bytes[4];
+
+    bytes[0] = v;
+    bytes[1] = v >> 8;
+    bytes[2] = v >> 16;
+    bytes[3] = v >> 24;
+    put(buf, bytes, 4);
+}
+
+/**
+ * @brief Appends a little-endian 64-bit value to a code buffer.
+ */
+static void put_u64(bfx_jit_buffer_t* buf, uint64_t v) {
+    put_u32(buf, v);
+    put_u32(buf, v >> 32);
+}
+
+#if defined(__x86_64__)
+
+/*
+ * Register use: r13 = context, rbx = tape, r12 = tape pointer, r14 = maximum tape pointer,
+ * r15 = tape size. All of them are callee-saved, so they survive helper calls.
+ */
+
+#define X86_CALL_LEN 36
+
+static void emit_prologue(bfx_jit_buffer_t* buf) {
+    static const uint8_t code[] = {
+        0x53,                   /* push rbx */
+        0x55,                   /* push rbp */
+        0x41, 0x54,             /* push r12 */
+        0x41, 0x55,             /* push r13 */
+        0x41, 0x56,             /* push r14 */
+        0x41, 0x57,             /* push r15 */
+        0x48, 0x83, 0xEC, 0x08, /* sub rsp, 8 */
+        0x49, 0x89, 0xFD,       /* mov r13, rdi */
+        0x48, 0x89, 0xF3,       /* mov rbx, rsi */
+        0x49, 0x89, 0xD7,       /* mov r15, rdx */
+        0x4D, 0x8B, 0x65, CTX_TP,     /* mov r12, [r13 + tp] */
+        0x4D, 0x8B, 0x75, CTX_TP_MAX, /* mov r14, [r13 + tp_max] */
+    };
+    put(buf, code, sizeof(code));
+}
+
+static void emit_epilogue(bfx_jit_buffer_t* buf) {
+    static const uint8_t code[] = {
+        0x4D, 0x89, 0x65, CTX_TP,     /* mov [r13 + tp], r12 */
+        0x4D, 0x89, 0x75, CTX_TP_MAX, /* mov [r13 + tp_max], r14 */
+        0x48, 0x83, 0xC4, 0x08,       /* add rsp, 8 */
+        0x41, 0x5F,                   /* pop r15 */
+        0x41, 0x5E,                   /* pop r14 */
+        0x41, 0x5D,                   /* pop r13 */
+        0x41, 0x5C,                   /* pop r12 */
+        0x5D,                         /* pop rbp */
+        0x5B,                         /* pop rbx */
+        0xC3,                         /* ret */
+    };
+    put(buf, code, sizeof(code));
+}
+
+/**
+ * @brief Emits a call to helper(ctx, ip). Always X86_CALL_LEN bytes long.
+ */
+static void emit_call(bfx_jit_buffer_t* buf, bfx_jit_helper_fn helper, size_t ip) {
+    static const uint8_t save[] = {
+        0x4D, 0x89, 0x65, CTX_TP,     /* mov [r13 + tp], r12 */
+        0x4D, 0x89, 0x75, CTX_TP_MAX, /* mov [r13 + tp_max], r14 */
+        0x4C, 0x89, 0xEF,             /* mov rdi, r13 */
+        0xBE,                         /* mov esi, imm32 */
+    };
+    static const uint8_t call[] = {
+        0xFF, 0xD0,                   /* call rax */
+        0x4D, 0x8B, 0x65, CTX_TP,     /* mov r12, [r13 + tp] */
+        0x4D, 0x8B, 0x75, CTX_TP_MAX, /* mov r14, [r13 + tp_max] */
+    };
+    static const uint8_t mov_rax[] = { 0x48, 0xB8 }; /* mov rax, imm64 */
+
+    put(buf, save, sizeof(save));
+    put_u32(buf, ip);
+    put(buf, mov_rax, sizeof(mov_rax));
+    put_u64(buf, (uint64_t) (uintptr_t) helper);
+    put(buf, call, sizeof(call));
+}
+
+/**
+ * @brief Emits code which counts an instruction, and the test of a jump, in the context.
+ */
+static void emit_count(bfx_jit_buffer_t* buf, const bfx_op_t* op) {
+    uint8_t inc[] = { 0x49, 0xFF, 0x45, CTX_OPS }; /* inc qword [r13 + ops] */
+
+    put(buf, inc, sizeof(inc));
+    if (op->op == BFX_OP_JZ || op->op == BFX_OP_JNZ) {
+        inc[3] = op->op == BFX_OP_JZ ? CTX_JZ : CTX_JNZ;
+        put(buf, inc, sizeof(inc));
+    }
+}
+
+/**
+ * @brief Emits the code of an instruction.
+ * @param checked If moves and cell offsets are checked against the tape size.
+ * @param track If the maximum tape pointer is tracked on unchecked moves.
+ */
+static void emit_op(bfx_jit_buffer_t* buf,
+                    const bfx_op_t*   op,
+                    size_t            ip,
+                    size_t*           fixup,
+                    bool              checked,
+                    bool              track) {
+    static const uint8_t add[]       = { 0x42, 0x80, 0x04, 0x23 };       /* add [rbx+r12], imm8 */
+    static const uint8_t add_off[]   = { 0x42, 0x80, 0x84, 0x23 }; /* add [rbx+r12+disp32], imm8 */
+    static const uint8_t set[]       = { 0x42, 0xC6, 0x04, 0x23 };       /* mov [rbx+r12], imm8 */
+    static const uint8_t set_off[]   = { 0x42, 0xC6, 0x84, 0x23 }; /* mov [rbx+r12+disp32], imm8 */
+    static const uint8_t test[]      = { 0x42, 0x80, 0x3C, 0x23, 0x00 }; /* cmp [rbx+r12], 0 */
+    static const uint8_t jz[]        = { 0x0F, 0x84 };                   /* je rel32 */
+    static const uint8_t jnz[]       = { 0x0F, 0x85 };                   /* jne rel32 */
+    static const uint8_t move[]      = { 0x49, 0x81, 0xC4 };             /* add r12, imm32 */
+    static const uint8_t move_chk[]  = { 0x4D, 0x39, 0xFC };             /* cmp r12, r15 */
+    static const uint8_t move_max[]  = {
+        0x4D, 0x39, 0xF4, /* ok: cmp r12, r14 */
+        0x7E, 0x03,       /* jle done */
+        0x4D, 0x89, 0xE6, /* mov r14, r12 */
+    };
+    static const uint8_t mul_load[]  = {
+        0x42, 0x0F, 0xB6, 0x04, 0x23, /* movzx eax, byte [rbx+r12] */
+        0x84, 0xC0,                   /* test al, al */
+    };
+    static const uint8_t lea[]       = { 0x49, 0x8D, 0x8C, 0x24 }; /* lea rcx, [r12+disp32] */
+    static const uint8_t lea_min[]   = { 0x49, 0x8D, 0x84, 0x24 }; /* lea rax, [r12+disp32] */
+    static const uint8_t chk_min[]   = {
+        0x4C, 0x39, 0xF8,                         /* cmp rax, r15 */
+        0x73, sizeof(lea) + 4 + 3 + 2,            /* jae fail */
+    };
+    static const uint8_t chk_max[]   = {
+        0x4C, 0x39, 0xF9,       /* cmp rcx, r15 */
+        0x72, X86_CALL_LEN + 5, /* jb ok */
+    };
+    static const uint8_t chk_fail[]  = { 0xE9 }; /* fail: (call) jmp rel32 */
+    static const uint8_t mul_chk[]   = {
+        0x4C, 0x39, 0xF9,       /* cmp rcx, r15 */
+        0x72, X86_CALL_LEN + 2, /* jb ok */
+    };
+    static const uint8_t imul[]      = { 0x69, 0xC0 }; /* imul eax, eax, imm32 */
+    static const uint8_t stopped[]   = {
+        0x49, 0x83, 0x7D, CTX_STOPPED, 0x00, /* cmp qword [r13 + stopped], 0 */
+        0x74, 0x05,                          /* je ok */
+        0xE9,                                /* jmp rel32 */
+    };
+    static const uint8_t mul_store[] = {
+        0x00, 0x04, 0x0B, /* add [rbx+rcx], al */
+        0x4C, 0x39, 0xF1, /* cmp rcx, r14 */
+        0x7E, 0x03,       /* jle skip */
+        0x49, 0x89, 0xCE, /* mov r14, rcx */
+    };
+    static const uint8_t max_rcx[]   = {
+        0x4C, 0x39, 0xF1, /* cmp rcx, r14 */
+        0x7E, 0x03,       /* jle done */
+        0x49, 0x89, 0xCE, /* mov r14, rcx */
+    };
+    uint8_t jmp[2];
+    uint8_t imm;
+
+    switch (op->op) {
+    case BFX_OP_ADD:
+        imm = op->arg;
+        if (op->offset) {
+            put(buf, add_off, sizeof(add_off));
+            put_u32(buf, op->offset);
+        } else {
+            put(buf, add, sizeof(add));
+        }
+        put(buf, &imm, 1);
+        break;
+    case BFX_OP_SET:
+        imm = op->arg;
+        if (op->offset) {
+            put(buf, set_off, sizeof(set_off));
+            put_u32(buf, op->offset);
+        } else {
+            put(buf, set, sizeof(set));
+        }
+        put(buf, &imm, 1);
+        break;
+    case BFX_OP_CHECK:
+        /* without bounds checks there is nothing to jump past, which link_jumps() sees */
+        *fixup = 0;
+        if (!checked) {
+            if (track) {
+                put(buf, lea, sizeof(lea));
+                put_u32(buf, op->offset);
+                put(buf, max_rcx, sizeof(max_rcx));
+            }
+            break;
+        }
+        put(buf, lea_min, sizeof(lea_min));
+        put_u32(buf, op->arg);
+        put(buf, chk_min, sizeof(chk_min));
+        put(buf, lea, sizeof(lea));
+        put_u32(buf, op->offset);
+        put(buf, chk_max, sizeof(chk_max));
+        emit_call(buf, jit_check, ip);
+        put(buf, chk_fail, sizeof(chk_fail));
+        *fixup = buf->len;
+        put_u32(buf, 0);
+        put(buf, max_rcx, sizeof(max_rcx));
+        break;
+    case BFX_OP_MOVE:
+        put(buf, move, sizeof(move));
+        put_u32(buf, op->arg);
+        if (!checked) {
+            if (op->arg > 0 && track) {
+                put(buf, move_max, sizeof(move_max));
+            }
+            break;
+        }
+        put(buf, move_chk, sizeof(move_chk));
+        jmp[0] = 0x72; /* jb ok */
+        jmp[1] = op->arg > 0 ? X86_CALL_LEN + 2 : X86_CALL_LEN;
+        put(buf, jmp, 2);
+        emit_call(buf, jit_move, ip);
+        if (op->arg > 0) {
+            jmp[0] = 0xEB; /* jmp done */
+            jmp[1] = sizeof(move_max);
+            put(buf, jmp, 2);
+            put(buf, move_max, sizeof(move_max));
+        }
+        break;
+    case BFX_OP_JZ:
+    case BFX_OP_JNZ:
+        put(buf, test, sizeof(test));
+        put(buf, op->op == BFX_OP_JZ ? jz : jnz, 2);
+        *fixup = buf->len;
+        put_u32(buf, 0);
+        break;
+    case BFX_OP_MULADD:
+        put(buf, mul_load, sizeof(mul_load));
+        if (!checked) {
+            jmp[0] = 0x74; /* jz skip */
+            jmp[1] = sizeof(lea) + 4 + sizeof(imul) + 4 + sizeof(mul_store);
+            put(buf, jmp, 2);
+            put(buf, lea, sizeof(lea));
+            put_u32(buf, op->offset);
+            put(buf, imul, sizeof(imul));
+            put_u32(buf, op->arg);
+            put(buf, mul_store, sizeof(mul_store));
+            break;
+        }
+        jmp[0] = 0x74; /* jz skip */
+        jmp[1] = sizeof(lea) + 4 + sizeof(mul_chk) + X86_CALL_LEN + 2 + sizeof(imul) + 4
+                 + sizeof(mul_store);
+        put(buf, jmp, 2);
+        put(buf, lea, sizeof(lea));
+        put_u32(buf, op->offset);
+        put(buf, mul_chk, sizeof(mul_chk));
+        emit_call(buf, jit_offset, ip);
+        jmp[0] = 0xEB; /* jmp skip */
+        jmp[1] = sizeof(imul) + 4 + sizeof(mul_store);
+        put(buf, jmp, 2);
+        put(buf, imul, sizeof(imul));
+        put_u32(buf, op->arg);
+        put(buf, mul_store, sizeof(mul_store));
+        break;
+    case BFX_OP_IN:
+        emit_call(buf, jit_in, ip);
+        break;
+    case BFX_OP_OUT:
+        emit_call(buf, jit_out, ip);
+        break;
+    case BFX_OP_DEBUG:
+        emit_call(buf, jit_debug, ip);
+        break;
+    case BFX_OP_FORK:
+        emit_call(buf, jit_fork, ip);
+        put(buf, stopped, sizeof(stopped));
+        *fixup = buf->len;
+        put_u32(buf, 0);
+        break;
+    case BFX_OP_SCAN:
+        emit_call(buf, jit_scan, ip);
+        break;
+    }
+}
+
+static void link_jumps(bfx_jit_buffer_t*    buf,
+                       const bfx_program_t* program,
+                       size_t               start,
+                       size_t               end,
+                       const size_t*        starts,
+                       const size_t*        fixups) {
+    size_t   ip;
+    size_t   target;
+    size_t   fixup;
+    uint32_t rel;
+
+    for (ip = start; ip < end; ip++) {
+        if (program->ops[ip].op == BFX_OP_JZ || program->ops[ip].op == BFX_OP_JNZ
+            || program->ops[ip].op == BFX_OP_FORK
+            || (program->ops[ip].op == BFX_OP_CHECK && fixups[ip - start])) {
+            /* jumps land just past the matching bracket, failed checks past what they
+               guard, and stopped forks at the end of the code */
+            if (program->ops[ip].op == BFX_OP_FORK) {
+                target = end - 1;
+            } else if (program->ops[ip].op == BFX_OP_CHECK) {
+                target = bfx_program_check_end(program, ip);
+            } else {
+                target = program->ops[ip].arg;
+            }
+            fixup = fixups[ip - start];
+            rel   = starts[target + 1 - start] - (fixup + 4);
+            buf->code[fixup]     = rel;
+            buf->code[fixup + 1] = rel >> 8;
+            buf->code[fixup + 2] = rel >> 16;
+            buf->code[fixup + 3] = rel >> 24;
+        }
+    }
+}
+
+#elif defined(__aarch64__)
+
+/*
+ * Register use: x19 = context, x20 = tape, x21 = tape pointer, x22 = maximum tape pointer,
+ * x23 = tape size. All of them are callee-saved, so they survive helper calls. w0-w2, x9
+ * and x16 are scratch.
+ */
+
+#define A64_CALL_LEN 48
+
+#define A64_ADD_IMM(rd, rn, imm)  (0x91000000 | (uint32_t) (imm) << 10 | (rn) << 5 | (rd))
+#define A64_ADD_REG(rd, rn, rm)   (0x8B000000 | (rm) << 16 | (rn) << 5 | (rd))
+#define A64_ADD_W(rd, rn, rm)     (0x0B000000 | (rm) << 16 | (rn) << 5 | (rd))
+#define A64_ADD_W_IMM(rd, rn, im) (0x11000000 | (uint32_t) (im) << 10 | (rn) << 5 | (rd))
+#define A64_B(off)                (0x14000000 | ((uint32_t) (off) >> 2 & 0x3FFFFFF))
+#define A64_B_COND(cond, off)     (0x54000000 | ((uint32_t) (off) >> 2 & 0x7FFFF) << 5 | (cond))
+#define A64_CBNZ_W(rt, off)       (0x35000000 | ((uint32_t) (off) >> 2 & 0x7FFFF) << 5 | (rt))
+#define A64_CBZ_W(rt, off)        (0x34000000 | ((uint32_t) (off) >> 2 & 0x7FFFF) << 5 | (rt))
+#define A64_CMP(rn, rm)           (0xEB00001F | (rm) << 16 | (rn) << 5)
+#define A64_LDR_CTX(rt, off)      (0xF9400000 | (uint32_t) ((off) / 8) << 10 | 19 << 5 | (rt))
+#define A64_LDRB(rt, rn, rm)      (0x38606800 | (rm) << 16 | (rn) << 5 | (rt))
+#define A64_MOV(rd, rm)           (0xAA0003E0 | (rm) << 16 | (rd))
+#define A64_MOVK(rd, imm, hw) \
+    (0xF2800000 | (uint32_t) (hw) << 21 | (uint32_t) (imm) << 5 | (rd))
+#define A64_MOVZ(rd, imm, hw) \
+    (0xD2800000 | (uint32_t) (hw) << 21 | (uint32_t) (imm) << 5 | (rd))
+#define A64_MOVZ_W(rd, imm)       (0x52800000 | (uint32_t) (imm) << 5 | (rd))
+#define A64_MUL_W(rd, rn, rm)     (0x1B007C00 | (rm) << 16 | (rn) << 5 | (rd))
+#define A64_STR_CTX(rt, off)      (0xF9000000 | (uint32_t) ((off) / 8) << 10 | 19 << 5 | (rt))
+#define A64_STRB(rt, rn, rm)      (0x38206800 | (rm) << 16 | (rn) << 5 | (rt))
+#define A64_SUB_IMM(rd, rn, imm)  (0xD1000000 | (uint32_t) (imm) << 10 | (rn) << 5 | (rd))
+
+#define A64_COND_HS 2
+#define A64_COND_LO 3
+#define A64_COND_LE 13
+
+static void emit_mov_imm(bfx_jit_buffer_t*, int, uint64_t);
+
+static void emit_prologue(bfx_jit_buffer_t* buf) {
+    put_u32(buf, 0xA9BC7BFD); /* stp x29, x30, [sp, #-64]! */
+    put_u32(buf, 0x910003FD); /* mov x29, sp */
+    put_u32(buf, 0xA90153F3); /* stp x19, x20, [sp, #16] */
+    put_u32(buf, 0xA9025BF5); /* stp x21, x22, [sp, #32] */
+    put_u32(buf, 0xF9001BF7); /* str x23, [sp, #48] */
+    put_u32(buf, A64_MOV(19, 0));
+    put_u32(buf, A64_MOV(20, 1));
+    put_u32(buf, A64_MOV(23, 2));
+    put_u32(buf, A64_LDR_CTX(21, CTX_TP));
+    put_u32(buf, A64_LDR_CTX(22, CTX_TP_MAX));
+}
+
+static void emit_epilogue(bfx_jit_buffer_t* buf) {
+    put_u32(buf, A64_STR_CTX(21, CTX_TP));
+    put_u32(buf, A64_STR_CTX(22, CTX_TP_MAX));
+    put_u32(buf, 0xF9401BF7); /* ldr x23, [sp, #48] */
+    put_u32(buf, 0xA9425BF5); /* ldp x21, x22, [sp, #32] */
+    put_u32(buf, 0xA94153F3); /* ldp x19, x20, [sp, #16] */
+    put_u32(buf, 0xA8C47BFD); /* ldp x29, x30, [sp], #64 */
+    put_u32(buf, 0xD65F03C0); /* ret */
+}
+
+/**
+ * @brief Loads a 64-bit immediate with a fixed-length movz/movk sequence.
+ */
+static void emit_mov_imm(bfx_jit_buffer_t* buf, int rd, uint64_t imm) {
+    put_u32(buf, A64_MOVZ(rd, imm & 0xFFFF, 0));
+    put_u32(buf, A64_MOVK(rd, imm >> 16 & 0xFFFF, 1));
+    put_u32(buf, A64_MOVK(rd, imm >> 32 & 0xFFFF, 2));
+    put_u32(buf, A64_MOVK(rd, imm >> 48 & 0xFFFF, 3));
+}
+
+/**
+ * @brief Emits a call to helper(ctx, ip). Always A64_CALL_LEN bytes long.
+ */
+static void emit_call(bfx_jit_buffer_t* buf, bfx_jit_helper_fn helper, size_t ip) {
+    put_u32(buf, A64_STR_CTX(21, CTX_TP));
+    put_u32(buf, A64_STR_CTX(22, CTX_TP_MAX));
+    put_u32(buf, A64_MOV(0, 19));
+    put_u32(buf, A64_MOVZ(1, ip & 0xFFFF, 0));
+    put_u32(buf, A64_MOVK(1, ip >> 16 & 0xFFFF, 1));
+    emit_mov_imm(buf, 16, (uint64_t) (uintptr_t) helper);
+    put_u32(buf, 0xD63F0200); /* blr x16 */
+    put_u32(buf, A64_LDR_CTX(21, CTX_TP));
+    put_u32(buf, A64_LDR_CTX(22, CTX_TP_MAX));
+}
+
+/**
+ * @brief Emits code which counts an instruction, and the test of a jump, in the context.
+ */
+static void emit_count(bfx_jit_buffer_t* buf, const bfx_op_t* op) {
+    put_u32(buf, A64_LDR_CTX(9, CTX_OPS));
+    put_u32(buf, A64_ADD_IMM(9, 9, 1));
+    put_u32(buf, A64_STR_CTX(9, CTX_OPS));
+    if (op->op == BFX_OP_JZ || op->op == BFX_OP_JNZ) {
+        put_u32(buf, A64_LDR_CTX(9, op->op == BFX_OP_JZ ? CTX_JZ : CTX_JNZ));
+        put_u32(buf, A64_ADD_IMM(9, 9, 1));
+        put_u32(buf, A64_STR_CTX(9, op->op == BFX_OP_JZ ? CTX_JZ : CTX_JNZ));
+    }
+}
+
+/**
+ * @brief Emits the code of an instruction.
+ * @param checked If moves and cell offsets are checked against the tape size.
+ * @param track If the maximum tape pointer is tracked on unchecked moves.
+ */
+static void emit_op(bfx_jit_buffer_t* buf,
+                    const bfx_op_t*   op,
+                    size_t            ip,
+                    size_t*           fixup,
+                    bool              checked,
+                    bool              track) {
+    int cell;
+
+    /* cells at an offset are addressed through x1 */
+    cell = 21;
+    if ((op->op == BFX_OP_ADD || op->op == BFX_OP_SET) && op->offset) {
+        emit_mov_imm(buf, 9, (uint64_t) (int64_t) op->offset);
+        put_u32(buf, A64_ADD_REG(1, 21, 9));
+        cell = 1;
+    }
+
+    switch (op->op) {
+    case BFX_OP_ADD:
+        put_u32(buf, A64_LDRB(0, 20, cell));
+        put_u32(buf, A64_ADD_W_IMM(0, 0, op->arg & 0xFF));
+        put_u32(buf, A64_STRB(0, 20, cell));
+        break;
+    case BFX_OP_SET:
+        put_u32(buf, A64_MOVZ_W(0, op->arg & 0xFF));
+        put_u32(buf, A64_STRB(0, 20, cell));
+        break;
+    case BFX_OP_CHECK:
+        /* without bounds checks there is nothing to jump past, which link_jumps() sees */
+        *fixup = 0;
+        if (checked) {
+            emit_mov_imm(buf, 9, (uint64_t) (int64_t) op->arg);
+            put_u32(buf, A64_ADD_REG(1, 21, 9));
+            put_u32(buf, A64_CMP(1, 23));
+            put_u32(buf, A64_B_COND(A64_COND_HS, 4 + 16 + 4 + 4 + 4));
+        } else if (!track) {
+            break;
+        }
+        emit_mov_imm(buf, 9, (uint64_t) (int64_t) op->offset);
+        put_u32(buf, A64_ADD_REG(1, 21, 9));
+        if (checked) {
+            put_u32(buf, A64_CMP(1, 23));
+            put_u32(buf, A64_B_COND(A64_COND_LO, 4 + A64_CALL_LEN + 4));
+            emit_call(buf, jit_check, ip);
+            *fixup = buf->len;
+            put_u32(buf, A64_B(0));
+        }
+        put_u32(buf, A64_CMP(1, 22));
+        put_u32(buf, A64_B_COND(A64_COND_LE, 8));
+        put_u32(buf, A64_MOV(22, 1));
+        break;
+    case BFX_OP_MOVE:
+        emit_mov_imm(buf, 9, (uint64_t) (int64_t) op->arg);
+        put_u32(buf, A64_ADD_REG(21, 21, 9));
+        if (!checked) {
+            if (op->arg > 0 && track) {
+                put_u32(buf, A64_CMP(21, 22));
+                put_u32(buf, A64_B_COND(A64_COND_LE, 8));
+                put_u32(buf, A64_MOV(22, 21));
+            }
+            break;
+        }
+        put_u32(buf, A64_CMP(21, 23));
+        put_u32(buf,
+                A64_B_COND(A64_COND_LO, op->arg > 0 ? 4 + A64_CALL_LEN + 4 : 4 + A64_CALL_LEN));
+        emit_call(buf, jit_move, ip);
+        if (op->arg > 0) {
+            put_u32(buf, A64_B(4 + 12));
+            put_u32(buf, A64_CMP(21, 22));
+            put_u32(buf, A64_B_COND(A64_COND_LE, 8));
+            put_u32(buf, A64_MOV(22, 21));
+        }
+        break;
+    case BFX_OP_JZ:
+    case BFX_OP_JNZ:
+        put_u32(buf, A64_LDRB(0, 20, 21));
+        put_u32(buf, op->op == BFX_OP_JZ ? A64_CBNZ_W(0, 8) : A64_CBZ_W(0, 8));
+        *fixup = buf->len;
+        put_u32(buf, A64_B(0));
+        break;
+    case BFX_OP_MULADD:
+        put_u32(buf, A64_LDRB(0, 20, 21));
+        if (checked) {
+            put_u32(buf, A64_CBZ_W(0, 4 + 16 + 4 + 4 + 4 + A64_CALL_LEN + 4 + 16 + 28));
+        } else {
+            put_u32(buf, A64_CBZ_W(0, 4 + 16 + 4 + 16 + 28));
+        }
+        emit_mov_imm(buf, 9, (uint64_t) (int64_t) op->offset);
+        put_u32(buf, A64_ADD_REG(1, 21, 9));
+        if (checked) {
+            put_u32(buf, A64_CMP(1, 23));
+            put_u32(buf, A64_B_COND(A64_COND_LO, 4 + A64_CALL_LEN + 4));
+            emit_call(buf, jit_offset, ip);
+            put_u32(buf, A64_B(4 + 16 + 28));
+        }
+        emit_mov_imm(buf, 9, (uint64_t) (uint32_t) op->arg);
+        put_u32(buf, A64_MUL_W(0, 0, 9));
+        put_u32(buf, A64_LDRB(2, 20, 1));
+        put_u32(buf, A64_ADD_W(2, 2, 0));
+        put_u32(buf, A64_STRB(2, 20, 1));
+        put_u32(buf, A64_CMP(1, 22));
+        put_u32(buf, A64_B_COND(A64_COND_LE, 8));
+        put_u32(buf, A64_MOV(22, 1));
+        break;
+    case BFX_OP_IN:
+        emit_call(buf, jit_in, ip);
+        break;
+    case BFX_OP_OUT:
+        emit_call(buf, jit_out, ip);
+        break;
+    case BFX_OP_DEBUG:
+        emit_call(buf, jit_debug, ip);
+        break;
+    case BFX_OP_FORK:
+        emit_call(buf, jit_fork, ip);
+        put_u32(buf, A64_LDR_CTX(9, CTX_STOPPED));
+        put_u32(buf, A64_CBZ_W(9, 8));
+        *fixup = buf->len;
+        put_u32(buf, A64_B(0));
+        break;
+    case BFX_OP_SCAN:
+        emit_call(buf, jit_scan, ip);
+        break;
+    }
+}
+
+static void link_jumps(bfx_jit_buffer_t*    buf,
+                       const bfx_program_t* program,
+                       size_t               start,
+                       size_t               end,
+                       const size_t*        starts,
+                       const size_t*        fixups) {
+    size_t   ip;
+    size_t   target;
+    size_t   fixup;
+    uint32_t insn;
+
+    for (ip = start; ip < end; ip++) {
+        if (program->ops[ip].op == BFX_OP_JZ || program->ops[ip].op == BFX_OP_JNZ
+            || program->ops[ip].op == BFX_OP_FORK
+            || (program->ops[ip].op == BFX_OP_CHECK && fixups[ip - start])) {
+            /* jumps land just past the matching bracket, failed checks past what they
+               guard, and stopped forks at the end of the code */
+            if (program->ops[ip].op == BFX_OP_FORK) {
+                target = end - 1;
+            } else if (program->ops[ip].op == BFX_OP_CHECK) {
+                target = bfx_program_check_end(program, ip);
+            } else {
+                target = program->ops[ip].arg;
+            }
+            fixup = fixups[ip - start];
+            insn  = A64_B(starts[target + 1 - start] - fixup);
+            buf->code[fixup]     = insn;
+            buf->code[fixup + 1] = insn >> 8;
+            buf->code[fixup + 2] = insn >> 16;
+            buf->code[fixup + 3] = insn >> 24;
+        }
+    }
+}
+
+#endif
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef BFX_JIT_H
+#define BFX_JIT_H
+
+#include "bfx.h"
+#include "program.h"
+
+typedef struct bfx_jit_code bfx_jit_code_t;
+
+/**
+ * @brief Structure to hold the state of a tiered run (see bfx_execute_tiered()).
+ * @param counts Number of times the closing jump of each loop has been taken, indexed
+ *               by instruction.
+ * @param code Code compiled for each hot loop, indexed by its opening jump, or NULL.
+ * @param track If compiled code keeps the maximum tape pointer up to date (see
+ *              bfx_jit_track()).
+ */
+typedef struct {
+    uint64_t*        counts;
+    bfx_jit_code_t** code;
+    bool             track;
+} bfx_tier_t;
+
+void            bfx_execute_jit(bfx_t*, const bfx_program_t*);
+bfx_jit_code_t* bfx_jit_compile(const bfx_t*, const bfx_program_t*, size_t, size_t, bool);
+void            bfx_jit_free(bfx_jit_code_t*);
+void            bfx_jit_run(bfx_t*, const bfx_program_t*, const bfx_jit_code_t*);
+bool            bfx_jit_track(const bfx_t*, const bfx_program_t*);
+
+#endif
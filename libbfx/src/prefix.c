@@ -0,0 +1,395 @@
+/**
+ * @file prefix.c
+ * @brief evaluates the part of a program which does not depend on its input
+ *
+ * Many programs build tables of constants before they read anything. Since every run
+ * of such a program does the same work up to its first ',', that work can be done
+ * once, ahead of time: the program is run on a private tape until it would read
+ * input, or until BFX_PREFIX_STEP_LIMIT instructions have run, and the tape and output
+ * it reached are kept. Compiled programs start from them as initialized data, and
+ * batch jobs load them instead of running the prefix again.
+ *
+ * Runs only stop outside of loops, so the rest of the program is a sequence of whole
+ * loops which any engine or code generator can start on, and never between a CHECK
+ * and the instructions it guards. Whatever cannot be evaluated exactly, such as '#' or
+ * leaving the tape, which warns, stops the run at the last of these points.
+ */
+
+#include "prefix.h"
+#include "bfx.h"
+#include "interpret.h"
+#include "program.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Structure to hold the state of a program being evaluated.
+ * @param program Pointer to the program.
+ * @param tape Value of each cell.
+ * @param tape_size Number of cells.
+ * @param mask Mask of the bits of a cell.
+ * @param ip Index of the next instruction.
+ * @param tp Tape pointer.
+ * @param tp_max Highest cell reached.
+ * @param depth Number of loops the next instruction is in.
+ * @param guarded Index of the first instruction after the last CHECK outside of loops.
+ * @param output Output written so far, if it is recorded.
+ * @param output_len Length of the output.
+ * @param output_size Allocated size of the output.
+ * @param record If output is recorded.
+ */
+typedef struct {
+    const bfx_program_t* program;
+    uint32_t*            tape;
+    size_t               tape_size;
+    uint32_t             mask;
+    size_t               ip;
+    long                 tp;
+    long                 tp_max;
+    size_t               depth;
+    size_t               guarded;
+    uint8_t*             output;
+    size_t               output_len;
+    size_t               output_size;
+    bool                 record;
+} bfx_evaluation_t;
+
+static unsigned long evaluate(bfx_evaluation_t*, bfx_prefix_t*, unsigned long);
+static bool          put(bfx_evaluation_t*, uint8_t);
+static void          start(bfx_evaluation_t*, bool);
+static bool          step(bfx_evaluation_t*);
+static bool          touch(bfx_evaluation_t*, long);
+
+/**
+ * @brief Evaluates a program until it depends on its input.
+ *
+ * The program is run on a tape of `params.tape_size` cells of `params.cell_width` bits
+ * until it reaches ',' or '#', leaves the tape or runs BFX_PREFIX_STEP_LIMIT
+ * instructions, and `prefix` is set to the last state it reached outside of a loop.
+ * The run is then repeated up to that state, so the tape never has to be copied while
+ * the program runs.
+ *
+ * @param prefix Set to the state reached. Free it with bfx_prefix_free().
+ * @param program Pointer to the program to evaluate.
+ * @param params Parameters the program will run with.
+ *
+ * @return Returns BFX_STATUS_OK on success, BFX_STATUS_INVALID_PARAMETERS if the tape
+ *         size or cell width is invalid, or BFX_STATUS_NO_MEMORY.
+ */
+int bfx_prefix_evaluate(bfx_prefix_t*        prefix,
+                        const bfx_program_t* program,
+                        bfx_parameters_t     params) {
+    bfx_evaluation_t e;
+    bfx_prefix_t     replay;
+    unsigned long    steps;
+    uint32_t*        tape;
+
+    memset(prefix, 0, sizeof(bfx_prefix_t));
+    if (params.tape_size == 0
+        || (params.cell_width != 8 && params.cell_width != 16 && params.cell_width != 32)) {
+        return BFX_STATUS_INVALID_PARAMETERS;
+    }
+    prefix->tape_size  = params.tape_size;
+    prefix->cell_width = params.cell_width;
+
+    e.program     = program;
+    e.tape_size   = params.tape_size;
+    e.mask        = params.cell_width < 32 ? (1UL << params.cell_width) - 1 : 0xffffffffUL;
+    e.output      = NULL;
+    e.output_size = 0;
+    if (!(e.tape = calloc(params.tape_size, sizeof(uint32_t)))) {
+        return BFX_STATUS_NO_MEMORY;
+    }
+
+    start(&e, true);
+    steps          = evaluate(&e, prefix, BFX_PREFIX_STEP_LIMIT);
+    prefix->output = e.output;
+    if (prefix->ip == 0) {
+        free(e.tape);
+        bfx_prefix_free(prefix);
+        return BFX_STATUS_OK;
+    }
+
+    memset(e.tape, 0, sizeof(uint32_t) * (e.tp_max + 1));
+    start(&e, false);
+    evaluate(&e, &replay, steps);
+
+    for (prefix->cells = prefix->tp_max + 1; prefix->cells > 0; prefix->cells--) {
+        if (e.tape[prefix->cells - 1]) {
+            break;
+        }
+    }
+    if (prefix->cells > 0) {
+        if (!(tape = malloc(sizeof(uint32_t) * prefix->cells))) {
+            free(e.tape);
+            bfx_prefix_free(prefix);
+            return BFX_STATUS_NO_MEMORY;
+        }
+        memcpy(tape, e.tape, sizeof(uint32_t) * prefix->cells);
+        prefix->tape = tape;
+    }
+    free(e.tape);
+    return BFX_STATUS_OK;
+}
+
+/**
+ * @brief Frees the tape and output of a prefix.
+ * @param prefix Pointer to the prefix.
+ */
+void bfx_prefix_free(bfx_prefix_t* prefix) {
+    if (prefix) {
+        free(prefix->tape);
+        free(prefix->output);
+        prefix->tape   = NULL;
+        prefix->output = NULL;
+    }
+}
+
+/**
+ * @brief Starts a run from the end of a prefix.
+ *
+ * The cells and pointers are set to those the prefix reached and its output is
+ * written, so the engines carry on from `bf->ip`. Nothing happens unless the run has
+ * not started yet, and the prefix was evaluated with the run's tape size and cell
+ * width.
+ *
+ * @param bf Pointer to the interpreter state, which must be newly initialized or reset.
+ * @param prefix Pointer to the prefix, or NULL.
+ */
+void bfx_prefix_load(bfx_t* bf, const bfx_prefix_t* prefix) {
+    size_t i;
+
+    if (!prefix || prefix->ip == 0 || bf->ip != 0 || prefix->tape_size != bf->tape_size
+        || prefix->cell_width != bf->cell_width) {
+        return;
+    }
+
+    for (i = 0; i < prefix->cells; i++) {
+        switch (bf->cell_width) {
+        case 16:
+            ((uint16_t*) bf->tape)[i] = (uint16_t) prefix->tape[i];
+            break;
+        case 32:
+            ((uint32_t*) bf->tape)[i] = prefix->tape[i];
+            break;
+        default:
+            bf->tape[i] = (uint8_t) prefix->tape[i];
+            break;
+        }
+    }
+    for (i = 0; i < prefix->output_len; i++) {
+        bfx_putchar(bf, prefix->output[i]);
+    }
+    bf->ip     = prefix->ip;
+    bf->tp     = prefix->tp;
+    bf->tp_max = prefix->tp_max;
+}
+
+/**
+ * @brief Evaluates a program's prefix, which every run of the program then starts from
+ * (see bfx_prefix_evaluate()).
+ *
+ * Runs with other tape sizes or cell widths still start from the beginning.
+ *
+ * @param program Pointer to the program, which must not be running.
+ * @param params Parameters the program will run with.
+ *
+ * @return Returns BFX_STATUS_OK on success, BFX_STATUS_INVALID_PARAMETERS if the tape
+ *         size or cell width is invalid, or BFX_STATUS_NO_MEMORY. The program is
+ *         unchanged on failure.
+ */
+int bfx_program_evaluate(bfx_program_t* program, bfx_parameters_t params) {
+    bfx_prefix_t* prefix;
+    int           ret;
+
+    if (!(prefix = malloc(sizeof(bfx_prefix_t)))) {
+        return BFX_STATUS_NO_MEMORY;
+    }
+    if ((ret = bfx_prefix_evaluate(prefix, program, params)) || prefix->ip == 0) {
+        bfx_prefix_free(prefix);
+        free(prefix);
+        return ret;
+    }
+
+    bfx_prefix_free(program->prefix);
+    free(program->prefix);
+    program->prefix = prefix;
+    return BFX_STATUS_OK;
+}
+
+/**
+ * @brief Runs a program until it cannot be evaluated or has run `limit` instructions.
+ *
+ * @param e Pointer to the evaluation.
+ * @param prefix Set to the last state reached outside of a loop.
+ * @param limit Most instructions to run.
+ *
+ * @return Returns the number of instructions run up to the state in `prefix`.
+ */
+static unsigned long evaluate(bfx_evaluation_t* e, bfx_prefix_t* prefix, unsigned long limit) {
+    unsigned long steps;
+    unsigned long reached;
+
+    for (steps = 0, reached = 0;; steps++) {
+        if (e->depth == 0 && e->ip >= e->guarded) {
+            reached            = steps;
+            prefix->ip         = e->ip;
+            prefix->tp         = e->tp;
+            prefix->tp_max     = e->tp_max;
+            prefix->output_len = e->output_len;
+        }
+        if (e->ip >= e->program->len || steps == limit || !step(e)) {
+            return reached;
+        }
+    }
+}
+
+/**
+ * @brief Appends a byte to the output, if it is recorded.
+ * @return Returns false if the output cannot be grown.
+ */
+static bool put(bfx_evaluation_t* e, uint8_t c) {
+    uint8_t* output;
+    size_t   size;
+
+    if (!e->record) {
+        return true;
+    }
+    if (e->output_len == e->output_size) {
+        size = e->output_size ? e->output_size * 2 : BFX_DEFAULT_IO_BUFFER_SIZE;
+        if (!(output = realloc(e->output, size))) {
+            return false;
+        }
+        e->output      = output;
+        e->output_size = size;
+    }
+    e->output[e->output_len++] = c;
+    return true;
+}
+
+/**
+ * @brief Starts an evaluation at the first instruction, on a tape which is all zeros.
+ * @param e Pointer to the evaluation.
+ * @param record If output is recorded.
+ */
+static void start(bfx_evaluation_t* e, bool record) {
+    e->ip         = 0;
+    e->tp         = 0;
+    e->tp_max     = 0;
+    e->depth      = 0;
+    e->guarded    = 0;
+    e->output_len = 0;
+    e->record     = record;
+}
+
+/**
+ * @brief Runs the next instruction like bfx_execute() would.
+ *
+ * @param e Pointer to the evaluation.
+ *
+ * @return Returns false without running it if it cannot be evaluated: ',' and '#',
+ *         and instructions which would leave the tape.
+ */
+static bool step(bfx_evaluation_t* e) {
+    const bfx_op_t* op;
+    uint32_t*       tape;
+    long            cell;
+    int             n;
+
+    op   = &e->program->ops[e->ip];
+    tape = e->tape;
+    cell = e->tp + op->offset;
+
+    switch (op->op) {
+    case BFX_OP_ADD:
+        if (!touch(e, cell)) {
+            return false;
+        }
+        tape[cell] = (tape[cell] + (uint32_t) op->arg) & e->mask;
+        break;
+    case BFX_OP_MOVE:
+        if (!touch(e, e->tp + op->arg)) {
+            return false;
+        }
+        e->tp += op->arg;
+        break;
+    case BFX_OP_JZ:
+        if (!tape[e->tp]) {
+            e->ip = op->arg;
+        } else {
+            e->depth++;
+        }
+        break;
+    case BFX_OP_JNZ:
+        if (tape[e->tp]) {
+            e->ip = op->arg;
+        } else {
+            e->depth--;
+        }
+        break;
+    case BFX_OP_OUT:
+        if (!touch(e, cell)) {
+            return false;
+        }
+        for (n = 0; n < op->arg; n++) {
+            if (!put(e, (uint8_t) tape[cell])) {
+                return false;
+            }
+        }
+        break;
+    case BFX_OP_SET:
+        if (!touch(e, cell)) {
+            return false;
+        }
+        tape[cell] = (uint32_t) op->arg & e->mask;
+        break;
+    case BFX_OP_SCAN:
+        while (tape[e->tp]) {
+            if (!touch(e, e->tp + op->arg)) {
+                return false;
+            }
+            e->tp += op->arg;
+        }
+        break;
+    case BFX_OP_MULADD:
+        if (tape[e->tp]) {
+            if (!touch(e, cell)) {
+                return false;
+            }
+            /* unsigned arithmetic, so wide cells wrap instead of overflowing */
+            tape[cell] = (uint32_t) (tape[cell]
+                                     + (unsigned long) tape[e->tp] * (unsigned long) op->arg)
+                       & e->mask;
+        }
+        break;
+    case BFX_OP_CHECK:
+        if (!touch(e, e->tp + op->arg) || !touch(e, cell)) {
+            return false;
+        }
+        if (e->depth == 0) {
+            e->guarded = bfx_program_check_end(e->program, e->ip) + 1;
+        }
+        break;
+    default:
+        /* ',' needs input, '#' prints the state it is run in and 'Y' starts a thread */
+        return false;
+    }
+    e->ip++;
+    return true;
+}
+
+/**
+ * @brief Checks that a cell is on the tape, and raises the highest cell reached to it.
+ * @return Returns false if the cell is off the tape.
+ */
+static bool touch(bfx_evaluation_t* e, long cell) {
+    if (cell < 0 || (size_t) cell >= e->tape_size) {
+        return false;
+    }
+    if (cell > e->tp_max) {
+        e->tp_max = cell;
+    }
+    return true;
+}
@@ -0,0 +1,41 @@
+#ifndef BFX_PREFIX_H
+#define BFX_PREFIX_H
+
+#include "bfx.h"
+#include "program.h"
+
+/* most instructions evaluated ahead of time before giving up on reaching input */
+#ifndef BFX_PREFIX_STEP_LIMIT
+#define BFX_PREFIX_STEP_LIMIT 50000000UL
+#endif
+
+/**
+ * @brief Structure to hold the state a program reaches before it depends on its input.
+ * @param ip Index of the first instruction which was not evaluated, or 0 if nothing was.
+ * @param tp Tape pointer.
+ * @param tp_max Maximum tape pointer value.
+ * @param tape Value of each cell up to the last one which is not zero.
+ * @param cells Number of cells in `tape`.
+ * @param output Output written by the evaluated instructions.
+ * @param output_len Length of the output.
+ * @param tape_size Number of cells of the tape the program was evaluated on.
+ * @param cell_width Width of a cell in bits.
+ */
+struct bfx_prefix {
+    size_t    ip;
+    int       tp;
+    int       tp_max;
+    uint32_t* tape;
+    size_t    cells;
+    uint8_t*  output;
+    size_t    output_len;
+    size_t    tape_size;
+    int       cell_width;
+};
+
+int  bfx_prefix_evaluate(bfx_prefix_t*, const bfx_program_t*, bfx_parameters_t);
+void bfx_prefix_free(bfx_prefix_t*);
+void bfx_prefix_load(bfx_t*, const bfx_prefix_t*);
+int  bfx_program_evaluate(bfx_program_t*, bfx_parameters_t);
+
+#endif
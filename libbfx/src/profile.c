@@ -0,0 +1,249 @@
+/**
+ * @file profile.c
+ * @brief counts where a program spends its time and reports the hot spots
+ *
+ * The program is run by a copy of the switch engine which counts how many times each
+ * instruction runs. Each count is weighted by a rough cost of its instruction, and
+ * the loops and instructions with the most estimated cycles are reported with their
+ * source positions. A loop's cycles include those of the loops nested in it.
+ */
+
+#include "profile.h"
+#include "bfx.h"
+#include "interpret.h"
+#include "io.h"
+#include "program.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef BFX_PROFILE_REPORT_SIZE
+#define BFX_PROFILE_REPORT_SIZE 10
+#endif
+
+/**
+ * @brief Structure to represent a line of the report.
+ * @param ip Index of the instruction, or of the loop's opening jump.
+ * @param cycles Estimated cycles spent in it.
+ */
+typedef struct {
+    size_t ip;
+    double cycles;
+} bfx_profile_entry_t;
+
+static int  compare_entries(const void*, const void*);
+static void format_op(char*, const bfx_op_t*);
+static void print_loops(FILE*, const bfx_program_t*, const uint64_t*, const double*, double);
+static void print_ops(FILE*, const bfx_program_t*, const uint64_t*, double);
+
+/*
+ * Rough cost in cycles of each instruction in the switch engine, dispatch included,
+ * indexed by opcode. They only need to rank hot spots, not to match a real machine.
+ * SCAN is the cost of a short scan, '#' is not counted since it only runs
+ * while debugging, and 'Y' is roughly the cost of starting a thread.
+ */
+static const double costs[] = { 3, 3, 4, 4, 20, 10, 0, 3, 12, 5, 4, 20000 };
+
+static const char* const names[] = { "ADD", "MOVE", "JZ",   "JNZ",    "IN",   "OUT",
+                                     "#",   "SET",  "SCAN", "MULADD", "CHECK", "Y" };
+
+/**
+ * @brief Runs a program while counting how often each instruction runs, then reports
+ * the hot loops and instructions.
+ *
+ * Output is written before the report.
+ *
+ * @param bf Pointer to the interpreter state.
+ * @param program Pointer to the program to run.
+ * @param out Stream the report is written to.
+ *
+ * @return Returns BFX_STATUS_OK on success, or BFX_STATUS_NO_MEMORY, in which case the
+ *         program has not run.
+ */
+int bfx_profile(bfx_t* bf, const bfx_program_t* program, FILE* out) {
+    uint64_t* counts;
+    double*   cycles;
+    uint64_t  total;
+    size_t    i;
+
+    counts = calloc(program->len + 1, sizeof(uint64_t));
+    cycles = malloc(sizeof(double) * (program->len + 1));
+    if (!counts || !cycles) {
+        free(counts);
+        free(cycles);
+        return BFX_STATUS_NO_MEMORY;
+    }
+
+    bfx_execute_profile(bf, program, counts);
+    bfx_io_flush(bf);
+
+    /* cycles[i] is the estimated cost of the instructions before i, so any range is cheap */
+    total     = 0;
+    cycles[0] = 0;
+    for (i = 0; i < program->len; i++) {
+        total += counts[i];
+        cycles[i + 1] = cycles[i] + (double) counts[i] * costs[program->ops[i].op];
+    }
+
+    fprintf(out,
+            "\nProfile: %.0f instructions run, about %.0f cycles.\n",
+            (double) total,
+            cycles[program->len]);
+    print_loops(out, program, counts, cycles, cycles[program->len]);
+    print_ops(out, program, counts, cycles[program->len]);
+
+    free(counts);
+    free(cycles);
+    return BFX_STATUS_OK;
+}
+
+/**
+ * @brief Orders report entries by estimated cycles, most first.
+ */
+static int compare_entries(const void* a, const void* b) {
+    const bfx_profile_entry_t* x = a;
+    const bfx_profile_entry_t* y = b;
+
+    if (x->cycles != y->cycles) {
+        return x->cycles < y->cycles ? 1 : -1;
+    }
+    return x->ip < y->ip ? -1 : x->ip > y->ip;
+}
+
+/**
+ * @brief Writes an instruction as its name followed by its operands, such as `MOVE 3` or
+ * `MULADD 2@-1` (factor 2, offset -1). Jumps are written without their targets.
+ *
+ * @param buf Buffer of at least 32 bytes.
+ * @param op Pointer to the instruction.
+ */
+static void format_op(char* buf, const bfx_op_t* op) {
+    switch (op->op) {
+    case BFX_OP_MOVE:
+    case BFX_OP_SCAN:
+        sprintf(buf, "%s %d", names[op->op], op->arg);
+        break;
+    case BFX_OP_ADD:
+    case BFX_OP_OUT:
+    case BFX_OP_SET:
+    case BFX_OP_MULADD:
+        sprintf(buf, "%s %d@%d", names[op->op], op->arg, op->offset);
+        break;
+    case BFX_OP_IN:
+        sprintf(buf, "%s @%d", names[op->op], op->offset);
+        break;
+    case BFX_OP_CHECK:
+        sprintf(buf, "%s %d..%d", names[op->op], op->arg, op->offset);
+        break;
+    default:
+        sprintf(buf, "%s", names[op->op]);
+        break;
+    }
+}
+
+/**
+ * @brief Reports the loops with the most estimated cycles.
+ *
+ * A loop is entered each time its opening jump runs, and each run of its closing jump
+ * ends an iteration. Loops which were never entered are left out.
+ *
+ * @param out Stream the report is written to.
+ * @param program Pointer to the program.
+ * @param counts Number of times each instruction ran.
+ * @param cycles Estimated cycles spent before each instruction (see bfx_profile()).
+ * @param total Estimated cycles of the whole run.
+ */
+static void print_loops(FILE*                out,
+                        const bfx_program_t* program,
+                        const uint64_t*      counts,
+                        const double*        cycles,
+                        double               total) {
+    bfx_profile_entry_t*    loops;
+    const bfx_file_index_t* start;
+    const bfx_file_index_t* end;
+    size_t                  len;
+    size_t                  i;
+
+    if (!(loops = malloc(sizeof(bfx_profile_entry_t) * (program->len + 1)))) {
+        return;
+    }
+    for (i = 0, len = 0; i < program->len; i++) {
+        if (program->ops[i].op == BFX_OP_JZ && counts[i]) {
+            loops[len].ip     = i;
+            loops[len].cycles = cycles[program->ops[i].arg + 1] - cycles[i];
+            len++;
+        }
+    }
+    qsort(loops, len, sizeof(bfx_profile_entry_t), compare_entries);
+
+    fprintf(out, "\nHot loops:\n");
+    fprintf(out, "%14s %7s %12s %14s  %s\n", "cycles", "%", "entries", "iterations", "loop");
+    for (i = 0; i < len && i < BFX_PROFILE_REPORT_SIZE; i++) {
+        start = &program->index[loops[i].ip];
+        end   = &program->index[program->ops[loops[i].ip].arg];
+        fprintf(out,
+                "%14.0f %6.2f%% %12.0f %14.0f  %d,%d-%d,%d\n",
+                loops[i].cycles,
+                total ? 100 * loops[i].cycles / total : 0,
+                (double) counts[loops[i].ip],
+                (double) counts[program->ops[loops[i].ip].arg],
+                start->line,
+                start->line_idx,
+                end->line,
+                end->line_idx);
+    }
+    if (!len) {
+        fprintf(out, "  (none)\n");
+    }
+
+    free(loops);
+}
+
+/**
+ * @brief Reports the instructions with the most estimated cycles.
+ *
+ * @param out Stream the report is written to.
+ * @param program Pointer to the program.
+ * @param counts Number of times each instruction ran.
+ * @param total Estimated cycles of the whole run.
+ */
+static void print_ops(FILE*                out,
+                      const bfx_program_t* program,
+                      const uint64_t*      counts,
+                      double               total) {
+    bfx_profile_entry_t* ops;
+    char                 name[32];
+    size_t               len;
+    size_t               i;
+
+    if (!(ops = malloc(sizeof(bfx_profile_entry_t) * (program->len + 1)))) {
+        return;
+    }
+    for (i = 0, len = 0; i < program->len; i++) {
+        if (counts[i]) {
+            ops[len].ip     = i;
+            ops[len].cycles = (double) counts[i] * costs[program->ops[i].op];
+            len++;
+        }
+    }
+    qsort(ops, len, sizeof(bfx_profile_entry_t), compare_entries);
+
+    fprintf(out, "\nHot instructions:\n");
+    fprintf(out, "%14s %7s %12s  %-20s %s\n", "cycles", "%", "count", "instruction", "at");
+    for (i = 0; i < len && i < BFX_PROFILE_REPORT_SIZE; i++) {
+        format_op(name, &program->ops[ops[i].ip]);
+        fprintf(out,
+                "%14.0f %6.2f%% %12.0f  %-20s %d,%d\n",
+                ops[i].cycles,
+                total ? 100 * ops[i].cycles / total : 0,
+                (double) counts[ops[i].ip],
+                name,
+                program->index[ops[i].ip].line,
+                program->index[ops[i].ip].line_idx);
+    }
+    if (!len) {
+        fprintf(out, "  (none)\n");
+    }
+
+    free(ops);
+}
@@ -0,0 +1,11 @@
+#ifndef BFX_PROFILE_H
+#define BFX_PROFILE_H
+
+#include "bfx.h"
+#include "program.h"
+
+#include <stdio.h>
+
+int bfx_profile(bfx_t*, const bfx_program_t*, FILE*);
+
+#endif
@@ -0,0 +1,800 @@
+#include "program.h"
+#include "prefix.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool   can_hoist(const bfx_op_t*, size_t, size_t);
+static int    emit(bfx_program_t*, uint8_t, int, bfx_file_index_t);
+static int    fold(bfx_program_t*, uint8_t, int, bfx_file_index_t);
+static int    fold_offsets(bfx_program_t*);
+static size_t fold_run(const bfx_program_t*, size_t, bfx_op_t*, bfx_file_index_t*, size_t*);
+static int    fuse(bfx_program_t*);
+static bool   is_cell_op(uint8_t);
+static size_t lower_loop(bfx_program_t*, size_t, size_t, size_t);
+static size_t put(bfx_program_t*, size_t, uint8_t, int, int, bfx_file_index_t);
+
+/**
+ * @brief Compiles brainfuck source code to the intermediate representation.
+ *
+ * Runs of '+'/'-' and '>'/'<' are folded into a single ADD or MOVE (runs which
+ * cancel out are dropped entirely), runs of '.' are folded into an OUT which writes
+ * the cell that many times, matching brackets are linked to each other, and bytes
+ * which are not commands are skipped. '#' is only kept in debug mode with special
+ * instructions enabled, and 'Y' only with brainfork enabled.
+ *
+ * A folded MOVE moves the tape pointer by its net distance at once, and only where
+ * it ends is checked against the ends of the tape. This differs from the source
+ * interpreter, which puts the pointer back on the tape after every step: at the
+ * first cell, `+<>.` prints 1 here, as the `<>` is dropped, but 0 with `-n`, where
+ * the `<` is clamped to the first cell and the `>` then leaves it.
+ *
+ * @param program Pointer to the program to build.
+ * @param src Brainfuck source code.
+ * @param len Length of the source code.
+ * @param flags Interpreter flags (BFX_FLAG_*).
+ * @param error If not NULL, set to the position of the unmatched bracket on
+ *              BFX_STATUS_SYNTAX_ERROR. Its `idx` is the bracket's index in `src`.
+ *
+ * @return Returns BFX_STATUS_OK on success, BFX_STATUS_SYNTAX_ERROR if the source
+ *         contains an unmatched bracket, or BFX_STATUS_NO_MEMORY.
+ */
+int bfx_program_build(bfx_program_t*    program,
+                      const char*       src,
+                      size_t            len,
+                      int               flags,
+                      bfx_file_index_t* error) {
+    bfx_builder_t builder;
+    int           ret;
+
+    if ((ret = bfx_builder_init(&builder, program, flags))) {
+        return ret;
+    }
+    if (!(ret = bfx_builder_feed(&builder, src, len))) {
+        ret = bfx_builder_finish(&builder);
+    }
+    if (ret == BFX_STATUS_SYNTAX_ERROR && error) {
+        *error = builder.error;
+    }
+    return ret;
+}
+
+/**
+ * @brief Compiles and optimizes a program which can be shared by many instances.
+ *
+ * Unlike bfx_run_file(), nothing is read or run, and errors are returned rather
+ * than exiting.
+ *
+ * @param program Set to the new program on success.
+ * @param src Brainfuck source code.
+ * @param len Length of the source code.
+ * @param flags Interpreter flags (BFX_FLAG_*).
+ *
+ * @return Returns BFX_STATUS_OK on success, BFX_STATUS_SYNTAX_ERROR if the source
+ *         contains an unmatched bracket, or BFX_STATUS_NO_MEMORY.
+ */
+int bfx_program_create(bfx_program_t** program, const char* src, size_t len, int flags) {
+    bfx_program_t* p;
+    int            ret;
+
+    if (!(p = malloc(sizeof(bfx_program_t)))) {
+        return BFX_STATUS_NO_MEMORY;
+    }
+    if ((ret = bfx_program_build(p, src, len, flags, NULL)) || (ret = bfx_program_optimize(p))) {
+        bfx_program_free(p);
+        free(p);
+        return ret;
+    }
+
+    *program = p;
+    return BFX_STATUS_OK;
+}
+
+/**
+ * @brief Frees a program created by bfx_program_create().
+ *
+ * No instance may use the program after it is destroyed.
+ *
+ * @param program Pointer to the program.
+ */
+void bfx_program_destroy(bfx_program_t* program) {
+    bfx_program_free(program);
+    free(program);
+}
+
+/**
+ * @brief Starts building a program from source code which arrives in chunks.
+ *
+ * Source is passed to bfx_builder_feed() as it is read, and the program is complete
+ * once bfx_builder_finish() succeeds. Only the bracket stack is kept between chunks,
+ * so the source itself never has to be held in memory.
+ *
+ * @param builder Pointer to the builder state.
+ * @param program Pointer to the program to build.
+ * @param flags Interpreter flags (BFX_FLAG_*).
+ *
+ * @return Returns BFX_STATUS_OK on success, or BFX_STATUS_NO_MEMORY.
+ */
+int bfx_builder_init(bfx_builder_t* builder, bfx_program_t* program, int flags) {
+    memset(program, 0, sizeof(bfx_program_t));
+    program->size         = BFX_INITIAL_PROGRAM_SIZE;
+    program->ops          = malloc(sizeof(bfx_op_t) * program->size);
+    program->index        = malloc(sizeof(bfx_file_index_t) * program->size);
+    builder->program      = program;
+    builder->stack_top    = 0;
+    builder->stack_size   = BFX_INITIAL_LOOP_SIZE;
+    builder->stack        = malloc(sizeof(bfx_file_index_t) * builder->stack_size);
+    builder->pos.idx      = 0;
+    builder->pos.line     = 1;
+    builder->pos.line_idx = 0;
+    builder->debug        = (flags & BFX_FLAG_DEBUG)
+                     && !(flags & BFX_FLAG_DISABLE_SPECIAL_INSTRUCTIONS);
+    builder->fork         = flags & BFX_FLAG_BRAINFORK;
+
+    if (!program->ops || !program->index || !builder->stack) {
+        free(builder->stack);
+        bfx_program_free(program);
+        return BFX_STATUS_NO_MEMORY;
+    }
+    return BFX_STATUS_OK;
+}
+
+/**
+ * @brief Drops the instructions built so far, so the next chunk starts a new program.
+ *
+ * The source position is kept, so positions count on from the dropped source. This
+ * must only be called when no brackets are open.
+ *
+ * @param builder Pointer to the builder state.
+ */
+void bfx_builder_discard(bfx_builder_t* builder) {
+    builder->program->len = 0;
+    builder->stack_top    = 0;
+}
+
+/**
+ * @brief Compiles the next chunk of source code.
+ *
+ * @param builder Pointer to the builder state.
+ * @param src Chunk of brainfuck source code.
+ * @param len Length of the chunk.
+ *
+ * @return Returns BFX_STATUS_OK on success, BFX_STATUS_SYNTAX_ERROR if the chunk
+ *         contains an unmatched closing bracket, whose position is then kept in
+ *         `builder->error`, or BFX_STATUS_NO_MEMORY. On failure the program and
+ *         builder are freed.
+ */
+int bfx_builder_feed(bfx_builder_t* builder, const char* src, size_t len) {
+    bfx_program_t*    program;
+    bfx_file_index_t  pos;
+    bfx_file_index_t* stack;
+    size_t            start;
+    size_t            i;
+    int               ret;
+
+    program = builder->program;
+    pos     = builder->pos;
+    ret     = BFX_STATUS_OK;
+
+    for (i = 0; i < len && !ret; i++, pos.idx++) {
+        pos.line_idx++;
+        switch (src[i]) {
+        case '+':
+            ret = fold(program, BFX_OP_ADD, 1, pos);
+            break;
+        case '-':
+            ret = fold(program, BFX_OP_ADD, -1, pos);
+            break;
+        case '>':
+            ret = fold(program, BFX_OP_MOVE, 1, pos);
+            break;
+        case '<':
+            ret = fold(program, BFX_OP_MOVE, -1, pos);
+            break;
+        case ',':
+            ret = emit(program, BFX_OP_IN, 0, pos);
+            break;
+        case '.':
+            ret = fold(program, BFX_OP_OUT, 1, pos);
+            break;
+        case '[':
+            if (builder->stack_top >= builder->stack_size) {
+                if (!(stack = realloc(builder->stack,
+                                      sizeof(bfx_file_index_t) * builder->stack_size * 2))) {
+                    ret = BFX_STATUS_NO_MEMORY;
+                    break;
+                }
+                builder->stack = stack;
+                builder->stack_size *= 2;
+            }
+            builder->stack[builder->stack_top]     = pos;
+            builder->stack[builder->stack_top].idx = program->len;
+            builder->stack_top++;
+            ret = emit(program, BFX_OP_JZ, 0, pos);
+            break;
+        case ']':
+            if (builder->stack_top == 0) {
+                builder->error = pos;
+                ret            = BFX_STATUS_SYNTAX_ERROR;
+                break;
+            }
+            start                   = builder->stack[--builder->stack_top].idx;
+            program->ops[start].arg = program->len;
+            ret                     = emit(program, BFX_OP_JNZ, start, pos);
+            break;
+        case '#':
+            if (builder->debug) {
+                ret = emit(program, BFX_OP_DEBUG, 0, pos);
+            }
+            break;
+        case 'Y':
+            if (builder->fork) {
+                ret = emit(program, BFX_OP_FORK, 0, pos);
+            }
+            break;
+        case '\n':
+            pos.line++;
+            pos.line_idx = 0;
+            break;
+        }
+    }
+
+    if (ret) {
+        free(builder->stack);
+        bfx_program_free(program);
+        return ret;
+    }
+    builder->pos = pos;
+    return BFX_STATUS_OK;
+}
+
+/**
+ * @brief Drops the program built so far, including open brackets, and starts again
+ * at the first line.
+ *
+ * @param builder Pointer to the builder state.
+ */
+void bfx_builder_reset(bfx_builder_t* builder) {
+    bfx_builder_discard(builder);
+    builder->pos.idx      = 0;
+    builder->pos.line     = 1;
+    builder->pos.line_idx = 0;
+}
+
+/**
+ * @brief Finishes building a program.
+ *
+ * @param builder Pointer to the builder state.
+ *
+ * @return Returns BFX_STATUS_OK on success, or BFX_STATUS_SYNTAX_ERROR if the source
+ *         contains an unmatched opening bracket, whose position is then kept in
+ *         `builder->error`. On failure the program is freed.
+ */
+int bfx_builder_finish(bfx_builder_t* builder) {
+    if (builder->stack_top != 0) {
+        /* the stack holds the index of each bracket's JZ, which has its source position */
+        builder->error = builder->program->index[builder->stack[builder->stack_top - 1].idx];
+        free(builder->stack);
+        bfx_program_free(builder->program);
+        return BFX_STATUS_SYNTAX_ERROR;
+    }
+
+    free(builder->stack);
+    return BFX_STATUS_OK;
+}
+
+/**
+ * @brief Finds the last instruction guarded by a CHECK.
+ *
+ * A CHECK guards the loop after it, or otherwise the run of ADD, IN, OUT and SET
+ * after it and the MOVE ending the run, if there is one.
+ *
+ * @param program Pointer to the program.
+ * @param ip Index of the CHECK.
+ *
+ * @return Returns the index of the last guarded instruction.
+ */
+size_t bfx_program_check_end(const bfx_program_t* program, size_t ip) {
+    size_t i;
+
+    if (program->ops[ip + 1].op == BFX_OP_JZ) {
+        return program->ops[ip + 1].arg;
+    }
+    for (i = ip + 1; i < program->len && is_cell_op(program->ops[i].op); i++) {
+    }
+    return i < program->len && program->ops[i].op == BFX_OP_MOVE ? i : i - 1;
+}
+
+/**
+ * @brief Frees the memory allocated for a program.
+ * @param program Pointer to the program.
+ */
+void bfx_program_free(bfx_program_t* program) {
+    if (program) {
+        if (program->ops) {
+            free(program->ops);
+        }
+        if (program->index) {
+            free(program->index);
+        }
+        free(program->opcodes);
+        bfx_prefix_free(program->prefix);
+        free(program->prefix);
+        memset(program, 0, sizeof(bfx_program_t));
+    }
+}
+
+/**
+ * @brief Replaces common loop idioms with single instructions.
+ *
+ * The following loops are recognized:
+ * - `[-]` and `[+]` become SET 0 (a following ADD is folded into the SET).
+ * - `[>]`, `[<]`, `[>>]`, etc. become SCAN with the loop's stride.
+ * - Loops without I/O or nested loops which decrement or increment the current
+ *   cell by one and return to it, such as `[->+>++<<]`, become one MULADD per
+ *   modified cell followed by SET 0.
+ *
+ * The cells of the remaining straight runs are then addressed by offset (see
+ * fold_offsets()), and the opcodes the interpreters dispatch on are chosen (see
+ * fuse()).
+ *
+ * The program is rewritten in place and jumps are relinked.
+ *
+ * @param program Pointer to the program to optimize.
+ *
+ * @return Returns BFX_STATUS_OK on success, or BFX_STATUS_NO_MEMORY, in which case
+ *         the program is only fit to be freed.
+ */
+int bfx_program_optimize(bfx_program_t* program) {
+    size_t* stack;
+    size_t* grown;
+    size_t  stack_top;
+    size_t  stack_size;
+    size_t  start;
+    size_t  end;
+    size_t  len;
+    size_t  lowered;
+    size_t  i;
+
+    stack_top  = 0;
+    stack_size = BFX_INITIAL_LOOP_SIZE;
+    len        = 0;
+
+    if (!(stack = malloc(sizeof(size_t) * stack_size))) {
+        return BFX_STATUS_NO_MEMORY;
+    }
+
+    for (i = 0; i < program->len; i++) {
+        switch (program->ops[i].op) {
+        case BFX_OP_JZ:
+            end = program->ops[i].arg;
+            if ((lowered = lower_loop(program, i, end, len)) != len) {
+                len = lowered;
+                i   = end;
+                break;
+            }
+            if (stack_top >= stack_size) {
+                if (!(grown = realloc(stack, sizeof(size_t) * stack_size * 2))) {
+                    free(stack);
+                    return BFX_STATUS_NO_MEMORY;
+                }
+                stack = grown;
+                stack_size *= 2;
+            }
+            stack[stack_top++] = len;
+            len                = put(program, len, BFX_OP_JZ, 0, 0, program->index[i]);
+            break;
+        case BFX_OP_JNZ:
+            start                   = stack[--stack_top];
+            program->ops[start].arg = len;
+            len = put(program, len, BFX_OP_JNZ, start, 0, program->index[i]);
+            break;
+        default:
+            len = put(program,
+                      len,
+                      program->ops[i].op,
+                      program->ops[i].arg,
+                      program->ops[i].offset,
+                      program->index[i]);
+            break;
+        }
+    }
+
+    program->len = len;
+    free(stack);
+    if (fold_offsets(program)) {
+        return BFX_STATUS_NO_MEMORY;
+    }
+    return fuse(program);
+}
+
+/**
+ * @brief Checks if a loop's body is a run which starts with a CHECK and does not move
+ * the tape pointer, so its CHECK can be put before the loop.
+ * @param ops Pointer to the instructions.
+ * @param start Index of the loop's JZ.
+ * @param end Index of the loop's JNZ.
+ */
+static bool can_hoist(const bfx_op_t* ops, size_t start, size_t end) {
+    size_t i;
+
+    if (start + 1 >= end || ops[start + 1].op != BFX_OP_CHECK) {
+        return false;
+    }
+    for (i = start + 2; i < end; i++) {
+        if (!is_cell_op(ops[i].op)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Appends an instruction to a program.
+ * @param program Pointer to the program.
+ * @param op Opcode.
+ * @param arg Operand.
+ * @param pos Source position of the instruction.
+ *
+ * @return Returns BFX_STATUS_OK on success, or BFX_STATUS_NO_MEMORY.
+ */
+static int emit(bfx_program_t* program, uint8_t op, int arg, bfx_file_index_t pos) {
+    bfx_op_t*         ops;
+    bfx_file_index_t* index;
+
+    if (program->len >= program->size) {
+        if (!(ops = realloc(program->ops, sizeof(bfx_op_t) * program->size * 2))) {
+            return BFX_STATUS_NO_MEMORY;
+        }
+        program->ops = ops;
+        if (!(index = realloc(program->index, sizeof(bfx_file_index_t) * program->size * 2))) {
+            return BFX_STATUS_NO_MEMORY;
+        }
+        program->index = index;
+        program->size *= 2;
+    }
+
+    program->ops[program->len].op     = op;
+    program->ops[program->len].arg    = arg;
+    program->ops[program->len].offset = 0;
+    program->index[program->len]      = pos;
+    program->len++;
+    return BFX_STATUS_OK;
+}
+
+/**
+ * @brief Appends an ADD, MOVE or OUT, folding it into the previous instruction if possible.
+ *
+ * If the folded instruction cancels out, it is removed, even for a MOVE which
+ * would have left the tape part of the way (see bfx_program_build()).
+ *
+ * @param program Pointer to the program.
+ * @param op Opcode (BFX_OP_ADD, BFX_OP_MOVE or BFX_OP_OUT).
+ * @param arg Operand.
+ * @param pos Source position of the instruction.
+ *
+ * @return Returns BFX_STATUS_OK on success, or BFX_STATUS_NO_MEMORY.
+ */
+static int fold(bfx_program_t* program, uint8_t op, int arg, bfx_file_index_t pos) {
+    bfx_op_t* last;
+
+    if (program->len > 0) {
+        last = &program->ops[program->len - 1];
+        if (last->op == op) {
+            last->arg += arg;
+            if (last->arg == 0) {
+                program->len--;
+            }
+            return BFX_STATUS_OK;
+        }
+    }
+
+    return emit(program, op, arg, pos);
+}
+
+/**
+ * @brief Addresses cells by their offset within each straight run of instructions, so
+ * the tape pointer only moves once per run.
+ *
+ * A run is a sequence of ADD, IN, OUT, SET and MOVE. In a run with at least two
+ * MOVEs, such as `>+>>-<.`, each cell instruction is given the offset the tape pointer
+ * would have had, the MOVEs are replaced by one MOVE of their total at the end of
+ * the run, and a CHECK of the lowest and highest offsets is put at its start, in
+ * place of the bounds check each MOVE did. Runs with fewer MOVEs are left alone,
+ * so the program never gets longer.
+ *
+ * A loop whose body is a single such run which returns to the cell it started at,
+ * such as `[.>+<-]`, moves nothing while it runs, so its CHECK is put
+ * before the loop and happens once per entry rather than once per iteration. This
+ * is not done in programs with '#', since a CHECK counts its cells as used even if
+ * the loop does not run, and '#' would print them.
+ *
+ * @param program Pointer to the program.
+ *
+ * @return Returns BFX_STATUS_OK on success, or BFX_STATUS_NO_MEMORY, in which case
+ *         the program is unchanged.
+ */
+static int fold_offsets(bfx_program_t* program) {
+    bfx_op_t*         ops;
+    bfx_file_index_t* index;
+    bfx_op_t          op;
+    bfx_file_index_t  pos;
+    size_t*           stack;
+    size_t            stack_top;
+    size_t            start;
+    size_t            len;
+    size_t            i;
+    bool              hoist;
+
+    ops   = malloc(sizeof(bfx_op_t) * program->size);
+    index = malloc(sizeof(bfx_file_index_t) * program->size);
+    stack = malloc(sizeof(size_t) * (program->len + 1));
+    if (!ops || !index || !stack) {
+        free(ops);
+        free(index);
+        free(stack);
+        return BFX_STATUS_NO_MEMORY;
+    }
+
+    hoist = true;
+    for (i = 0; i < program->len; i++) {
+        if (program->ops[i].op == BFX_OP_DEBUG) {
+            hoist = false;
+        }
+    }
+
+    len       = 0;
+    stack_top = 0;
+    for (i = 0; i < program->len;) {
+        if (is_cell_op(program->ops[i].op) || program->ops[i].op == BFX_OP_MOVE) {
+            i = fold_run(program, i, ops, index, &len);
+            continue;
+        }
+
+        ops[len]   = program->ops[i];
+        index[len] = program->index[i];
+        if (ops[len].op == BFX_OP_JZ) {
+            stack[stack_top++] = len;
+        } else if (ops[len].op == BFX_OP_JNZ) {
+            start = stack[--stack_top];
+            if (hoist && can_hoist(ops, start, len)) {
+                op               = ops[start];
+                pos              = index[start];
+                ops[start]       = ops[start + 1];
+                index[start]     = index[start + 1];
+                ops[start + 1]   = op;
+                index[start + 1] = pos;
+                start++;
+            }
+            ops[start].arg = len;
+            ops[len].arg   = start;
+        }
+        len++;
+        i++;
+    }
+
+    free(program->ops);
+    free(program->index);
+    free(stack);
+    program->ops   = ops;
+    program->index = index;
+    program->len   = len;
+    return BFX_STATUS_OK;
+}
+
+/**
+ * @brief Copies a run of ADD, IN, OUT, SET and MOVE, addressing its cells by offset if
+ * it has at least two MOVEs (see fold_offsets()).
+ * @param program Pointer to the program.
+ * @param i Index of the first instruction of the run.
+ * @param ops Instructions to write the run to.
+ * @param index Source positions to write the run's positions to.
+ * @param len Index at which to write the run, advanced past what was written.
+ *
+ * @return Returns the index of the first instruction after the run.
+ */
+static size_t fold_run(const bfx_program_t* program,
+                       size_t               i,
+                       bfx_op_t*            ops,
+                       bfx_file_index_t*    index,
+                       size_t*              len) {
+    bfx_file_index_t pos;
+    size_t           end;
+    size_t           moves;
+    int              offset;
+    int              min;
+    int              max;
+
+    offset = 0;
+    min    = 0;
+    max    = 0;
+    moves  = 0;
+    for (end = i; end < program->len; end++) {
+        if (program->ops[end].op == BFX_OP_MOVE) {
+            offset += program->ops[end].arg;
+            moves++;
+        } else if (!is_cell_op(program->ops[end].op)) {
+            break;
+        } else if (offset + program->ops[end].offset < min) {
+            min = offset + program->ops[end].offset;
+        } else if (offset + program->ops[end].offset > max) {
+            max = offset + program->ops[end].offset;
+        }
+    }
+
+    if (moves < 2) {
+        for (; i < end; i++, (*len)++) {
+            ops[*len]   = program->ops[i];
+            index[*len] = program->index[i];
+        }
+        return end;
+    }
+
+    ops[*len].op     = BFX_OP_CHECK;
+    ops[*len].arg    = min;
+    ops[*len].offset = max;
+    index[*len]      = program->index[i];
+    (*len)++;
+
+    pos = program->index[i];
+    for (offset = 0; i < end; i++) {
+        if (program->ops[i].op == BFX_OP_MOVE) {
+            offset += program->ops[i].arg;
+            pos = program->index[i];
+            continue;
+        }
+        ops[*len] = program->ops[i];
+        ops[*len].offset += offset;
+        index[*len]      = program->index[i];
+        (*len)++;
+    }
+    if (offset != 0) {
+        ops[*len].op     = BFX_OP_MOVE;
+        ops[*len].arg    = offset;
+        ops[*len].offset = 0;
+        index[*len]      = pos;
+        (*len)++;
+    }
+    return end;
+}
+
+/**
+ * @brief Sets the opcode the interpreters dispatch on for each instruction.
+ *
+ * An instruction followed by one it is often paired with gets the opcode of a
+ * superinstruction which runs both, so the pair costs one dispatch instead of two.
+ * The pairs are the most frequent ones the profiler counts in the benchmark corpus once
+ * loops are lowered and runs are addressed by offset: the ADDs of a run, a run ending
+ * with a MOVE, a MOVE before a loop's first ADD, and the ADD or MOVE which ends a
+ * loop's body. Pairs whose first instruction does I/O are left alone, since the I/O
+ * costs far more than the dispatch.
+ *
+ * Pairs may overlap, and jumps may land on the second instruction of a pair, since it
+ * keeps an opcode of its own.
+ *
+ * @param program Pointer to the program.
+ *
+ * @return Returns BFX_STATUS_OK on success, or BFX_STATUS_NO_MEMORY.
+ */
+static int fuse(bfx_program_t* program) {
+    static const uint8_t pairs[][3] = {
+        { BFX_OP_ADD, BFX_OP_ADD, BFX_OP_ADD_ADD },   { BFX_OP_ADD, BFX_OP_MOVE, BFX_OP_ADD_MOVE },
+        { BFX_OP_ADD, BFX_OP_JNZ, BFX_OP_ADD_JNZ },   { BFX_OP_MOVE, BFX_OP_ADD, BFX_OP_MOVE_ADD },
+        { BFX_OP_MOVE, BFX_OP_JNZ, BFX_OP_MOVE_JNZ },
+    };
+    uint8_t* opcodes;
+    size_t   i;
+    size_t   j;
+
+    if (!(opcodes = realloc(program->opcodes, program->len + 1))) {
+        return BFX_STATUS_NO_MEMORY;
+    }
+    program->opcodes = opcodes;
+
+    for (i = 0; i < program->len; i++) {
+        opcodes[i] = program->ops[i].op;
+        for (j = 0; i + 1 < program->len && j < sizeof(pairs) / sizeof(pairs[0]); j++) {
+            if (program->ops[i].op == pairs[j][0] && program->ops[i + 1].op == pairs[j][1]) {
+                opcodes[i] = pairs[j][2];
+            }
+        }
+    }
+    return BFX_STATUS_OK;
+}
+
+/**
+ * @brief Checks if an instruction only uses the cell at its offset, so it can be part
+ * of a run whose cells are addressed by offset.
+ */
+static bool is_cell_op(uint8_t op) {
+    return op == BFX_OP_ADD || op == BFX_OP_IN || op == BFX_OP_OUT || op == BFX_OP_SET;
+}
+
+/**
+ * @brief Lowers a loop to idiom instructions if it is recognized.
+ *
+ * Since a lowered loop is never longer than the original, the instructions are
+ * written in place at `len`, which never exceeds `start`.
+ *
+ * @param program Pointer to the program.
+ * @param start Index of the loop's JZ.
+ * @param end Index of the loop's JNZ.
+ * @param len Index at which to write the lowered instructions.
+ *
+ * @return Returns the new program length, or `len` if the loop was not lowered.
+ */
+static size_t lower_loop(bfx_program_t* program, size_t start, size_t end, size_t len) {
+    bfx_op_t*        ops;
+    bfx_file_index_t pos;
+    int              offset;
+    int              delta;
+    size_t           i;
+
+    ops = program->ops;
+    pos = program->index[start];
+
+    if (end == start + 2 && ops[start + 1].op == BFX_OP_MOVE) {
+        return put(program, len, BFX_OP_SCAN, ops[start + 1].arg, 0, pos);
+    }
+
+    offset = 0;
+    delta  = 0;
+    for (i = start + 1; i < end; i++) {
+        if (ops[i].op == BFX_OP_MOVE) {
+            offset += ops[i].arg;
+        } else if (ops[i].op != BFX_OP_ADD) {
+            return len;
+        } else if (offset == 0) {
+            delta += ops[i].arg;
+        }
+    }
+
+    if (offset != 0 || (delta != 1 && delta != -1)) {
+        return len;
+    }
+
+    /* the loop runs cell times when decrementing, or -cell times when incrementing */
+    for (i = start + 1; i < end; i++) {
+        if (ops[i].op == BFX_OP_MOVE) {
+            offset += ops[i].arg;
+        } else if (offset != 0) {
+            len = put(program, len, BFX_OP_MULADD, -delta * ops[i].arg, offset, pos);
+        }
+    }
+
+    return put(program, len, BFX_OP_SET, 0, 0, pos);
+}
+
+/**
+ * @brief Writes an instruction at the given index of a program.
+ *
+ * An ADD directly following a SET of the same cell is folded into the SET.
+ *
+ * @param program Pointer to the program.
+ * @param len Index at which to write the instruction.
+ * @param op Opcode.
+ * @param arg Operand.
+ * @param offset Cell offset.
+ * @param pos Source position of the instruction.
+ *
+ * @return Returns the new program length.
+ */
+static size_t put(bfx_program_t*   program,
+                  size_t           len,
+                  uint8_t          op,
+                  int              arg,
+                  int              offset,
+                  bfx_file_index_t pos) {
+    if (op == BFX_OP_ADD && len > 0 && program->ops[len - 1].op == BFX_OP_SET
+        && program->ops[len - 1].offset == 0) {
+        program->ops[len - 1].arg += arg;
+        return len;
+    }
+
+    program->ops[len].op     = op;
+    program->ops[len].arg    = arg;
+    program->ops[len].offset = offset;
+    program->index[len]      = pos;
+    return len + 1;
+}
@@ -0,0 +1,114 @@
+#ifndef BFX_PROGRAM_H
+#define BFX_PROGRAM_H
+
+#include "bfx.h"
+
+#define BFX_OP_ADD    0  /* add arg to the cell at offset */
+#define BFX_OP_MOVE   1  /* add arg to the tape pointer */
+#define BFX_OP_JZ     2  /* jump to arg if the current cell is zero */
+#define BFX_OP_JNZ    3  /* jump to arg if the current cell is nonzero */
+#define BFX_OP_IN     4  /* read a byte into the cell at offset */
+#define BFX_OP_OUT    5  /* write the cell at offset arg times */
+#define BFX_OP_DEBUG  6  /* print the interpreter state ('#') */
+#define BFX_OP_SET    7  /* set the cell at offset to arg */
+#define BFX_OP_SCAN   8  /* move by arg until the current cell is zero */
+#define BFX_OP_MULADD 9  /* add the current cell times arg to the cell at offset */
+#define BFX_OP_CHECK  10 /* check that the cells at offsets arg to offset are on the tape */
+#define BFX_OP_FORK   11 /* fork a thread (brainfork's 'Y', see fork.c) */
+
+/* superinstructions, which only appear in bfx_program_t.opcodes (see bfx_program_optimize()) */
+#define BFX_OP_ADD_ADD  12 /* ADD, then the ADD after it */
+#define BFX_OP_ADD_MOVE 13 /* ADD, then the MOVE after it */
+#define BFX_OP_ADD_JNZ  14 /* ADD, then the JNZ after it */
+#define BFX_OP_MOVE_ADD 15 /* MOVE, then the ADD after it */
+#define BFX_OP_MOVE_JNZ 16 /* MOVE, then the JNZ after it */
+
+/**
+ * @brief The state a program reaches before it reads any input (see prefix.h).
+ */
+typedef struct bfx_prefix bfx_prefix_t;
+
+/**
+ * @brief Structure to represent a single instruction of the intermediate representation.
+ * @param op Opcode (one of BFX_OP_*).
+ * @param arg Operand. For ADD, MOVE and OUT this is the folded count, for JZ and JNZ
+ *            the index of the matching jump, for SET the value, for SCAN the stride,
+ *            for MULADD the factor and for CHECK the lowest offset.
+ * @param offset Offset of the target cell from the tape pointer (ADD, IN, OUT, SET and
+ *               MULADD), or the highest offset for CHECK.
+ */
+typedef struct {
+    uint8_t op;
+    int     arg;
+    int     offset;
+} bfx_op_t;
+
+/**
+ * @brief Structure to represent a brainfuck program compiled to the intermediate representation.
+ *
+ * Runs of '+'/'-', '>'/'<' and '.' are folded into a single ADD, MOVE or OUT, and bytes
+ * which are not commands are dropped.
+ *
+ * Once optimized, a CHECK is followed by the instructions it guards: either a loop,
+ * or a run of ADD, IN, OUT and SET ending with at most one MOVE (see
+ * bfx_program_check_end()). If the check fails, the engine runs the guarded
+ * instructions as if each offset was reached by moving the tape pointer, so the
+ * tape pointer is reset where it would have been without offsets (see bfx_unfold()).
+ *
+ * The interpreters read opcodes from a stream of their own, one byte each, in which
+ * common pairs of instructions are replaced by superinstructions. The second
+ * instruction of a pair keeps its own opcode, so jumps can still land on it.
+ *
+ * @param ops Pointer to the instruction array.
+ * @param opcodes Opcode the interpreters dispatch on for each instruction: its own, or
+ *                that of a superinstruction which also runs the instruction after it.
+ *                Only set once the program is optimized.
+ * @param len Number of instructions.
+ * @param size Allocated size of the instruction array.
+ * @param index Source position of each instruction (only used for diagnostics).
+ * @param prefix State every run starts from, or NULL to start from the beginning (see
+ *               bfx_program_evaluate()).
+ */
+struct bfx_program {
+    bfx_op_t*         ops;
+    uint8_t*          opcodes;
+    size_t            len;
+    size_t            size;
+    bfx_file_index_t* index;
+    bfx_prefix_t*     prefix;
+};
+
+/**
+ * @brief Structure to hold the state of a program being built from chunks of source.
+ * @param program Pointer to the program being built.
+ * @param pos Source position of the next byte.
+ * @param stack Stack of unmatched opening brackets.
+ * @param stack_top Number of unmatched opening brackets.
+ * @param stack_size Allocated size of the stack.
+ * @param debug If '#' should be compiled.
+ * @param fork If brainfork's 'Y' should be compiled.
+ * @param error Source position of the unmatched bracket, once building failed with
+ *              BFX_STATUS_SYNTAX_ERROR.
+ */
+typedef struct {
+    bfx_program_t*    program;
+    bfx_file_index_t  pos;
+    bfx_file_index_t* stack;
+    size_t            stack_top;
+    size_t            stack_size;
+    bool              debug;
+    bool              fork;
+    bfx_file_index_t  error;
+} bfx_builder_t;
+
+void   bfx_builder_discard(bfx_builder_t*);
+int    bfx_builder_feed(bfx_builder_t*, const char*, size_t);
+int    bfx_builder_finish(bfx_builder_t*);
+int    bfx_builder_init(bfx_builder_t*, bfx_program_t*, int);
+void   bfx_builder_reset(bfx_builder_t*);
+int    bfx_program_build(bfx_program_t*, const char*, size_t, int, bfx_file_index_t*);
+size_t bfx_program_check_end(const bfx_program_t*, size_t);
+void   bfx_program_free(bfx_program_t*);
+int    bfx_program_optimize(bfx_program_t*);
+
+#endif
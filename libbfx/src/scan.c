@@ -0,0 +1,245 @@
+/* memrchr() is a GNU extension */
+#define _GNU_SOURCE
+
+#include "scan.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define BFX_SCAN_X86
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_NEON)
+#define BFX_SCAN_NEON
+#include <arm_neon.h>
+#endif
+
+typedef int (*bfx_scan_fn)(const uint8_t*, int, int, size_t);
+
+static bfx_scan_fn select_kernel(void);
+static int         scan_scalar(const uint8_t*, int, int, size_t);
+#ifdef BFX_SCAN_X86
+static unsigned lane_mask(int, int, int);
+static int      scan_avx2(const uint8_t*, int, int, size_t);
+static int      scan_sse2(const uint8_t*, int, int, size_t);
+#endif
+#ifdef BFX_SCAN_NEON
+static int scan_neon(const uint8_t*, int, int, size_t);
+#endif
+
+static bfx_scan_fn kernel;
+
+/**
+ * @brief Finds the first zero cell reached by a scan loop such as `[>]` or `[<<]`.
+ *
+ * Cells `tp`, `tp + stride`, `tp + 2 * stride`, ... are checked until a zero cell is
+ * found or the scan leaves the tape. Stride 1 uses memchr() and stride -1 memrchr()
+ * where available. Other strides dividing the vector width use an SSE2/AVX2 or NEON
+ * compare-and-mask kernel, chosen once at runtime from the CPU's features. Remaining
+ * strides use a scalar loop.
+ *
+ * @param tape Pointer to the tape.
+ * @param tp Tape pointer to start from. Must be inside the tape.
+ * @param stride Distance between checked cells (nonzero).
+ * @param tape_size Size of the tape.
+ *
+ * @return Returns the index of the zero cell, or -1 if the scan leaves the tape first.
+ */
+int bfx_scan(const uint8_t* tape, int tp, int stride, size_t tape_size) {
+    const uint8_t* p;
+
+    if (stride == 1) {
+        p = memchr(tape + tp, 0, tape_size - tp);
+        return p ? p - tape : -1;
+    }
+#ifdef __GLIBC__
+    if (stride == -1) {
+        p = memrchr(tape, 0, tp + 1);
+        return p ? p - tape : -1;
+    }
+#endif
+
+    if (!kernel) {
+        kernel = select_kernel();
+    }
+    return kernel(tape, tp, stride, tape_size);
+}
+
+/**
+ * @brief Chooses the fastest scan kernel supported by the CPU.
+ */
+static bfx_scan_fn select_kernel(void) {
+#if defined(BFX_SCAN_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return scan_avx2;
+    }
+    return scan_sse2;
+#elif defined(BFX_SCAN_NEON)
+    return scan_neon;
+#else
+    return scan_scalar;
+#endif
+}
+
+static int scan_scalar(const uint8_t* tape, int tp, int stride, size_t tape_size) {
+    long i;
+
+    for (i = tp; i >= 0 && (size_t) i < tape_size; i += stride) {
+        if (!tape[i]) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+#ifdef BFX_SCAN_X86
+/**
+ * @brief Builds a movemask selecting the lanes a scan with the given stride visits.
+ *
+ * For forward scans the first lane is the current cell; for backward scans it is the last.
+ *
+ * @param stride Absolute stride, dividing `width`.
+ * @param width Vector width in bytes.
+ * @param backward Whether the scan moves left.
+ */
+static unsigned lane_mask(int stride, int width, int backward) {
+    unsigned mask;
+    int      lane;
+
+    mask = 0;
+    for (lane = 0; lane < width; lane += stride) {
+        mask |= 1u << (backward ? width - 1 - lane : lane);
+    }
+
+    return mask;
+}
+
+__attribute__((target("avx2"))) static int
+scan_avx2(const uint8_t* tape, int tp, int stride, size_t tape_size) {
+    __m256i  zero;
+    unsigned mask;
+    unsigned m;
+    long     i;
+
+    if (32 % abs(stride)) {
+        return scan_scalar(tape, tp, stride, tape_size);
+    }
+
+    zero = _mm256_setzero_si256();
+    mask = lane_mask(abs(stride), 32, stride < 0);
+    i    = tp;
+    if (stride > 0) {
+        for (; (size_t) i + 32 <= tape_size; i += 32) {
+            m = _mm256_movemask_epi8(
+                    _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (tape + i)), zero))
+                & mask;
+            if (m) {
+                return i + __builtin_ctz(m);
+            }
+        }
+    } else {
+        for (; i >= 31; i -= 32) {
+            m = _mm256_movemask_epi8(
+                    _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (tape + i - 31)), zero))
+                & mask;
+            if (m) {
+                return i - __builtin_clz(m);
+            }
+        }
+    }
+
+    return i < 0 ? -1 : scan_scalar(tape, i, stride, tape_size);
+}
+
+static int scan_sse2(const uint8_t* tape, int tp, int stride, size_t tape_size) {
+    __m128i  zero;
+    unsigned mask;
+    unsigned m;
+    long     i;
+
+    if (16 % abs(stride)) {
+        return scan_scalar(tape, tp, stride, tape_size);
+    }
+
+    zero = _mm_setzero_si128();
+    mask = lane_mask(abs(stride), 16, stride < 0);
+    i    = tp;
+    if (stride > 0) {
+        for (; (size_t) i + 16 <= tape_size; i += 16) {
+            m = _mm_movemask_epi8(
+                    _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (tape + i)), zero))
+                & mask;
+            if (m) {
+                return i + __builtin_ctz(m);
+            }
+        }
+    } else {
+        for (; i >= 15; i -= 16) {
+            m = _mm_movemask_epi8(
+                    _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (tape + i - 15)), zero))
+                & mask;
+            if (m) {
+                /* the highest set bit of a 16-bit mask, counted down from lane 15 */
+                return i - (__builtin_clz(m) - 16);
+            }
+        }
+    }
+
+    return i < 0 ? -1 : scan_scalar(tape, i, stride, tape_size);
+}
+#endif
+
+#ifdef BFX_SCAN_NEON
+/**
+ * @brief NEON scan kernel.
+ *
+ * NEON has no movemask, so the comparison result is narrowed to a 64-bit mask
+ * holding four bits per lane.
+ */
+static int scan_neon(const uint8_t* tape, int tp, int stride, size_t tape_size) {
+    uint8x16_t zero;
+    uint64_t   mask;
+    uint64_t   m;
+    long       i;
+    int        lane;
+
+    if (16 % abs(stride)) {
+        return scan_scalar(tape, tp, stride, tape_size);
+    }
+
+    zero = vdupq_n_u8(0);
+    mask = 0;
+    for (lane = 0; lane < 16; lane += abs(stride)) {
+        mask |= (uint64_t) 0xF << 4 * (stride < 0 ? 15 - lane : lane);
+    }
+
+    i = tp;
+    if (stride > 0) {
+        for (; (size_t) i + 16 <= tape_size; i += 16) {
+            m = vget_lane_u64(
+                    vreinterpret_u64_u8(vshrn_n_u16(
+                        vreinterpretq_u16_u8(vceqq_u8(vld1q_u8(tape + i), zero)), 4)),
+                    0)
+                & mask;
+            if (m) {
+                return i + __builtin_ctzl(m) / 4;
+            }
+        }
+    } else {
+        for (; i >= 15; i -= 16) {
+            m = vget_lane_u64(
+                    vreinterpret_u64_u8(vshrn_n_u16(
+                        vreinterpretq_u16_u8(vceqq_u8(vld1q_u8(tape + i - 15), zero)), 4)),
+                    0)
+                & mask;
+            if (m) {
+                return i - __builtin_clzl(m) / 4;
+            }
+        }
+    }
+
+    return i < 0 ? -1 : scan_scalar(tape, i, stride, tape_size);
+}
+#endif
@@ -0,0 +1,8 @@
+#ifndef BFX_SCAN_H
+#define BFX_SCAN_H
+
+#include "bfx.h"
+
+int bfx_scan(const uint8_t*, int, int, size_t);
+
+#endif
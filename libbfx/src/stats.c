@@ -0,0 +1,187 @@
+/**
+ * @file stats.c
+ * @brief measures a run of a program and reports it as JSON
+ *
+ * The program is run by the engine its flags select, so the report is of that engine.
+ * With `BFX_FLAG_STATS` set, each engine counts the instructions and jumps it runs in
+ * `bf->counts`: the switch and tiered engines with a counting copy of themselves, the
+ * threaded engine through a counting handler and the JIT with an increment before each
+ * instruction. The counts are the same whichever engine runs the program, and the cost
+ * of keeping them is part of the time and counters reported.
+ *
+ * The run is timed, and on Linux the CPU's cycles, instructions, branch misses and L1
+ * data cache misses are read from perf_event counters opened around it. Counters which
+ * cannot be opened, because the kernel or the machine does not have them or
+ * perf_event_paranoid forbids them, are reported as null.
+ */
+
+#include "stats.h"
+#include "bfx.h"
+#include "instance.h"
+#include "io.h"
+#include "program.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#define BFX_STATS_COUNTERS 4
+
+static void   close_counters(int*);
+static void   open_counters(int*);
+static void   print_counter(FILE*, const char*, int);
+static double seconds(void);
+
+/* JSON keys of the hardware counters, in the order they are opened */
+static const char* const counter_names[] = { "cycles", "instructions", "branch_misses",
+                                             "l1d_misses" };
+
+/**
+ * @brief Runs a program with bfx_run_program() while measuring it, then reports the
+ * measurements as one JSON object on a line of its own.
+ *
+ * The object holds the number of instructions of the intermediate representation
+ * executed (`ops`, with runs of commands folded into one), the wall-clock time and
+ * instructions per second, how many times `[` and `]` were tested, the highest tape
+ * pointer, the process's peak resident set size and the hardware counters. Output is
+ * written before the report.
+ *
+ * @param bf Pointer to the interpreter state.
+ * @param program Pointer to the program to run.
+ * @param out Stream the report is written to.
+ */
+void bfx_stats(bfx_t* bf, const bfx_program_t* program, FILE* out) {
+    struct rusage usage;
+    double        start;
+    double        wall;
+    int           fds[BFX_STATS_COUNTERS];
+    size_t        i;
+
+    memset(&bf->counts, 0, sizeof(bf->counts));
+    open_counters(fds);
+    start = seconds();
+    bfx_run_program(bf, program);
+    bfx_io_flush(bf);
+    wall = seconds() - start;
+#ifdef __linux__
+    for (i = 0; i < BFX_STATS_COUNTERS; i++) {
+        if (fds[i] >= 0) {
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+#endif
+
+    if (getrusage(RUSAGE_SELF, &usage)) {
+        usage.ru_maxrss = 0;
+    }
+
+    fprintf(out,
+            "{\"ops\":%.0f,\"wall_s\":%.6f,\"ops_per_s\":%.0f,\"branches\":{\"jz\":%.0f,"
+            "\"jnz\":%.0f},\"tp_max\":%d,\"max_rss_kb\":%ld",
+            (double) bf->counts.ops,
+            wall,
+            wall > 0 ? bf->counts.ops / wall : 0,
+            (double) bf->counts.jz,
+            (double) bf->counts.jnz,
+            bf->tp_max,
+            (long) usage.ru_maxrss);
+    for (i = 0; i < BFX_STATS_COUNTERS; i++) {
+        print_counter(out, counter_names[i], fds[i]);
+    }
+    fprintf(out, "}\n");
+
+    close_counters(fds);
+}
+
+/**
+ * @brief Closes the counters opened by open_counters().
+ */
+static void close_counters(int* fds) {
+    size_t i;
+
+    for (i = 0; i < BFX_STATS_COUNTERS; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+}
+
+/**
+ * @brief Opens and starts a perf_event counter of this thread's user-space execution for
+ * each of `counter_names`.
+ *
+ * Each counter is opened on its own rather than as a group, so that one the machine
+ * does not have leaves the others working.
+ *
+ * @param fds Set to the file descriptor of each counter, or -1 if it cannot be opened.
+ */
+static void open_counters(int* fds) {
+#ifdef __linux__
+    static const struct {
+        uint32_t type;
+        uint64_t config;
+    } events[] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_HW_CACHE,
+          PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+              | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    };
+    struct perf_event_attr attr;
+    size_t                 i;
+
+    for (i = 0; i < BFX_STATS_COUNTERS; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size           = sizeof(attr);
+        attr.type           = events[i].type;
+        attr.config         = events[i].config;
+        attr.disabled       = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        fds[i]              = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fds[i] >= 0) {
+            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#else
+    size_t i;
+
+    for (i = 0; i < BFX_STATS_COUNTERS; i++) {
+        fds[i] = -1;
+    }
+#endif
+}
+
+/**
+ * @brief Writes a hardware counter as a member of the report, or null if it was not opened
+ * or cannot be read.
+ */
+static void print_counter(FILE* out, const char* name, int fd) {
+    uint64_t value;
+
+    if (fd >= 0 && read(fd, &value, sizeof(value)) == sizeof(value)) {
+        fprintf(out, ",\"%s\":%.0f", name, (double) value);
+    } else {
+        fprintf(out, ",\"%s\":null", name);
+    }
+}
+
+/**
+ * @brief Returns the time in seconds on a clock which is never set back.
+ */
+static double seconds(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,11 @@
+#ifndef BFX_STATS_H
+#define BFX_STATS_H
+
+#include "bfx.h"
+#include "program.h"
+
+#include <stdio.h>
+
+void bfx_stats(bfx_t*, const bfx_program_t*, FILE*);
+
+#endif
@@ -0,0 +1,362 @@
+/* REG_RIP is a GNU extension */
+#define _GNU_SOURCE
+
+#include "tape.h"
+#include "io.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#define BFX_TAPE_UNKNOWN_IP ((size_t) -1)
+
+static size_t   fault_ip(void*);
+static void     free_tape(uint8_t*, size_t);
+static void     handle_fault(int, siginfo_t*, void*);
+static uint8_t* map_tape(size_t);
+static size_t   round_up(size_t, size_t);
+
+/* a process has a single fault handler, so it serves a single growable tape at a time */
+static bfx_t*               tape_bf;
+static const bfx_program_t* tape_program;
+static const uint8_t*       tape_code;
+static const size_t*        tape_starts;
+static size_t               tape_code_first;
+static size_t               tape_code_len;
+
+/* tapes released by finished runs, which are already cleared */
+static struct {
+    uint8_t* tape;
+    size_t   bytes;
+} pool[BFX_TAPE_POOL_SIZE];
+static size_t          pool_len;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Takes a zeroed fixed-size tape from the pool, or allocates one.
+ *
+ * Tapes of at least BFX_TAPE_MAP_SIZE bytes are mapped rather than allocated, so
+ * their pages are only backed by memory once they are touched, and can be
+ * cleared by bfx_tape_clear() without writing to them.
+ *
+ * @param bytes Size of the tape in bytes.
+ *
+ * @return Returns the tape, or NULL if it cannot be allocated.
+ */
+uint8_t* bfx_tape_acquire(size_t bytes) {
+    uint8_t* tape;
+    size_t   i;
+
+    tape = NULL;
+    pthread_mutex_lock(&pool_lock);
+    for (i = 0; i < pool_len; i++) {
+        if (pool[i].bytes == bytes) {
+            tape    = pool[i].tape;
+            pool[i] = pool[--pool_len];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (!tape) {
+        tape = bytes >= BFX_TAPE_MAP_SIZE ? map_tape(bytes) : calloc(bytes, 1);
+    }
+    return tape;
+}
+
+/**
+ * @brief Zeroes the part of a tape which may have been written.
+ *
+ * Only the first `dirty` bytes are cleared; on Linux, a large dirty range of a
+ * mapped tape is dropped with madvise() instead, so it costs nothing until the
+ * pages are touched again.
+ *
+ * @param tape Pointer to a tape from bfx_tape_acquire().
+ * @param bytes Size of the tape in bytes.
+ * @param dirty Number of bytes from the start of the tape which may be nonzero.
+ */
+void bfx_tape_clear(uint8_t* tape, size_t bytes, size_t dirty) {
+    if (dirty > bytes) {
+        dirty = bytes;
+    }
+#if defined(__linux__) && defined(MADV_DONTNEED)
+    /* private anonymous pages read back as zeros once they are dropped */
+    if (bytes >= BFX_TAPE_MAP_SIZE && dirty >= BFX_TAPE_MAP_SIZE
+        && !madvise(tape, round_up(dirty, sysconf(_SC_PAGESIZE)), MADV_DONTNEED)) {
+        return;
+    }
+#endif
+    memset(tape, 0, dirty);
+}
+
+/**
+ * @brief Reports a tape pointer which left a growable tape and exits.
+ *
+ * Unlike a fixed tape, the tape pointer cannot be reset to zero, since the violation
+ * may only be noticed as a fault on the access which follows it.
+ *
+ * @param bf Pointer to the interpreter state.
+ * @param program Pointer to the program, or NULL if it is not known.
+ * @param ip Index of the offending instruction, or (size_t) -1 if it is not known.
+ * @param tp Offending tape pointer; its sign tells underflow from overflow.
+ */
+void bfx_tape_error(bfx_t* bf, const bfx_program_t* program, size_t ip, int tp) {
+    bfx_io_flush(bf);
+    if (program && ip < program->len) {
+        fprintf(stderr,
+                "libbfx: Error (%d,%d): Tape pointer %s.\n",
+                program->index[ip].line,
+                program->index[ip].line_idx,
+                tp < 0 ? "underflow" : "overflow");
+    } else {
+        fprintf(stderr, "libbfx: Error: Tape pointer %s.\n", tp < 0 ? "underflow" : "overflow");
+    }
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Unmaps a growable tape and removes the fault handler.
+ * @param bf Pointer to the interpreter state.
+ */
+void bfx_tape_free(bfx_t* bf) {
+    signal(SIGSEGV, SIG_DFL);
+    munmap(bf->tape - bf->tape_guard, bf->tape_size * BFX_CELL_SIZE(*bf) + 2 * bf->tape_guard);
+    bf->tape     = NULL;
+    tape_bf      = NULL;
+    tape_program = NULL;
+}
+
+/**
+ * @brief Replaces the tape with a growable one reserved in virtual memory.
+ *
+ * `bf->tape_size` cells (rounded up to whole pages) are reserved without being
+ * backed by memory, and only the first BFX_TAPE_COMMIT_SIZE bytes are accessible.
+ * The reservation is surrounded by inaccessible guard pages at least as large as
+ * the longest move or cell offset in the program, so a tape pointer which leaves
+ * the tape faults on its next access. A SIGSEGV handler makes more of the tape
+ * accessible when it is first touched, and reports tape pointer underflow or
+ * overflow when a guard page is.
+ *
+ * @param bf Pointer to the interpreter state.
+ * @param program Pointer to the program which will use the tape.
+ */
+void bfx_tape_init(bfx_t* bf, const bfx_program_t* program) {
+    struct sigaction sa;
+    size_t           page;
+    size_t           bytes;
+    size_t           reach;
+    size_t           i;
+    uint8_t*         base;
+
+    page  = sysconf(_SC_PAGESIZE);
+    reach = 1;
+    for (i = 0; i < program->len; i++) {
+        if ((program->ops[i].op == BFX_OP_MOVE || program->ops[i].op == BFX_OP_CHECK)
+            && (size_t) abs(program->ops[i].arg) > reach) {
+            reach = abs(program->ops[i].arg);
+        }
+        if ((size_t) abs(program->ops[i].offset) > reach) {
+            reach = abs(program->ops[i].offset);
+        }
+    }
+
+    bytes              = round_up(bf->tape_size * BFX_CELL_SIZE(*bf), page);
+    bf->tape_size      = bytes / BFX_CELL_SIZE(*bf);
+    bf->tape_guard     = round_up(reach * BFX_CELL_SIZE(*bf), page);
+    bf->tape_committed = bytes < BFX_TAPE_COMMIT_SIZE ? bytes
+                                                      : round_up(BFX_TAPE_COMMIT_SIZE, page);
+    base               = mmap(NULL,
+                bytes + 2 * bf->tape_guard,
+                PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                -1,
+                0);
+    if (base == MAP_FAILED
+        || mprotect(base + bf->tape_guard, bf->tape_committed, PROT_READ | PROT_WRITE)) {
+        BFX_ERROR("Cannot reserve memory for the tape.");
+    }
+
+    free(bf->tape);
+    bf->tape     = base + bf->tape_guard;
+    tape_bf      = bf;
+    tape_program = program;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = handle_fault;
+    sa.sa_flags     = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, NULL);
+}
+
+/**
+ * @brief Clears a tape from bfx_tape_acquire() and returns it to the pool.
+ *
+ * If the pool is full, the tape is freed.
+ *
+ * @param tape Pointer to the tape, or NULL.
+ * @param bytes Size of the tape in bytes.
+ * @param dirty Number of bytes from the start of the tape which may be nonzero.
+ */
+void bfx_tape_release(uint8_t* tape, size_t bytes, size_t dirty) {
+    if (!tape) {
+        return;
+    }
+
+    bfx_tape_clear(tape, bytes, dirty);
+    pthread_mutex_lock(&pool_lock);
+    if (pool_len < BFX_TAPE_POOL_SIZE) {
+        pool[pool_len].tape  = tape;
+        pool[pool_len].bytes = bytes;
+        pool_len++;
+        tape = NULL;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (tape) {
+        free_tape(tape, bytes);
+    }
+}
+
+/**
+ * @brief Registers generated code, so faults in it can be traced to an instruction.
+ * @param code Start of the generated code, or NULL to unregister it.
+ * @param starts Offset of the code of each instruction within `code`, followed by the
+ *               end of the code.
+ * @param first Index of the first instruction the code was generated for.
+ * @param len Number of instructions.
+ */
+void bfx_tape_set_code(const uint8_t* code, const size_t* starts, size_t first, size_t len) {
+    tape_code       = code;
+    tape_starts     = starts;
+    tape_code_first = first;
+    tape_code_len   = len;
+}
+
+/**
+ * @brief Finds the instruction whose generated code faulted.
+ * @param context Signal context of the fault.
+ * @return Returns the instruction's index, or BFX_TAPE_UNKNOWN_IP.
+ */
+static size_t fault_ip(void* context) {
+    ucontext_t* uc;
+    uintptr_t   pc;
+    size_t      lo;
+    size_t      hi;
+    size_t      mid;
+
+    uc = context;
+#if defined(__x86_64__)
+    pc = uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+    pc = uc->uc_mcontext.pc;
+#else
+    return BFX_TAPE_UNKNOWN_IP;
+#endif
+
+    if (!tape_code || pc < (uintptr_t) tape_code
+        || pc >= (uintptr_t) tape_code + tape_starts[tape_code_len]) {
+        return BFX_TAPE_UNKNOWN_IP;
+    }
+
+    /* find the last instruction starting at or before pc */
+    lo = 0;
+    hi = tape_code_len;
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if ((uintptr_t) tape_code + tape_starts[mid] <= pc) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    /* the access faults, but it is usually the move before it which left the tape */
+    lo += tape_code_first;
+    if (lo > 0 && tape_program->ops[lo - 1].op == BFX_OP_MOVE) {
+        lo--;
+    }
+    return lo;
+}
+
+/**
+ * @brief Frees a tape from bfx_tape_acquire().
+ */
+static void free_tape(uint8_t* tape, size_t bytes) {
+    if (bytes >= BFX_TAPE_MAP_SIZE) {
+        munmap(tape, bytes);
+    } else {
+        free(tape);
+    }
+}
+
+/**
+ * @brief Grows the tape, or reports a guard page access.
+ *
+ * Faults which do not touch the tape's reservation are not ours: the default
+ * action is restored and the faulting access is retried, which crashes as usual.
+ */
+static void handle_fault(int sig, siginfo_t* info, void* context) {
+    uint8_t* addr;
+    size_t   bytes;
+    size_t   offset;
+    size_t   size;
+
+    if (!tape_bf) {
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+
+    addr  = info->si_addr;
+    bytes = tape_bf->tape_size * BFX_CELL_SIZE(*tape_bf);
+    if (addr < tape_bf->tape - tape_bf->tape_guard
+        || addr >= tape_bf->tape + bytes + tape_bf->tape_guard) {
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+
+    if (addr < tape_bf->tape) {
+        bfx_tape_error(tape_bf, tape_program, fault_ip(context), -1);
+    } else if (addr >= tape_bf->tape + bytes) {
+        bfx_tape_error(tape_bf, tape_program, fault_ip(context), 1);
+    }
+
+    offset = addr - tape_bf->tape;
+    size   = tape_bf->tape_committed * 2;
+    while (size <= offset) {
+        size *= 2;
+    }
+    if (size > bytes) {
+        size = bytes;
+    }
+
+    if (offset < tape_bf->tape_committed
+        || mprotect(tape_bf->tape + tape_bf->tape_committed,
+                    size - tape_bf->tape_committed,
+                    PROT_READ | PROT_WRITE)) {
+        /* the fault was not caused by the tape being too small */
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+    tape_bf->tape_committed = size;
+}
+
+/**
+ * @brief Maps a zeroed tape.
+ * @return Returns the tape, or NULL if it cannot be mapped.
+ */
+static uint8_t* map_tape(size_t bytes) {
+    void* tape;
+
+    tape = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return tape == MAP_FAILED ? NULL : tape;
+}
+
+/**
+ * @brief Rounds a size up to a multiple of a power of two.
+ */
+static size_t round_up(size_t size, size_t align) { return (size + align - 1) & ~(align - 1); }
@@ -0,0 +1,15 @@
+#ifndef BFX_TAPE_H
+#define BFX_TAPE_H
+
+#include "bfx.h"
+#include "program.h"
+
+uint8_t* bfx_tape_acquire(size_t);
+void     bfx_tape_clear(uint8_t*, size_t, size_t);
+void     bfx_tape_error(bfx_t*, const bfx_program_t*, size_t, int);
+void     bfx_tape_free(bfx_t*);
+void     bfx_tape_init(bfx_t*, const bfx_program_t*);
+void     bfx_tape_release(uint8_t*, size_t, size_t);
+void     bfx_tape_set_code(const uint8_t*, const size_t*, size_t, size_t);
+
+#endif
@@ -0,0 +1,192 @@
+/*
+ * Direct-threaded code needs GNU C labels as values, so this file is built with
+ * -std=gnu89 and without -pedantic (see libbfx/CMakeLists.txt).
+ */
+
+#include "threaded.h"
+#include "fork.h"
+#include "interpret.h"
+#include "io.h"
+#include "scan.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define DISPATCH() goto *code[++ip]
+
+/**
+ * @brief Executes a program using direct-threaded dispatch.
+ *
+ * Each instruction is translated to the address of its handler before running, and
+ * every handler jumps straight to the next instruction's handler, instead of going
+ * back through a single `switch`. Handlers are chosen by the program's opcode stream,
+ * and a superinstruction's handler runs the first instruction of its pair, then
+ * jumps directly into the second's handler, saving an indirect jump. If `BFX_FLAG_STATS`
+ * is set, every instruction is first sent through a handler which counts it in
+ * `bf->counts`, so runs which are not counted pay nothing for it. Behavior is
+ * identical to bfx_execute(), which is used instead when the compiler does not support
+ * labels as values, for programs with cells wider than 8 bits, and if the handler table
+ * cannot be allocated.
+ *
+ * @param bf Pointer to the interpreter state.
+ * @param program Pointer to the program to execute.
+ */
+void bfx_execute_threaded(bfx_t* bf, const bfx_program_t* program) {
+#if defined(__GNUC__)
+    static const void* const handlers[] = {
+        &&op_add,      &&op_move,     &&op_jz,      &&op_jnz,      &&op_in,
+        &&op_out,      &&op_debug,    &&op_set,     &&op_scan,     &&op_muladd,
+        &&op_check,    &&op_fork,     &&op_add_add, &&op_add_move, &&op_add_jnz,
+        &&op_move_add, &&op_move_jnz
+    };
+    /* instructions run by each opcode, since a superinstruction runs two */
+    static const uint8_t widths[] = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2 };
+    const bfx_op_t* ops;
+    const void**    code;
+    uint8_t*        tape;
+    size_t          ip;
+    int             tp;
+    int             cell;
+
+    if (bf->cell_width != 8 || !(code = malloc(sizeof(void*) * (program->len + 1)))) {
+        bfx_execute(bf, program);
+        return;
+    }
+    for (ip = 0; ip < program->len; ip++) {
+        code[ip] = bf->flags & BFX_FLAG_STATS ? &&op_count : handlers[program->opcodes[ip]];
+    }
+    code[program->len] = &&done;
+
+    ops  = program->ops;
+    tape = bf->tape;
+    tp   = bf->tp;
+    ip   = bf->ip;
+    goto *code[ip];
+
+op_count:
+    bf->counts.ops += widths[program->opcodes[ip]];
+    bf->counts.jz += program->opcodes[ip] == BFX_OP_JZ;
+    bf->counts.jnz += program->opcodes[ip] == BFX_OP_JNZ || program->opcodes[ip] == BFX_OP_ADD_JNZ
+                      || program->opcodes[ip] == BFX_OP_MOVE_JNZ;
+    goto *handlers[program->opcodes[ip]];
+op_add:
+    tape[tp + ops[ip].offset] += ops[ip].arg;
+    DISPATCH();
+op_move:
+    tp += ops[ip].arg;
+    if (tp < 0 || (size_t) tp >= bf->tape_size) {
+        tp = bfx_move_warning(bf, program, ip, tp);
+    } else if (tp > bf->tp_max) {
+        bf->tp_max = tp;
+    }
+    DISPATCH();
+op_jz:
+    if (!tape[tp]) {
+        ip = ops[ip].arg;
+    }
+    DISPATCH();
+op_jnz:
+    if (tape[tp]) {
+        ip = ops[ip].arg;
+    }
+    DISPATCH();
+op_in:
+    cell       = tp + ops[ip].offset;
+    tape[cell] = BFX_GETCHAR(bf, tape[cell]);
+    DISPATCH();
+op_out:
+    if (ops[ip].arg == 1) {
+        bfx_putchar(bf, tape[tp + ops[ip].offset]);
+    } else {
+        bfx_putchars(bf, tape[tp + ops[ip].offset], ops[ip].arg);
+    }
+    DISPATCH();
+op_debug:
+    bf->tp = tp;
+    bf->ip = program->index[ip].idx;
+    bfx_diagnose(bf, &program->index[ip]);
+    DISPATCH();
+op_set:
+    tape[tp + ops[ip].offset] = ops[ip].arg;
+    DISPATCH();
+op_scan:
+    while ((cell = bfx_scan(tape, tp, ops[ip].arg, bf->tape_size)) < 0) {
+        if (ops[ip].arg > 0) {
+            bf->tp_max = bf->tape_size - 1;
+        }
+        tp = bfx_move_warning(bf, program, ip, ops[ip].arg);
+    }
+    tp = cell;
+    if (tp > bf->tp_max) {
+        bf->tp_max = tp;
+    }
+    DISPATCH();
+op_muladd:
+    if (tape[tp]) {
+        cell = tp + ops[ip].offset;
+        if (cell < 0 || (size_t) cell >= bf->tape_size) {
+            bfx_offset_warning(program, ip, cell);
+        } else {
+            tape[cell] += tape[tp] * ops[ip].arg;
+            if (cell > bf->tp_max) {
+                bf->tp_max = cell;
+            }
+        }
+    }
+    DISPATCH();
+op_check:
+    if (tp + ops[ip].arg < 0 || (size_t) (tp + ops[ip].offset) >= bf->tape_size) {
+        bf->tp = tp;
+        ip     = bfx_unfold(bf, program, ip);
+        tp     = bf->tp;
+    } else if (tp + ops[ip].offset > bf->tp_max) {
+        bf->tp_max = tp + ops[ip].offset;
+    }
+    DISPATCH();
+op_fork:
+    bf->tp = tp;
+    if (bfx_fork(bf, program, ip)) {
+        ip = program->len;
+        goto done;
+    }
+    tape[tp] = 0;
+    DISPATCH();
+op_add_add:
+    tape[tp + ops[ip].offset] += ops[ip].arg;
+    ip++;
+    goto op_add;
+op_add_move:
+    tape[tp + ops[ip].offset] += ops[ip].arg;
+    ip++;
+    goto op_move;
+op_add_jnz:
+    tape[tp + ops[ip].offset] += ops[ip].arg;
+    ip++;
+    goto op_jnz;
+op_move_add:
+    tp += ops[ip].arg;
+    if (tp < 0 || (size_t) tp >= bf->tape_size) {
+        tp = bfx_move_warning(bf, program, ip, tp);
+    } else if (tp > bf->tp_max) {
+        bf->tp_max = tp;
+    }
+    ip++;
+    goto op_add;
+op_move_jnz:
+    tp += ops[ip].arg;
+    if (tp < 0 || (size_t) tp >= bf->tape_size) {
+        tp = bfx_move_warning(bf, program, ip, tp);
+    } else if (tp > bf->tp_max) {
+        bf->tp_max = tp;
+    }
+    ip++;
+    goto op_jnz;
+
+done:
+    free(code);
+    bf->ip = ip;
+    bf->tp = tp;
+#else
+    bfx_execute(bf, program);
+#endif
+}
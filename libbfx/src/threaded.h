@@ -0,0 +1,9 @@
+#ifndef BFX_THREADED_H
+#define BFX_THREADED_H
+
+#include "bfx.h"
+#include "program.h"
+
+void bfx_execute_threaded(bfx_t*, const bfx_program_t*);
+
+#endif
@@ -1,8 +1,739 @@
 #include "unity.h"
 
 #include "bfx.h"
+#include "checkpoint.h"
+#include "instance.h"
+#include "interpret.h"
+#include "io.h"
+#include "prefix.h"
+#include "program.h"
+#include "stats.h"
+#include "tape.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 void setUp() {}
 void tearDown() {}
 
 void test_bfx_build_loops(void) { TEST_ASSERT_EQUAL(1, 1); }
+
+void test_bfx_locate(void) {
+    bfx_t            bf;
+    bfx_file_index_t index;
+    size_t           lines[] = { 0, 4, 5, 9 };
+
+    memset(&bf, 0, sizeof(bfx_t));
+    bf.lines     = lines;
+    bf.lines_len = 4;
+
+    index = bfx_locate(&bf, 0);
+    TEST_ASSERT_EQUAL(1, index.line);
+    TEST_ASSERT_EQUAL(1, index.line_idx);
+    index = bfx_locate(&bf, 3);
+    TEST_ASSERT_EQUAL(1, index.line);
+    TEST_ASSERT_EQUAL(4, index.line_idx);
+    index = bfx_locate(&bf, 4);
+    TEST_ASSERT_EQUAL(2, index.line);
+    TEST_ASSERT_EQUAL(1, index.line_idx);
+    index = bfx_locate(&bf, 12);
+    TEST_ASSERT_EQUAL(4, index.line);
+    TEST_ASSERT_EQUAL(4, index.line_idx);
+}
+
+void test_bfx_program_build_folds_runs(void) {
+    bfx_program_t program;
+    const char*   src = "+++++ comment >>><\n--";
+
+    TEST_ASSERT_EQUAL(0, bfx_program_build(&program, src, strlen(src), 0, NULL));
+    TEST_ASSERT_EQUAL(3, program.len);
+    TEST_ASSERT_EQUAL(BFX_OP_ADD, program.ops[0].op);
+    TEST_ASSERT_EQUAL(5, program.ops[0].arg);
+    TEST_ASSERT_EQUAL(BFX_OP_MOVE, program.ops[1].op);
+    TEST_ASSERT_EQUAL(2, program.ops[1].arg);
+    TEST_ASSERT_EQUAL(BFX_OP_ADD, program.ops[2].op);
+    TEST_ASSERT_EQUAL(-2, program.ops[2].arg);
+    TEST_ASSERT_EQUAL(2, program.index[2].line);
+    bfx_program_free(&program);
+}
+
+void test_bfx_program_build_links_loops(void) {
+    bfx_program_t program;
+    const char*   src = "+[>+<[.]-]";
+
+    TEST_ASSERT_EQUAL(0, bfx_program_build(&program, src, strlen(src), 0, NULL));
+    TEST_ASSERT_EQUAL(10, program.len);
+    TEST_ASSERT_EQUAL(BFX_OP_JZ, program.ops[1].op);
+    TEST_ASSERT_EQUAL(9, program.ops[1].arg);
+    TEST_ASSERT_EQUAL(BFX_OP_JNZ, program.ops[9].op);
+    TEST_ASSERT_EQUAL(1, program.ops[9].arg);
+    TEST_ASSERT_EQUAL(7, program.ops[5].arg);
+    TEST_ASSERT_EQUAL(5, program.ops[7].arg);
+    bfx_program_free(&program);
+}
+
+void test_bfx_program_build_drops_cancelled_runs(void) {
+    bfx_program_t program;
+    const char*   src = "+>+-<-.<>.";
+
+    /* the '<>' is dropped too, although it is not a no-op at the first cell */
+    TEST_ASSERT_EQUAL(0, bfx_program_build(&program, src, strlen(src), 0, NULL));
+    TEST_ASSERT_EQUAL(1, program.len);
+    TEST_ASSERT_EQUAL(BFX_OP_OUT, program.ops[0].op);
+    TEST_ASSERT_EQUAL(2, program.ops[0].arg);
+    bfx_program_free(&program);
+}
+
+void test_bfx_program_build_unmatched(void) {
+    bfx_program_t    program;
+    bfx_file_index_t error;
+
+    TEST_ASSERT_EQUAL(1, bfx_program_build(&program, "[[]", 3, 0, &error));
+    TEST_ASSERT_EQUAL(0, error.idx);
+    TEST_ASSERT_EQUAL(1, error.line);
+    TEST_ASSERT_EQUAL(1, error.line_idx);
+    TEST_ASSERT_EQUAL(1, bfx_program_build(&program, "[]\n]", 4, 0, &error));
+    TEST_ASSERT_EQUAL(3, error.idx);
+    TEST_ASSERT_EQUAL(2, error.line);
+    TEST_ASSERT_EQUAL(1, error.line_idx);
+}
+
+void test_bfx_builder_feeds_chunks(void) {
+    bfx_program_t program;
+    bfx_builder_t builder;
+
+    bfx_builder_init(&builder, &program, 0);
+    TEST_ASSERT_EQUAL(0, bfx_builder_feed(&builder, "++[>", 4));
+    TEST_ASSERT_EQUAL(0, bfx_builder_feed(&builder, "+\n+]", 4));
+    TEST_ASSERT_EQUAL(0, bfx_builder_finish(&builder));
+    TEST_ASSERT_EQUAL(5, program.len);
+    TEST_ASSERT_EQUAL(2, program.ops[0].arg);
+    TEST_ASSERT_EQUAL(4, program.ops[1].arg);
+    TEST_ASSERT_EQUAL(2, program.ops[3].arg);
+    TEST_ASSERT_EQUAL(1, program.ops[4].arg);
+    TEST_ASSERT_EQUAL(2, program.index[4].line);
+    TEST_ASSERT_EQUAL(7, program.index[4].idx);
+    bfx_program_free(&program);
+}
+
+void test_bfx_program_optimize_idioms(void) {
+    bfx_program_t program;
+    const char*   src = "[-]+++[>>]<[->+>++<<]";
+
+    TEST_ASSERT_EQUAL(0, bfx_program_build(&program, src, strlen(src), 0, NULL));
+    bfx_program_optimize(&program);
+    TEST_ASSERT_EQUAL(6, program.len);
+    TEST_ASSERT_EQUAL(BFX_OP_SET, program.ops[0].op);
+    TEST_ASSERT_EQUAL(3, program.ops[0].arg);
+    TEST_ASSERT_EQUAL(BFX_OP_SCAN, program.ops[1].op);
+    TEST_ASSERT_EQUAL(2, program.ops[1].arg);
+    TEST_ASSERT_EQUAL(BFX_OP_MOVE, program.ops[2].op);
+    TEST_ASSERT_EQUAL(BFX_OP_MULADD, program.ops[3].op);
+    TEST_ASSERT_EQUAL(1, program.ops[3].offset);
+    TEST_ASSERT_EQUAL(1, program.ops[3].arg);
+    TEST_ASSERT_EQUAL(BFX_OP_MULADD, program.ops[4].op);
+    TEST_ASSERT_EQUAL(2, program.ops[4].offset);
+    TEST_ASSERT_EQUAL(2, program.ops[4].arg);
+    TEST_ASSERT_EQUAL(BFX_OP_SET, program.ops[5].op);
+    bfx_program_free(&program);
+}
+
+void test_bfx_program_optimize_relinks_loops(void) {
+    bfx_program_t program;
+    const char*   src = "+[[-]>[-<+>]<.]";
+
+    TEST_ASSERT_EQUAL(0, bfx_program_build(&program, src, strlen(src), 0, NULL));
+    bfx_program_optimize(&program);
+    TEST_ASSERT_EQUAL(9, program.len);
+    TEST_ASSERT_EQUAL(BFX_OP_JZ, program.ops[1].op);
+    TEST_ASSERT_EQUAL(8, program.ops[1].arg);
+    TEST_ASSERT_EQUAL(BFX_OP_JNZ, program.ops[8].op);
+    TEST_ASSERT_EQUAL(1, program.ops[8].arg);
+    TEST_ASSERT_EQUAL(BFX_OP_MULADD, program.ops[4].op);
+    TEST_ASSERT_EQUAL(-1, program.ops[4].offset);
+    bfx_program_free(&program);
+}
+
+void test_bfx_program_optimize_keeps_unbalanced_loops(void) {
+    bfx_program_t program;
+    const char*   src = "[->+]";
+
+    TEST_ASSERT_EQUAL(0, bfx_program_build(&program, src, strlen(src), 0, NULL));
+    bfx_program_optimize(&program);
+    TEST_ASSERT_EQUAL(5, program.len);
+    TEST_ASSERT_EQUAL(BFX_OP_JZ, program.ops[0].op);
+    bfx_program_free(&program);
+}
+
+void test_bfx_program_optimize_folds_offsets(void) {
+    bfx_program_t program;
+    const char*   src = ">+>>-<[.>+<-]";
+
+    TEST_ASSERT_EQUAL(0, bfx_program_build(&program, src, strlen(src), 0, NULL));
+    bfx_program_optimize(&program);
+    TEST_ASSERT_EQUAL(10, program.len);
+    TEST_ASSERT_EQUAL(BFX_OP_CHECK, program.ops[0].op);
+    TEST_ASSERT_EQUAL(0, program.ops[0].arg);
+    TEST_ASSERT_EQUAL(3, program.ops[0].offset);
+    TEST_ASSERT_EQUAL(BFX_OP_ADD, program.ops[1].op);
+    TEST_ASSERT_EQUAL(1, program.ops[1].offset);
+    TEST_ASSERT_EQUAL(BFX_OP_ADD, program.ops[2].op);
+    TEST_ASSERT_EQUAL(3, program.ops[2].offset);
+    TEST_ASSERT_EQUAL(BFX_OP_MOVE, program.ops[3].op);
+    TEST_ASSERT_EQUAL(2, program.ops[3].arg);
+    TEST_ASSERT_EQUAL(BFX_OP_CHECK, program.ops[4].op);
+    TEST_ASSERT_EQUAL(BFX_OP_JZ, program.ops[5].op);
+    TEST_ASSERT_EQUAL(9, program.ops[5].arg);
+    TEST_ASSERT_EQUAL(BFX_OP_OUT, program.ops[6].op);
+    TEST_ASSERT_EQUAL(1, program.ops[7].offset);
+    TEST_ASSERT_EQUAL(BFX_OP_JNZ, program.ops[9].op);
+    TEST_ASSERT_EQUAL(5, program.ops[9].arg);
+    TEST_ASSERT_EQUAL(9, bfx_program_check_end(&program, 4));
+    bfx_program_free(&program);
+}
+
+void test_bfx_program_optimize_fuses_pairs(void) {
+    bfx_program_t program;
+    const char*   src = "+>-[.>-]";
+
+    TEST_ASSERT_EQUAL(0, bfx_program_build(&program, src, strlen(src), 0, NULL));
+    bfx_program_optimize(&program);
+    TEST_ASSERT_EQUAL(8, program.len);
+    TEST_ASSERT_EQUAL(BFX_OP_ADD_MOVE, program.opcodes[0]);
+    TEST_ASSERT_EQUAL(BFX_OP_MOVE_ADD, program.opcodes[1]);
+    TEST_ASSERT_EQUAL(BFX_OP_ADD, program.opcodes[2]);
+    TEST_ASSERT_EQUAL(BFX_OP_JZ, program.opcodes[3]);
+    TEST_ASSERT_EQUAL(BFX_OP_OUT, program.opcodes[4]);
+    TEST_ASSERT_EQUAL(BFX_OP_MOVE_ADD, program.opcodes[5]);
+    TEST_ASSERT_EQUAL(BFX_OP_ADD_JNZ, program.opcodes[6]);
+    /* the second instruction of a pair keeps its own opcode, since jumps land on it */
+    TEST_ASSERT_EQUAL(BFX_OP_JNZ, program.opcodes[7]);
+    TEST_ASSERT_EQUAL(BFX_OP_ADD, program.ops[6].op);
+    bfx_program_free(&program);
+}
+
+void test_bfx_execute_profile_counts_instructions(void) {
+    bfx_program_t    program;
+    bfx_parameters_t params;
+    bfx_t            bf;
+    uint64_t         counts[9] = { 0 };
+    const char*      src       = "++[>+>[-]<<-]";
+
+    memset(&params, 0, sizeof(params));
+    params.tape_size      = 16;
+    params.cell_width     = 8;
+    params.io_buffer_size = 16;
+
+    TEST_ASSERT_EQUAL(0, bfx_program_build(&program, src, strlen(src), 0, NULL));
+    bfx_program_optimize(&program);
+    TEST_ASSERT_EQUAL(7, program.len);
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_state_init(&bf, params));
+
+    bfx_execute_profile(&bf, &program, counts);
+    TEST_ASSERT_EQUAL(1, counts[0]);
+    TEST_ASSERT_EQUAL(1, counts[1]);
+    TEST_ASSERT_EQUAL(1, counts[2]);
+    TEST_ASSERT_EQUAL(2, counts[6]);
+    TEST_ASSERT_EQUAL(2, bf.tape[1]);
+
+    bfx_state_free(&bf);
+    bfx_program_free(&program);
+}
+
+void test_bfx_stats_counts_every_engine(void) {
+    static const int engines[] = { 0, BFX_FLAG_TIERED, BFX_FLAG_THREADED, BFX_FLAG_JIT };
+    bfx_program_t    program;
+    bfx_parameters_t params;
+    bfx_t            bf;
+    FILE*            out;
+    char             line[512];
+    double           ops;
+    double           jz;
+    double           jnz;
+    int              tp_max;
+    size_t           i;
+    const char*      src = "++[>+>[-]<<-]";
+
+    memset(&params, 0, sizeof(params));
+    params.tape_size      = 16;
+    params.cell_width     = 8;
+    params.io_buffer_size = 16;
+
+    TEST_ASSERT_EQUAL(0, bfx_program_build(&program, src, strlen(src), 0, NULL));
+    bfx_program_optimize(&program);
+
+    /* ADD and CHECK, then JZ and twice ADD, SET, ADD and JNZ, whichever engine runs it */
+    for (i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+        params.flags = BFX_FLAG_STATS | engines[i];
+        TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_state_init(&bf, params));
+        TEST_ASSERT_NOT_NULL(out = tmpfile());
+        bfx_stats(&bf, &program, out);
+        rewind(out);
+        TEST_ASSERT_NOT_NULL(fgets(line, sizeof(line), out));
+        TEST_ASSERT_EQUAL(4,
+                          sscanf(line,
+                                 "{\"ops\":%lf,\"wall_s\":%*f,\"ops_per_s\":%*f,\"branches\":"
+                                 "{\"jz\":%lf,\"jnz\":%lf},\"tp_max\":%d,",
+                                 &ops,
+                                 &jz,
+                                 &jnz,
+                                 &tp_max));
+        fclose(out);
+        TEST_ASSERT_EQUAL(11, (int) ops);
+        TEST_ASSERT_EQUAL(1, (int) jz);
+        TEST_ASSERT_EQUAL(2, (int) jnz);
+        TEST_ASSERT_EQUAL(2, tp_max);
+        bfx_state_free(&bf);
+    }
+
+    bfx_program_free(&program);
+}
+
+typedef struct {
+    const char* in;
+    size_t      in_len;
+    char        out[64];
+    size_t      out_len;
+} test_io_t;
+
+static size_t test_read(void* data, uint8_t* buf, size_t size) {
+    test_io_t* io = data;
+    size_t     n  = io->in_len < size ? io->in_len : size;
+
+    memcpy(buf, io->in, n);
+    io->in += n;
+    io->in_len -= n;
+    return n;
+}
+
+static size_t test_write(void* data, const uint8_t* buf, size_t len) {
+    test_io_t* io = data;
+
+    memcpy(io->out + io->out_len, buf, len);
+    io->out_len += len;
+    return len;
+}
+
+void test_bfx_instance_runs_shared_program(void) {
+    bfx_program_t*   program;
+    bfx_instance_t*  first;
+    bfx_instance_t*  second;
+    bfx_parameters_t params;
+    bfx_io_t         io;
+    test_io_t        a = { "abc", 3 };
+    test_io_t        b = { "xy", 2 };
+    const char*      src = ",[+.,]";
+
+    memset(&params, 0, sizeof(params));
+    params.tape_size      = 16;
+    params.cell_width     = 8;
+    params.io_buffer_size = 2;
+
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_program_create(&program, src, strlen(src), 0));
+    io.read  = test_read;
+    io.write = test_write;
+    io.data  = &a;
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_instance_create(&first, program, params, &io));
+    io.data = &b;
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_instance_create(&second, program, params, &io));
+
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_instance_run(second));
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_instance_run(first));
+    TEST_ASSERT_EQUAL(3, a.out_len);
+    TEST_ASSERT_EQUAL(0, memcmp(a.out, "bcd", 3));
+    TEST_ASSERT_EQUAL(2, b.out_len);
+    TEST_ASSERT_EQUAL(0, memcmp(b.out, "yz", 2));
+
+    b.in     = "q";
+    b.in_len = 1;
+    bfx_instance_reset(second);
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_instance_run(second));
+    TEST_ASSERT_EQUAL(3, b.out_len);
+    TEST_ASSERT_EQUAL('r', b.out[2]);
+
+    bfx_instance_destroy(first);
+    bfx_instance_destroy(second);
+    bfx_program_destroy(program);
+}
+
+void test_bfx_instance_writes_repeated_output(void) {
+    bfx_program_t*   program;
+    bfx_instance_t*  instance;
+    bfx_parameters_t params;
+    bfx_io_t         io;
+    test_io_t        t   = { "a", 1 };
+    const char*      src = ",+.....";
+
+    memset(&params, 0, sizeof(params));
+    params.tape_size      = 16;
+    params.cell_width     = 8;
+    params.io_buffer_size = 3;
+
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_program_create(&program, src, strlen(src), 0));
+    TEST_ASSERT_EQUAL(3, program->len);
+    TEST_ASSERT_EQUAL(BFX_OP_OUT, program->ops[2].op);
+    TEST_ASSERT_EQUAL(5, program->ops[2].arg);
+
+    io.read  = test_read;
+    io.write = test_write;
+    io.data  = &t;
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_instance_create(&instance, program, params, &io));
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_instance_run(instance));
+    TEST_ASSERT_EQUAL(5, t.out_len);
+    TEST_ASSERT_EQUAL(0, memcmp(t.out, "bbbbb", 5));
+
+    bfx_instance_destroy(instance);
+    bfx_program_destroy(program);
+}
+
+void test_bfx_instance_runs_tiered(void) {
+    bfx_program_t*   program;
+    bfx_instance_t*  instance;
+    bfx_parameters_t params;
+    bfx_io_t         io;
+    test_io_t        t   = { "x", 1 };
+    const char*      src = ",[>++++++++++++++++++++[>+<--]<-]>>.";
+
+    memset(&params, 0, sizeof(params));
+    params.flags          = BFX_FLAG_TIERED;
+    params.tape_size      = 16;
+    params.cell_width     = 8;
+    params.io_buffer_size = 16;
+
+    /* the inner loop takes 9 backward jumps per entry, so it is compiled partway through */
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_program_create(&program, src, strlen(src), 0));
+    io.read  = test_read;
+    io.write = test_write;
+    io.data  = &t;
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_instance_create(&instance, program, params, &io));
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_instance_run(instance));
+    TEST_ASSERT_EQUAL(1, t.out_len);
+    TEST_ASSERT_EQUAL(120 * 10 % 256, (uint8_t) t.out[0]);
+
+    bfx_instance_destroy(instance);
+    bfx_program_destroy(program);
+}
+
+void test_bfx_instance_runs_many_hot_loops(void) {
+    bfx_program_t*   program;
+    bfx_instance_t*  instance;
+    bfx_parameters_t params;
+    bfx_io_t         io;
+    test_io_t        t    = { "", 0 };
+    const char*      loop = "+>+++++[>+[+>[-]<]<-]<";
+    char             src[200 * 22 + 2];
+    size_t           i;
+
+    /* every inner loop takes 5 * 255 backward jumps, so each of them is compiled */
+    for (i = 0; i < 200; i++) {
+        memcpy(src + i * strlen(loop), loop, strlen(loop));
+    }
+    strcpy(src + i * strlen(loop), ".");
+
+    memset(&params, 0, sizeof(params));
+    params.flags          = BFX_FLAG_TIERED;
+    params.tape_size      = 16;
+    params.cell_width     = 8;
+    params.io_buffer_size = 16;
+
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_program_create(&program, src, strlen(src), 0));
+    io.read  = test_read;
+    io.write = test_write;
+    io.data  = &t;
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_instance_create(&instance, program, params, &io));
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_instance_run(instance));
+    TEST_ASSERT_EQUAL(1, t.out_len);
+    TEST_ASSERT_EQUAL(200, (uint8_t) t.out[0]);
+
+    bfx_instance_destroy(instance);
+    bfx_program_destroy(program);
+}
+
+void test_bfx_instance_folds_moves_at_tape_edge(void) {
+    bfx_program_t*   program;
+    bfx_instance_t*  instance;
+    bfx_parameters_t params;
+    bfx_io_t         io;
+    test_io_t        t   = { "", 0 };
+    const char*      src = "+<>.";
+
+    memset(&params, 0, sizeof(params));
+    params.tape_size      = 16;
+    params.cell_width     = 8;
+    params.io_buffer_size = 16;
+
+    /* the net move is 0, so the pointer stays on the first cell instead of being
+       clamped by the '<' and then moved right by the '>' as it is with -n */
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_program_create(&program, src, strlen(src), 0));
+    io.read  = test_read;
+    io.write = test_write;
+    io.data  = &t;
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_instance_create(&instance, program, params, &io));
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_instance_run(instance));
+    TEST_ASSERT_EQUAL(1, t.out_len);
+    TEST_ASSERT_EQUAL(1, (uint8_t) t.out[0]);
+
+    bfx_instance_destroy(instance);
+    bfx_program_destroy(program);
+}
+
+void test_bfx_instance_unfolds_run_back_to_start(void) {
+    bfx_program_t*   program;
+    bfx_instance_t*  instance;
+    bfx_parameters_t params;
+    bfx_io_t         io;
+    test_io_t        t   = { "", 0 };
+    const char*      src = "+<+>[.[-]]+.";
+
+    memset(&params, 0, sizeof(params));
+    params.tape_size      = 16;
+    params.cell_width     = 8;
+    params.io_buffer_size = 16;
+
+    /* the CHECK of `+<+>` fails, and after the '<' is reset the '>' leaves the pointer
+       on the second cell, so the loop is skipped */
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_program_create(&program, src, strlen(src), 0));
+    io.read  = test_read;
+    io.write = test_write;
+    io.data  = &t;
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_instance_create(&instance, program, params, &io));
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_instance_run(instance));
+    TEST_ASSERT_EQUAL(1, t.out_len);
+    TEST_ASSERT_EQUAL(1, (uint8_t) t.out[0]);
+
+    bfx_instance_destroy(instance);
+    bfx_program_destroy(program);
+}
+
+void test_bfx_instance_runs_fork(void) {
+    bfx_program_t*   program;
+    bfx_instance_t*  instance;
+    bfx_parameters_t params;
+    bfx_io_t         io;
+    test_io_t        t   = { "", 0 };
+    const char*      src = ">++Y.<.";
+
+    memset(&params, 0, sizeof(params));
+    params.flags          = BFX_FLAG_BRAINFORK;
+    params.tape_size      = 16;
+    params.cell_width     = 8;
+    params.io_buffer_size = 16;
+
+    /* without threads the child runs to its end at the 'Y', before the parent goes on */
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK,
+                      bfx_program_create(&program, src, strlen(src), BFX_FLAG_BRAINFORK));
+    io.read  = test_read;
+    io.write = test_write;
+    io.data  = &t;
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_instance_create(&instance, program, params, &io));
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_instance_run(instance));
+    TEST_ASSERT_EQUAL(4, t.out_len);
+    TEST_ASSERT_EQUAL_MEMORY("\1\2\0\0", t.out, 4);
+
+    bfx_instance_destroy(instance);
+    bfx_program_destroy(program);
+}
+
+void test_bfx_instance_flushes_before_fork(void) {
+    bfx_program_t*   program;
+    bfx_instance_t*  instance;
+    bfx_parameters_t params;
+    bfx_io_t         io;
+    test_io_t        t   = { "", 0 };
+    const char*      src = "+.>Y+.";
+
+    memset(&params, 0, sizeof(params));
+    params.flags          = BFX_FLAG_BRAINFORK;
+    params.tape_size      = 16;
+    params.cell_width     = 8;
+    params.io_buffer_size = 16;
+
+    /* the parent's first output is still buffered at the 'Y', but comes before the child's */
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK,
+                      bfx_program_create(&program, src, strlen(src), BFX_FLAG_BRAINFORK));
+    io.read  = test_read;
+    io.write = test_write;
+    io.data  = &t;
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_instance_create(&instance, program, params, &io));
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_instance_run(instance));
+    TEST_ASSERT_EQUAL(3, t.out_len);
+    TEST_ASSERT_EQUAL_MEMORY("\1\2\1", t.out, 3);
+
+    bfx_instance_destroy(instance);
+    bfx_program_destroy(program);
+}
+
+void test_bfx_program_evaluate_skips_prefix(void) {
+    bfx_program_t*   program;
+    bfx_instance_t*  instance;
+    bfx_parameters_t params;
+    bfx_io_t         io;
+    test_io_t        t   = { "z", 1 };
+    const char*      src = "++++++[>++++++++<-]>+.,.";
+
+    memset(&params, 0, sizeof(params));
+    params.tape_size      = 16;
+    params.cell_width     = 8;
+    params.io_buffer_size = 16;
+
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_program_create(&program, src, strlen(src), 0));
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_program_evaluate(program, params));
+    TEST_ASSERT_NOT_NULL(program->prefix);
+    TEST_ASSERT_EQUAL(BFX_OP_IN, program->ops[program->prefix->ip].op);
+    TEST_ASSERT_EQUAL(1, program->prefix->tp);
+    TEST_ASSERT_EQUAL(2, program->prefix->cells);
+    TEST_ASSERT_EQUAL(49, program->prefix->tape[1]);
+    TEST_ASSERT_EQUAL(1, program->prefix->output_len);
+
+    io.read  = test_read;
+    io.write = test_write;
+    io.data  = &t;
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_instance_create(&instance, program, params, &io));
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_instance_run(instance));
+    TEST_ASSERT_EQUAL(2, t.out_len);
+    TEST_ASSERT_EQUAL(0, memcmp(t.out, "1z", 2));
+
+    bfx_instance_destroy(instance);
+    bfx_program_destroy(program);
+}
+
+void test_bfx_snapshot_restores_run(void) {
+    bfx_program_t*   program;
+    bfx_parameters_t params;
+    bfx_t            bf;
+    bfx_t            resumed;
+    test_io_t        a    = { "xy", 2 };
+    test_io_t        b    = { "xy", 2 };
+    const char*      src  = ",>+++>";
+    const char*      path = "test_bfx.snapshot";
+
+    memset(&params, 0, sizeof(params));
+    params.tape_size      = 16;
+    params.cell_width     = 16;
+    params.io_buffer_size = 16;
+
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_program_create(&program, src, strlen(src), 0));
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_state_init(&bf, params));
+    bf.io.read = test_read;
+    bf.io.data = &a;
+    bfx_execute(&bf, program);
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_snapshot_save(&bf, program, path));
+
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_state_init(&resumed, params));
+    resumed.io.read = test_read;
+    resumed.io.data = &b;
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_snapshot_load(&resumed, program, path));
+    TEST_ASSERT_EQUAL(bf.ip, resumed.ip);
+    TEST_ASSERT_EQUAL(2, resumed.tp);
+    TEST_ASSERT_EQUAL(2, resumed.tp_max);
+    TEST_ASSERT_EQUAL('x', ((uint16_t*) resumed.tape)[0]);
+    TEST_ASSERT_EQUAL(3, ((uint16_t*) resumed.tape)[1]);
+    TEST_ASSERT_EQUAL('y', bfx_io_read(&resumed));
+    bfx_state_free(&resumed);
+
+    params.tape_size = 32;
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_state_init(&resumed, params));
+    TEST_ASSERT_EQUAL(BFX_STATUS_INVALID_PARAMETERS, bfx_snapshot_load(&resumed, program, path));
+
+    remove(path);
+    bfx_state_free(&resumed);
+    bfx_state_free(&bf);
+    bfx_program_destroy(program);
+}
+
+void test_bfx_io_open_maps_input(void) {
+    bfx_parameters_t params;
+    bfx_t            bf;
+    FILE*            file;
+    const char*      path = "test_bfx.input";
+
+    memset(&params, 0, sizeof(params));
+    params.tape_size      = 16;
+    params.cell_width     = 8;
+    params.io_buffer_size = 2;
+
+    TEST_ASSERT_NOT_NULL(file = fopen(path, "wb"));
+    fputs("abc", file);
+    fclose(file);
+
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_state_init(&bf, params));
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_io_open(&bf, path));
+    TEST_ASSERT_EQUAL(3, bf.in_mapped);
+    TEST_ASSERT_EQUAL('a', bfx_io_read(&bf));
+    TEST_ASSERT_EQUAL('b', bfx_io_read(&bf));
+    TEST_ASSERT_EQUAL('c', bfx_io_read(&bf));
+    TEST_ASSERT_EQUAL(EOF, bfx_io_read(&bf));
+    TEST_ASSERT_EQUAL(BFX_STATUS_IO_ERROR, bfx_io_open(&bf, "test_bfx.missing"));
+
+    remove(path);
+    bfx_state_free(&bf);
+}
+
+void test_bfx_program_create_reports_errors(void) {
+    bfx_program_t*   program;
+    bfx_instance_t*  instance;
+    bfx_parameters_t params;
+
+    TEST_ASSERT_EQUAL(BFX_STATUS_SYNTAX_ERROR, bfx_program_create(&program, "[[]", 3, 0));
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_program_create(&program, "+", 1, 0));
+
+    memset(&params, 0, sizeof(params));
+    params.tape_size  = 16;
+    params.cell_width = 12;
+    TEST_ASSERT_EQUAL(BFX_STATUS_INVALID_PARAMETERS,
+                      bfx_instance_create(&instance, program, params, NULL));
+    bfx_program_destroy(program);
+}
+
+void test_bfx_batch_run_collects_outputs(void) {
+    bfx_program_t*   program;
+    bfx_parameters_t params;
+    bfx_job_t        jobs[5];
+    char             input[2];
+    size_t           i;
+
+    memset(&params, 0, sizeof(params));
+    memset(jobs, 0, sizeof(jobs));
+    params.tape_size      = 16;
+    params.cell_width     = 8;
+    params.io_buffer_size = 1;
+    params.jobs           = 3;
+
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_program_create(&program, ",+.,+.", 6, 0));
+    for (i = 0; i < 5; i++) {
+        jobs[i].program   = program;
+        jobs[i].input     = (const uint8_t*) "aebfcgdhei" + 2 * i;
+        jobs[i].input_len = 2;
+    }
+    TEST_ASSERT_EQUAL(BFX_STATUS_OK, bfx_batch_run(jobs, 5, params));
+
+    for (i = 0; i < 5; i++) {
+        input[0] = 'a' + i + 1;
+        input[1] = 'e' + i + 1;
+        TEST_ASSERT_EQUAL(BFX_STATUS_OK, jobs[i].status);
+        TEST_ASSERT_EQUAL(2, jobs[i].output_len);
+        TEST_ASSERT_EQUAL(0, memcmp(jobs[i].output, input, 2));
+        free(jobs[i].output);
+    }
+    bfx_program_destroy(program);
+}
+
+void test_bfx_tape_pool_reuses_cleared_tapes(void) {
+    uint8_t* tape;
+    uint8_t* again;
+
+    tape = bfx_tape_acquire(64);
+    TEST_ASSERT_NOT_NULL(tape);
+    tape[3]  = 1;
+    tape[40] = 1;
+    bfx_tape_clear(tape, 64, 4);
+    TEST_ASSERT_EQUAL(0, tape[3]);
+    TEST_ASSERT_EQUAL(1, tape[40]);
+
+    bfx_tape_release(tape, 64, 41);
+    again = bfx_tape_acquire(64);
+    TEST_ASSERT_EQUAL_PTR(tape, again);
+    TEST_ASSERT_EQUAL(0, again[40]);
+    bfx_tape_release(again, 64, 0);
+}